@@ -0,0 +1,256 @@
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace batch
+{
+  namespace
+  {
+    bool readBox(std::istringstream& line, CellBox& box)
+    {
+      return static_cast<bool>(line >> box.i0 >> box.j0 >> box.i1 >> box.j1) && (box.i0 <= box.i1) &&
+             (box.j0 <= box.j1);
+    }
+
+    CellBox clampToInterior(const CellBox& box, const Scene& scene)
+    {
+      // The border of the grid is always solid
+
+      CellBox clamped;
+
+      clamped.i0 = std::max(box.i0, 1);
+      clamped.j0 = std::max(box.j0, 1);
+      clamped.i1 = std::min(box.i1, scene.gridWidth - 2);
+      clamped.j1 = std::min(box.j1, scene.gridHeight - 2);
+
+      return clamped;
+    }
+  }
+
+  Scene::Scene()
+  : gridWidth(0),
+    gridHeight(0),
+    dx(0.0f),
+    picFlipFactor(0.0f),
+    velocityTransfer(mk::physics::kVelocityTransferPicFlip),
+    particlesPerAxis(2),
+    steps(100),
+    cflFactor(1.0f),
+    seed(0),
+    solids(),
+    emitters()
+  {
+  }
+
+  bool loadScene(const std::string& path, Scene& scene, std::string& error)
+  {
+    std::ifstream file(path.c_str());
+
+    if (!file)
+    {
+      error = "cannot open " + path;
+      return false;
+    }
+
+    scene = Scene();
+
+    std::string text;
+    int lineNumber = 0;
+
+    while (std::getline(file, text))
+    {
+      ++lineNumber;
+
+      const std::size_t comment = text.find('#');
+
+      if (comment != std::string::npos)
+      {
+        text.erase(comment);
+      }
+
+      std::istringstream line(text);
+      std::string keyword;
+
+      if (!(line >> keyword))
+      {
+        continue;
+      }
+
+      bool valid = true;
+
+      if (keyword == "grid")
+      {
+        valid = (line >> scene.gridWidth >> scene.gridHeight) && (scene.gridWidth >= 3) && (scene.gridHeight >= 3);
+      }
+      else if (keyword == "dx")
+      {
+        valid = (line >> scene.dx) && (scene.dx > 0.0f);
+      }
+      else if (keyword == "pic_flip")
+      {
+        valid = (line >> scene.picFlipFactor) && (scene.picFlipFactor >= 0.0f) && (scene.picFlipFactor <= 1.0f);
+      }
+      else if (keyword == "transfer")
+      {
+        std::string transfer;
+
+        valid = (line >> transfer) && ((transfer == "pic_flip") || (transfer == "apic"));
+        scene.velocityTransfer = (transfer == "apic") ? mk::physics::kVelocityTransferApic :
+                                                        mk::physics::kVelocityTransferPicFlip;
+      }
+      else if (keyword == "particles_per_axis")
+      {
+        valid = (line >> scene.particlesPerAxis) && (scene.particlesPerAxis > 0);
+      }
+      else if (keyword == "steps")
+      {
+        valid = (line >> scene.steps) && (scene.steps >= 0);
+      }
+      else if (keyword == "cfl")
+      {
+        valid = (line >> scene.cflFactor) && (scene.cflFactor > 0.0f);
+      }
+      else if (keyword == "seed")
+      {
+        valid = static_cast<bool>(line >> scene.seed);
+      }
+      else if (keyword == "solid")
+      {
+        CellBox box;
+
+        valid = readBox(line, box);
+        scene.solids.push_back(box);
+      }
+      else if (keyword == "fluid")
+      {
+        Emitter emitter;
+
+        emitter.velocity = glm::vec2(0.0f);
+        emitter.interval = 0;
+        emitter.stopStep = 0;
+
+        valid = readBox(line, emitter.box);
+
+        if (valid && (line >> emitter.velocity.x))
+        {
+          valid = static_cast<bool>(line >> emitter.velocity.y);
+        }
+
+        scene.emitters.push_back(emitter);
+      }
+      else if (keyword == "emitter")
+      {
+        Emitter emitter;
+
+        valid = readBox(line, emitter.box) && (line >> emitter.velocity.x >> emitter.velocity.y >> emitter.interval) &&
+                (emitter.interval > 0);
+
+        if (valid && !(line >> emitter.stopStep))
+        {
+          emitter.stopStep = -1;
+        }
+
+        scene.emitters.push_back(emitter);
+      }
+      else
+      {
+        valid = false;
+      }
+
+      // Optional arguments may have left the stream failed, anything left after them is an error
+
+      if (valid)
+      {
+        std::string trailing;
+
+        line.clear();
+        valid = !(line >> trailing);
+      }
+
+      if (!valid)
+      {
+        std::ostringstream message;
+        message << path << ":" << lineNumber << ": invalid statement '" << text << "'";
+        error = message.str();
+        return false;
+      }
+    }
+
+    if ((scene.gridWidth == 0) || (scene.dx == 0.0f))
+    {
+      error = path + ": the grid size and dx are required";
+      return false;
+    }
+
+    return true;
+  }
+
+  void setupSolver(const Scene& scene, mk::physics::FLIPSolver2D& solver)
+  {
+    // The solver starts with solid borders and air everywhere else
+
+    for (const CellBox& solid : scene.solids)
+    {
+      const CellBox box = clampToInterior(solid, scene);
+
+      for (int j = box.j0; j <= box.j1; j++)
+      for (int i = box.i0; i <= box.i1; i++)
+      {
+        solver.setCellType(i, j, mk::physics::kCellTypeSolid);
+      }
+    }
+
+    solver.setPicFlipFactor(scene.picFlipFactor);
+    solver.setVelocityTransfer(scene.velocityTransfer);
+  }
+
+  int emitParticles(const Scene& scene, int step, mk::physics::FLIPSolver2D& solver)
+  {
+    std::seed_seq seeds = { scene.seed, static_cast<unsigned int>(step) };
+    std::mt19937 rng(seeds);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    int numEmitted = 0;
+
+    for (const Emitter& emitter : scene.emitters)
+    {
+      const bool active = (emitter.interval == 0) ? (step == 0) :
+                          (((step % emitter.interval) == 0) && ((emitter.stopStep < 0) || (step < emitter.stopStep)));
+
+      if (!active)
+      {
+        continue;
+      }
+
+      const CellBox box = clampToInterior(emitter.box, scene);
+
+      for (int j = box.j0; j <= box.j1; j++)
+      for (int i = box.i0; i <= box.i1; i++)
+      {
+        if (solver.getCellType(i, j) != mk::physics::kCellTypeAir)
+        {
+          continue;
+        }
+
+        // Jittered particles, as the interactive demo paints them
+
+        for (int py = 0; py < scene.particlesPerAxis; py++)
+        for (int px = 0; px < scene.particlesPerAxis; px++)
+        {
+          const float x = (i + (px + 0.1f + 0.8f * uniform(rng)) / scene.particlesPerAxis) * scene.dx;
+          const float y = (j + (py + 0.1f + 0.8f * uniform(rng)) / scene.particlesPerAxis) * scene.dx;
+
+          solver.mParticles.addParticle(glm::vec2(x, y), emitter.velocity);
+          ++numEmitted;
+        }
+
+        solver.setCellType(i, j, mk::physics::kCellTypeFluid);
+      }
+    }
+
+    return numEmitted;
+  }
+}
@@ -0,0 +1,97 @@
+#ifndef SRC_SCENE_H_
+#define SRC_SCENE_H_
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "physics/fluids/FLIPSolver2D.hpp"
+
+namespace batch
+{
+  /**
+   * Inclusive range of cells [i0, i1] x [j0, j1].
+   */
+  struct CellBox
+  {
+    int i0;
+    int j0;
+    int i1;
+    int j1;
+  };
+
+  /**
+   * Fills the air cells of a box with particles, once at the first step or periodically.
+   */
+  struct Emitter
+  {
+    CellBox box;
+    glm::vec2 velocity;
+    int interval;
+    int stopStep;
+  };
+
+  /**
+   * Description of a simulation run without any user interaction. Scene files are plain text with one
+   * statement per line, where '#' starts a comment:
+   *
+   *   grid <width> <height>                       Size of the grid in cells (required).
+   *   dx <size>                                   Size of a cell (required).
+   *   pic_flip <factor>                           PIC/FLIP factor in [0, 1], 0 by default.
+   *   transfer pic_flip|apic                      Velocity transfer between particles and grid, pic_flip by
+   *                                               default. The PIC/FLIP factor is ignored with apic.
+   *   particles_per_axis <count>                  Particles per cell along each axis, 2 by default.
+   *   steps <count>                               Number of steps to simulate, 100 by default.
+   *   cfl <factor>                                Each step is factor * FLIPSolver2D::timeStep(), 1 by default.
+   *   seed <value>                                Seed of the particle jittering, 0 by default.
+   *   solid <i0> <j0> <i1> <j1>                   Makes a box of cells solid.
+   *   fluid <i0> <j0> <i1> <j1> [<u> <v>]         Fills a box of cells with fluid before the first step.
+   *   emitter <i0> <j0> <i1> <j1> <u> <v> <interval> [<stop>]
+   *                                               Fills the air cells of a box with fluid every interval steps,
+   *                                               until the given step.
+   *
+   * The cells in the border of the grid are always solid.
+   */
+  struct Scene
+  {
+    Scene();
+
+    int gridWidth;
+    int gridHeight;
+    float dx;
+    float picFlipFactor;
+    mk::physics::VelocityTransfer velocityTransfer;
+    int particlesPerAxis;
+    int steps;
+    float cflFactor;
+    unsigned int seed;
+    std::vector<CellBox> solids;
+    std::vector<Emitter> emitters;
+  };
+
+  /**
+   * Reads a scene file.
+   *
+   * @param path Path of the file.
+   * @param scene Scene read.
+   * @param error Description of the first error found, if any.
+   * @return True if the scene was read, false otherwise.
+   */
+  bool loadScene(const std::string& path, Scene& scene, std::string& error);
+
+  /**
+   * Sets the cells of a solver as described by a scene, with all cells but the solid ones empty.
+   */
+  void setupSolver(const Scene& scene, mk::physics::FLIPSolver2D& solver);
+
+  /**
+   * Adds the particles of the emitters active in the given step. Their jittering only depends on the seed of the
+   * scene and the step, so a run resumed from a checkpoint emits the same particles as an uninterrupted one.
+   *
+   * @return Number of particles added.
+   */
+  int emitParticles(const Scene& scene, int step, mk::physics::FLIPSolver2D& solver);
+}
+
+#endif  // SRC_SCENE_H_
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "physics/fluids/FLIPSolver2D.hpp"
+#include "physics/fluids/FrameWriter.hpp"
+#include "Scene.hpp"
+
+namespace
+{
+  struct Options
+  {
+    Options()
+    : scenePath(),
+      steps(-1),
+      numThreads(0),
+      csvPath(),
+      jsonPath(),
+      loadPath(),
+      savePath(),
+      framesPath(),
+      frameEncoding("delta")
+    {
+    }
+
+    std::string scenePath;
+    int steps;
+    int numThreads;
+    std::string csvPath;
+    std::string jsonPath;
+    std::string loadPath;
+    std::string savePath;
+    std::string framesPath;
+    std::string frameEncoding;
+  };
+
+  void printUsage(const char* program)
+  {
+    std::cerr << "Usage: " << program << " <scene> [--steps <count>] [--threads <count>] [--csv <path>]"
+              << " [--json <path>] [--load <checkpoint>] [--save <checkpoint>] [--frames <path>]"
+              << " [--frame-encoding raw|quantized|delta]\n\n"
+              << "Runs the FLIP solver on a scene without a window and reports its throughput and the time\n"
+              << "spent in every stage. --steps overrides the steps of the scene, --threads limits the threads\n"
+              << "used (0 uses all of them), --csv and --json export the statistics of every step. --load resumes\n"
+              << "the scene from a checkpoint instead of its first step, and --save writes one after the last step.\n"
+              << "--frames writes the particles and cells of every step from a background thread.\n";
+  }
+
+  bool parseOptions(int argc, char** argv, Options& options)
+  {
+    for (int a = 1; a < argc; a++)
+    {
+      const bool hasValue = (a + 1 < argc);
+
+      if ((std::strcmp(argv[a], "--steps") == 0) && hasValue)
+      {
+        options.steps = std::atoi(argv[++a]);
+      }
+      else if ((std::strcmp(argv[a], "--threads") == 0) && hasValue)
+      {
+        options.numThreads = std::atoi(argv[++a]);
+      }
+      else if ((std::strcmp(argv[a], "--csv") == 0) && hasValue)
+      {
+        options.csvPath = argv[++a];
+      }
+      else if ((std::strcmp(argv[a], "--json") == 0) && hasValue)
+      {
+        options.jsonPath = argv[++a];
+      }
+      else if ((std::strcmp(argv[a], "--load") == 0) && hasValue)
+      {
+        options.loadPath = argv[++a];
+      }
+      else if ((std::strcmp(argv[a], "--save") == 0) && hasValue)
+      {
+        options.savePath = argv[++a];
+      }
+      else if ((std::strcmp(argv[a], "--frames") == 0) && hasValue)
+      {
+        options.framesPath = argv[++a];
+      }
+      else if ((std::strcmp(argv[a], "--frame-encoding") == 0) && hasValue)
+      {
+        options.frameEncoding = argv[++a];
+      }
+      else if ((argv[a][0] != '-') && options.scenePath.empty())
+      {
+        options.scenePath = argv[a];
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    const bool validEncoding = (options.frameEncoding == "raw") || (options.frameEncoding == "quantized") ||
+                               (options.frameEncoding == "delta");
+
+    return !options.scenePath.empty() && validEncoding;
+  }
+
+  template <typename Writer> bool exportStats(const std::string& path, Writer write)
+  {
+    if (path.empty())
+    {
+      return true;
+    }
+
+    std::ofstream file(path.c_str());
+
+    if (!file)
+    {
+      std::cerr << "Error: cannot write " << path << std::endl;
+      return false;
+    }
+
+    write(file);
+
+    return true;
+  }
+
+  void printStageTimings(const mk::physics::SolverStats& stats)
+  {
+    if (stats.getNumSteps() == 0)
+    {
+      std::printf("\nPer-stage timings are not available, build with the MK_PHYSICS_PROFILING option to get them.\n");
+      return;
+    }
+
+    const mk::physics::SolverStageTimings stepTimings = stats.getStepTimings();
+
+    std::printf("\n%-20s %10s %10s %10s %10s %8s\n", "stage", "min ms", "mean ms", "p99 ms", "total ms", "share");
+
+    for (int s = 0; s < mk::physics::kSolverStageCount; s++)
+    {
+      const mk::physics::SolverStage stage = static_cast<mk::physics::SolverStage>(s);
+      const mk::physics::SolverStageTimings timings = stats.getStageTimings(stage);
+
+      std::printf("%-20s %10.3f %10.3f %10.3f %10.1f %7.1f%%\n", mk::physics::getSolverStageName(stage),
+                  timings.minMs, timings.meanMs, timings.p99Ms, timings.totalMs,
+                  100.0 * timings.totalMs / std::max(stepTimings.totalMs, 1e-9));
+    }
+
+    std::printf("%-20s %10.3f %10.3f %10.3f %10.1f\n", "step", stepTimings.minMs, stepTimings.meanMs,
+                stepTimings.p99Ms, stepTimings.totalMs);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+
+  if (!parseOptions(argc, argv, options))
+  {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  batch::Scene scene;
+  std::string error;
+
+  if (!batch::loadScene(options.scenePath, scene, error))
+  {
+    std::cerr << "Error: " << error << std::endl;
+    return 1;
+  }
+
+  const int steps = (options.steps >= 0) ? options.steps : scene.steps;
+
+  mk::physics::FLIPSolver2D solver(scene.gridWidth, scene.gridHeight, scene.dx);
+
+  solver.setNumThreads(options.numThreads);
+  solver.getStats().setCapacity(steps);
+  batch::setupSolver(scene, solver);
+
+  // A checkpoint replaces the initial state of the scene, and the emitters carry on from the step it was saved at
+
+  int firstStep = 0;
+
+  if (!options.loadPath.empty())
+  {
+    try
+    {
+      const mk::physics::FLIPCheckpoint checkpoint(options.loadPath);
+
+      solver.loadCheckpoint(checkpoint);
+      firstStep = checkpoint.getParameters().stepCount;
+    }
+    catch (const mk::physics::FLIPCheckpoint::CheckpointInvalid& exception)
+    {
+      std::cerr << "Error: " << exception.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // Frames are written by a background thread, the simulation only waits for it when its queue is full
+
+  std::unique_ptr<mk::physics::FrameWriter> frameWriter;
+
+  if (!options.framesPath.empty())
+  {
+    mk::physics::FrameWriterOptions frameOptions;
+
+    frameOptions.quantize = (options.frameEncoding != "raw");
+    frameOptions.delta = (options.frameEncoding == "delta");
+
+    try
+    {
+      frameWriter.reset(new mk::physics::FrameWriter(options.framesPath, scene.gridWidth, scene.gridHeight, scene.dx,
+                                                     frameOptions));
+    }
+    catch (const mk::physics::FrameWriter::FrameFileError& exception)
+    {
+      std::cerr << "Error: " << exception.what() << std::endl;
+      return 1;
+    }
+  }
+
+  double simulatedTime = 0.0;
+  long long particleSteps = 0;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  for (int step = firstStep; step < firstStep + steps; step++)
+  {
+    batch::emitParticles(scene, step, solver);
+
+    const float dt = scene.cflFactor * solver.timeStep();
+
+    solver.simulate(dt);
+
+    simulatedTime += dt;
+    particleSteps += solver.mParticles.getNumParticles();
+
+    if (frameWriter)
+    {
+      frameWriter->submit(solver, simulatedTime);
+    }
+  }
+
+  const double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (frameWriter)
+  {
+    frameWriter->close();
+  }
+
+  if (!options.savePath.empty())
+  {
+    try
+    {
+      solver.saveCheckpoint(options.savePath);
+    }
+    catch (const mk::physics::FLIPCheckpoint::CheckpointInvalid& exception)
+    {
+      std::cerr << "Error: " << exception.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // The mean position of the particles changes with any change in the results, so it works as a checksum when
+  // comparing runs
+
+  const mk::physics::Particles2D::PositionView positions = solver.mParticles.getPositions();
+
+  double meanX = 0.0;
+  double meanY = 0.0;
+
+  for (int p = 0; p < positions.size(); p++)
+  {
+    meanX += positions[p].x;
+    meanY += positions[p].y;
+  }
+
+  if (positions.size() > 0)
+  {
+    meanX /= positions.size();
+    meanY /= positions.size();
+  }
+
+  std::printf("scene:          %s (%d x %d cells, dx %g)\n", options.scenePath.c_str(), scene.gridWidth,
+              scene.gridHeight, scene.dx);
+  std::printf("threads:        %d\n", solver.getExecutionPolicy().getNumThreads());
+  std::printf("steps:          %d (%.4f s simulated)\n", steps, simulatedTime);
+  std::printf("particles:      %d\n", positions.size());
+  std::printf("wall time:      %.3f s\n", wallTime);
+  std::printf("throughput:     %.2f steps/s, %.3f M particle steps/s\n", steps / std::max(wallTime, 1e-9),
+              1e-6 * particleSteps / std::max(wallTime, 1e-9));
+  std::printf("mean position:  %.9f %.9f\n", meanX, meanY);
+
+  if (frameWriter)
+  {
+    const mk::physics::FrameWriterStats frameStats = frameWriter->getStats();
+
+    std::printf("frames:         %lld written, %lld dropped, %lld stalled (%.1f ms), %.1f MB%s\n",
+                frameStats.framesWritten, frameStats.framesDropped, frameStats.framesStalled, frameStats.stallMs,
+                frameStats.bytesWritten / (1024.0 * 1024.0), frameStats.failed ? ", write error" : "");
+  }
+
+  printStageTimings(solver.getStats());
+
+  const mk::physics::SolverStats& stats = solver.getStats();
+
+  const bool exported = exportStats(options.csvPath, [&stats](std::ostream& out) { stats.writeCsv(out); }) &&
+                        exportStats(options.jsonPath, [&stats](std::ostream& out) { stats.writeJson(out); });
+
+  return exported ? 0 : 1;
+}
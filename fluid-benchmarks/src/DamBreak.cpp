@@ -0,0 +1,56 @@
+#include "DamBreak.hpp"
+
+#include <chrono>
+#include <random>
+
+namespace benchmarks
+{
+  void setupDamBreak(mk::physics::FLIPSolver2D& solver, int gridSize, int particlesPerAxis, int warmupSteps)
+  {
+    std::mt19937 mersenneTwister;
+    std::uniform_real_distribution<float> uniformDist(0.0f, 1.0f);
+
+    const float dx = 1.0f / gridSize;
+    const float spacing = 1.0f / particlesPerAxis;
+
+    for (int j = 1; j < (gridSize * 6) / 10; j++)
+    for (int i = 1; i < (gridSize * 4) / 10; i++)
+    {
+      for (int rx = 0; rx < particlesPerAxis; rx++)
+      for (int ry = 0; ry < particlesPerAxis; ry++)
+      {
+        const float x = (i + (rx + 0.1f + 0.8f * uniformDist(mersenneTwister)) * spacing) * dx;
+        const float y = (j + (ry + 0.1f + 0.8f * uniformDist(mersenneTwister)) * spacing) * dx;
+
+        solver.mParticles.addParticle(glm::fvec2(x, y), glm::fvec2(0.0f));
+      }
+
+      solver.setCellType(i, j, mk::physics::kCellTypeFluid);
+    }
+
+    for (int step = 0; step < warmupSteps; step++)
+    {
+      solver.simulate(0.5f * solver.timeStep());
+    }
+  }
+
+  double timeStep(mk::physics::FLIPSolver2D& solver)
+  {
+    const float dt = 0.5f * solver.timeStep();
+
+    const auto start = std::chrono::high_resolution_clock::now();
+    solver.simulate(dt);
+    const auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+  }
+
+  double timePressureSolve(mk::physics::FLIPSolver2D& solver)
+  {
+    const auto start = std::chrono::high_resolution_clock::now();
+    solver.solvePressure();
+    const auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef SRC_DAMBREAK_H_
+#define SRC_DAMBREAK_H_
+
+#include "physics/fluids/FLIPSolver2D.hpp"
+
+namespace benchmarks
+{
+  /**
+   * Fills a solver with a column of fluid on the left side of a closed box, and advances it a few steps so that
+   * the state of the solver is representative of a running simulation.
+   *
+   * @param solver Solver with a square grid of gridSize cells per side, and a cell size of 1 / gridSize.
+   * @param gridSize Number of cells per side of the grid.
+   * @param particlesPerAxis The fluid cells get particlesPerAxis x particlesPerAxis jittered particles.
+   * @param warmupSteps Number of steps simulated after filling the box.
+   */
+  void setupDamBreak(mk::physics::FLIPSolver2D& solver, int gridSize, int particlesPerAxis, int warmupSteps);
+
+  /**
+   * Simulates a step of half the time step allowed by the solver.
+   *
+   * @return Wall time of the step in seconds.
+   */
+  double timeStep(mk::physics::FLIPSolver2D& solver);
+
+  /**
+   * Solves the pressure system assembled by the last step again.
+   *
+   * @return Wall time of the solve in seconds.
+   */
+  double timePressureSolve(mk::physics::FLIPSolver2D& solver);
+}
+
+#endif  // SRC_DAMBREAK_H_
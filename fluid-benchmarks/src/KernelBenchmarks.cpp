@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <cstddef>
+#include <cassert>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <boost/numeric/ublas/vector.hpp>
+
+#include "math/AlignedAllocator.hpp"
+#include "physics/fluids/FLIPSolver2D.hpp"
+#include "physics/fluids/PcgKernels.hpp"
+#include "DamBreak.hpp"
+
+namespace
+{
+  const int kMinVectorSize = 1 << 12;
+  const int kMaxVectorSize = 1 << 24;
+  const int kStencilWarmupSteps = 10;
+  const int kStencilParticlesPerAxis = 2;
+
+  template <typename T> struct DamBreakStencil
+  {
+    int numFluidCells;
+    mk::math::AlignedVector<T> coefDiag;
+    mk::math::AlignedVector<T> coefPlusI;
+    mk::math::AlignedVector<T> coefPlusJ;
+    mk::math::AlignedVector<int> neighbourMinusI;
+    mk::math::AlignedVector<int> neighbourPlusI;
+    mk::math::AlignedVector<int> neighbourMinusJ;
+    mk::math::AlignedVector<int> neighbourPlusJ;
+  };
+
+  double doNaiveDotProduct(const std::vector<double>& v1, const std::vector<double>& v2)
+  {
+    assert((v1.size() == v2.size()) && "Dot product can only be done on vectors with the same size");
+
+    double dotProduct = 0.0;
+
+    for (std::size_t i = 0; i < v1.size(); ++i)
+    {
+      dotProduct += (v1[i] * v2[i]);
+    }
+
+    return dotProduct;
+  }
+
+  double doBoostDotProduct(const boost::numeric::ublas::vector<double>& v1,
+                           const boost::numeric::ublas::vector<double>& v2)
+  {
+    return inner_prod(v1, v2);
+  }
+
+  template <typename T> void buildDamBreakStencil(int gridSize, DamBreakStencil<T>& stencil)
+  {
+    // Compacts the pressure system of a running dam break the way FLIPSolver2D does: fluid cells are numbered
+    // tile by tile and in lexicographic order inside each tile, and absent neighbours point to a trailing slot
+
+    mk::physics::FLIPSolver2D solver(gridSize, gridSize, 1.0f / gridSize);
+    benchmarks::setupDamBreak(solver, gridSize, kStencilParticlesPerAxis, kStencilWarmupSteps);
+
+    std::vector<mk::physics::CellType> cellTypes(gridSize * gridSize);
+    solver.getCellTypes(cellTypes.data());
+
+    const int tileSize = mk::physics::kFluidTileSize;
+    const int numTiles = (gridSize + tileSize - 1) / tileSize;
+
+    std::vector<int> compactIndex(gridSize * gridSize, -1);
+    std::vector<int> fluidCells;
+
+    for (int ty = 0; ty < numTiles; ty++)
+    for (int tx = 0; tx < numTiles; tx++)
+    for (int j = ty * tileSize; j < std::min((ty + 1) * tileSize, gridSize); j++)
+    for (int i = tx * tileSize; i < std::min((tx + 1) * tileSize, gridSize); i++)
+    {
+      if (cellTypes[i + j * gridSize] == mk::physics::kCellTypeFluid)
+      {
+        compactIndex[i + j * gridSize] = static_cast<int>(fluidCells.size());
+        fluidCells.push_back(i + j * gridSize);
+      }
+    }
+
+    const int numFluidCells = static_cast<int>(fluidCells.size());
+
+    stencil.numFluidCells = numFluidCells;
+    stencil.coefDiag.assign(numFluidCells + 1, static_cast<T>(0));
+    stencil.coefPlusI.assign(numFluidCells + 1, static_cast<T>(0));
+    stencil.coefPlusJ.assign(numFluidCells + 1, static_cast<T>(0));
+    stencil.neighbourMinusI.assign(numFluidCells, numFluidCells);
+    stencil.neighbourPlusI.assign(numFluidCells, numFluidCells);
+    stencil.neighbourMinusJ.assign(numFluidCells, numFluidCells);
+    stencil.neighbourPlusJ.assign(numFluidCells, numFluidCells);
+
+    // Fluid cells never touch the border of the grid, which is always solid
+
+    const int offsets[4] = { -1, 1, -gridSize, gridSize };
+    mk::math::AlignedVector<int>* neighbours[4] = { &stencil.neighbourMinusI, &stencil.neighbourPlusI,
+                                                    &stencil.neighbourMinusJ, &stencil.neighbourPlusJ };
+
+    for (int k = 0; k < numFluidCells; k++)
+    for (int n = 0; n < 4; n++)
+    {
+      const int neighbour = fluidCells[k] + offsets[n];
+
+      if (cellTypes[neighbour] == mk::physics::kCellTypeSolid)
+      {
+        continue;
+      }
+
+      stencil.coefDiag[k] += static_cast<T>(1);
+
+      if (cellTypes[neighbour] == mk::physics::kCellTypeFluid)
+      {
+        (*neighbours[n])[k] = compactIndex[neighbour];
+
+        if (n == 1)
+        {
+          stencil.coefPlusI[k] = static_cast<T>(-1);
+        }
+        else if (n == 3)
+        {
+          stencil.coefPlusJ[k] = static_cast<T>(-1);
+        }
+      }
+    }
+  }
+
+  void vectorSizeArguments(benchmark::internal::Benchmark* benchmark)
+  {
+    for (int size = kMinVectorSize; size <= kMaxVectorSize; size *= 16)
+    {
+      benchmark->Arg(size);
+    }
+  }
+
+  void kernelArguments(benchmark::internal::Benchmark* benchmark)
+  {
+    // The kernels of instruction sets the CPU does not support fall back to the best supported ones, so those
+    // runs repeat the results of a lower level
+
+    const int simdLevels[] = { mk::physics::kSimdScalar, mk::physics::kSimdSSE2, mk::physics::kSimdAVX2 };
+
+    for (int simdLevel : simdLevels)
+    for (int size = kMinVectorSize; size <= kMaxVectorSize; size *= 16)
+    {
+      benchmark->Args({ size, simdLevel });
+    }
+  }
+
+  void stencilArguments(benchmark::internal::Benchmark* benchmark)
+  {
+    const int simdLevels[] = { mk::physics::kSimdScalar, mk::physics::kSimdSSE2, mk::physics::kSimdAVX2 };
+    const int gridSizes[] = { 128, 256, 512 };
+
+    for (int simdLevel : simdLevels)
+    for (int gridSize : gridSizes)
+    {
+      benchmark->Args({ gridSize, simdLevel });
+    }
+  }
+}
+
+static void naiveDotProduct(benchmark::State& state)
+{
+  const std::size_t size = static_cast<std::size_t>(state.range(0));
+
+  std::vector<double> v1(size, 1.0);
+  std::vector<double> v2(size, 2.0);
+
+  while (state.KeepRunning())
+  {
+    benchmark::DoNotOptimize(doNaiveDotProduct(v1, v2));
+  }
+
+  state.SetBytesProcessed(state.iterations() * 2 * size * sizeof(double));
+}
+BENCHMARK(naiveDotProduct)->Apply(vectorSizeArguments);
+
+static void boostDotProduct(benchmark::State& state)
+{
+  const std::size_t size = static_cast<std::size_t>(state.range(0));
+
+  boost::numeric::ublas::vector<double> v1(size, 1.0);
+  boost::numeric::ublas::vector<double> v2(size, 2.0);
+
+  while (state.KeepRunning())
+  {
+    benchmark::DoNotOptimize(doBoostDotProduct(v1, v2));
+  }
+
+  state.SetBytesProcessed(state.iterations() * 2 * size * sizeof(double));
+}
+BENCHMARK(boostDotProduct)->Apply(vectorSizeArguments);
+
+template <typename T> static void pcgDot(benchmark::State& state)
+{
+  // The SIMD dot product is the one used by the pressure solver, picked at runtime for the CPU
+
+  const int size = static_cast<int>(state.range(0));
+  const mk::physics::PcgKernels<T>& kernels =
+      mk::physics::getPcgKernels<T>(static_cast<mk::physics::SimdLevel>(state.range(1)));
+
+  mk::math::AlignedVector<T> a(size, static_cast<T>(1));
+  mk::math::AlignedVector<T> b(size, static_cast<T>(2));
+
+  while (state.KeepRunning())
+  {
+    benchmark::DoNotOptimize(kernels.dot(a.data(), b.data(), size));
+  }
+
+  state.SetBytesProcessed(state.iterations() * 2 * size * sizeof(T));
+}
+BENCHMARK_TEMPLATE(pcgDot, double)->Apply(kernelArguments);
+BENCHMARK_TEMPLATE(pcgDot, float)->Apply(kernelArguments);
+
+template <typename T> static void pcgAxpyMaxNorm(benchmark::State& state)
+{
+  // alpha is 0 so that the vectors keep their values however many iterations are run
+
+  const int size = static_cast<int>(state.range(0));
+  const mk::physics::PcgKernels<T>& kernels =
+      mk::physics::getPcgKernels<T>(static_cast<mk::physics::SimdLevel>(state.range(1)));
+
+  mk::math::AlignedVector<T> s(size, static_cast<T>(1));
+  mk::math::AlignedVector<T> z(size, static_cast<T>(2));
+  mk::math::AlignedVector<T> p(size, static_cast<T>(0));
+  mk::math::AlignedVector<T> r(size, static_cast<T>(3));
+
+  while (state.KeepRunning())
+  {
+    benchmark::DoNotOptimize(kernels.axpyMaxNorm(0.0, s.data(), z.data(), p.data(), r.data(), size));
+  }
+
+  state.SetBytesProcessed(state.iterations() * 6 * size * sizeof(T));
+}
+BENCHMARK_TEMPLATE(pcgAxpyMaxNorm, double)->Apply(kernelArguments);
+BENCHMARK_TEMPLATE(pcgAxpyMaxNorm, float)->Apply(kernelArguments);
+
+template <typename T> static void pcgXpby(benchmark::State& state)
+{
+  const int size = static_cast<int>(state.range(0));
+  const mk::physics::PcgKernels<T>& kernels =
+      mk::physics::getPcgKernels<T>(static_cast<mk::physics::SimdLevel>(state.range(1)));
+
+  mk::math::AlignedVector<T> z(size, static_cast<T>(1));
+  mk::math::AlignedVector<T> s(size, static_cast<T>(0));
+
+  while (state.KeepRunning())
+  {
+    kernels.xpby(z.data(), 0.5, s.data(), size);
+    benchmark::ClobberMemory();
+  }
+
+  state.SetBytesProcessed(state.iterations() * 3 * size * sizeof(T));
+}
+BENCHMARK_TEMPLATE(pcgXpby, double)->Apply(kernelArguments);
+BENCHMARK_TEMPLATE(pcgXpby, float)->Apply(kernelArguments);
+
+template <typename T> static void pcgApplyStencilDot(benchmark::State& state)
+{
+  // Runs on the pressure system of a dam break, so that the gathers of the neighbours follow the layout the solver
+  // actually produces. The trailing slot of s stays 0, as the kernels require.
+
+  const int gridSize = static_cast<int>(state.range(0));
+  const mk::physics::PcgKernels<T>& kernels =
+      mk::physics::getPcgKernels<T>(static_cast<mk::physics::SimdLevel>(state.range(1)));
+
+  DamBreakStencil<T> system;
+  buildDamBreakStencil(gridSize, system);
+
+  const int numFluidCells = system.numFluidCells;
+
+  mk::physics::PcgStencil<T> stencil;
+  stencil.coefDiag = system.coefDiag.data();
+  stencil.coefPlusI = system.coefPlusI.data();
+  stencil.coefPlusJ = system.coefPlusJ.data();
+  stencil.neighbourMinusI = system.neighbourMinusI.data();
+  stencil.neighbourPlusI = system.neighbourPlusI.data();
+  stencil.neighbourMinusJ = system.neighbourMinusJ.data();
+  stencil.neighbourPlusJ = system.neighbourPlusJ.data();
+
+  mk::math::AlignedVector<T> s(numFluidCells + 1, static_cast<T>(1));
+  mk::math::AlignedVector<T> z(numFluidCells + 1, static_cast<T>(0));
+  s[numFluidCells] = static_cast<T>(0);
+
+  while (state.KeepRunning())
+  {
+    benchmark::DoNotOptimize(kernels.applyStencilDot(stencil, s.data(), z.data(), 0, numFluidCells));
+  }
+
+  state.counters["fluidCells"] = numFluidCells;
+  state.SetBytesProcessed(state.iterations() * numFluidCells * (5 * sizeof(T) + 4 * sizeof(int)));
+}
+BENCHMARK_TEMPLATE(pcgApplyStencilDot, double)->Apply(stencilArguments);
+BENCHMARK_TEMPLATE(pcgApplyStencilDot, float)->Apply(stencilArguments);
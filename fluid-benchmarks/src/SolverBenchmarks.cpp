@@ -0,0 +1,224 @@
+#include <benchmark/benchmark.h>
+
+#include "physics/fluids/FLIPSolver2D.hpp"
+#include "DamBreak.hpp"
+
+namespace
+{
+  const int kWarmupSteps = 10;
+  const int kStageSteps = 30;
+  const int kPressureReferenceSolves = 10;
+  const int kScalingGridSize = 256;
+  const int kScalingReferenceSteps = 5;
+
+  void sceneArguments(benchmark::internal::Benchmark* benchmark)
+  {
+    // Grid size and particles per axis of each fluid cell
+
+    const int gridSizes[] = { 64, 128, 256, 512 };
+
+    for (int gridSize : gridSizes)
+    for (int particlesPerAxis = 1; particlesPerAxis <= 3; particlesPerAxis++)
+    {
+      benchmark->Args({ gridSize, particlesPerAxis });
+    }
+  }
+
+  void stageArguments(benchmark::internal::Benchmark* benchmark)
+  {
+    const int gridSizes[] = { 64, 128, 256, 512 };
+
+    for (int stage = 0; stage < mk::physics::kSolverStageCount; stage++)
+    for (int gridSize : gridSizes)
+    {
+      benchmark->Args({ stage, gridSize, 2 });
+    }
+  }
+}
+
+static void simulateStep(benchmark::State& state)
+{
+  const int gridSize = static_cast<int>(state.range(0));
+
+  mk::physics::FLIPSolver2D solver(gridSize, gridSize, 1.0f / gridSize);
+  benchmarks::setupDamBreak(solver, gridSize, static_cast<int>(state.range(1)), kWarmupSteps);
+
+  while (state.KeepRunning())
+  {
+    solver.simulate(0.5f * solver.timeStep());
+  }
+
+  const int numParticles = solver.mParticles.getNumParticles();
+
+  state.counters["particles"] = numParticles;
+  state.counters["particleSteps"] = benchmark::Counter(static_cast<double>(numParticles) * state.iterations(),
+                                                       benchmark::Counter::kIsRate);
+  state.counters["pcgIterations"] = solver.getPcgIterations();
+  state.counters["activeTiles"] = solver.getActiveTileRatio();
+}
+BENCHMARK(simulateStep)->Apply(sceneArguments)->Unit(benchmark::kMillisecond);
+
+static void solverStage(benchmark::State& state)
+{
+  // Stages are timed inside full steps, so that each one sees the state left by the previous ones. The times come
+  // from the statistics of the solver, which are only collected when mk-physics is built with profiling. The
+  // number of steps is fixed, as the time of the whole steps would otherwise grow with the inverse of the stage.
+
+  const mk::physics::SolverStage stage = static_cast<mk::physics::SolverStage>(state.range(0));
+  const int gridSize = static_cast<int>(state.range(1));
+
+  mk::physics::FLIPSolver2D solver(gridSize, gridSize, 1.0f / gridSize);
+
+  // Particles are only sorted, and distances only computed, when the solver is configured to need them
+
+  if (stage == mk::physics::kSolverStageSort)
+  {
+    solver.setParticleSortInterval(1);
+  }
+  else if (stage == mk::physics::kSolverStageDistance)
+  {
+    solver.setVelocityExtrapolation(mk::physics::kExtrapolationSweeping);
+  }
+
+  benchmarks::setupDamBreak(solver, gridSize, static_cast<int>(state.range(2)), kWarmupSteps);
+
+  state.SetLabel(mk::physics::getSolverStageName(stage));
+
+  while (state.KeepRunning())
+  {
+    solver.simulate(0.5f * solver.timeStep());
+
+    const mk::physics::SolverStats& stats = solver.getStats();
+
+    if (stats.getNumSteps() == 0)
+    {
+      state.SkipWithError("Stage timings need mk-physics built with the MK_PHYSICS_PROFILING option");
+      break;
+    }
+
+    state.SetIterationTime(stats.getStep(stats.getNumSteps() - 1).stageMs[stage] / 1000.0);
+  }
+
+  state.counters["particles"] = solver.mParticles.getNumParticles();
+}
+BENCHMARK(solverStage)->Apply(stageArguments)->Iterations(kStageSteps)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+static void pressureSolveArguments(benchmark::internal::Benchmark* benchmark)
+{
+  const int gridSizes[] = { 128, 256, 512 };
+
+  const int precisions[] = { mk::physics::kPressurePrecisionDouble,
+                             mk::physics::kPressurePrecisionFloat,
+                             mk::physics::kPressurePrecisionFloatRefined };
+
+  const int preconditioners[] = { mk::physics::kPreconditionerMIC, mk::physics::kPreconditionerMultigrid };
+
+  for (int gridSize : gridSizes)
+  for (int preconditioner : preconditioners)
+  for (int precision : precisions)
+  {
+    benchmark->Args({ gridSize, precision, preconditioner });
+  }
+}
+
+static void pressureSolve(benchmark::State& state)
+{
+  // The system is always assembled in double, so the same one is solved with each precision. The double
+  // solve is timed first to report the speedup of the selected precision against it.
+
+  const int gridSize = static_cast<int>(state.range(0));
+
+  mk::physics::FLIPSolver2D solver(gridSize, gridSize, 1.0f / gridSize);
+  benchmarks::setupDamBreak(solver, gridSize, 2, kWarmupSteps);
+
+  solver.setPressurePreconditioner(static_cast<mk::physics::PressurePreconditioner>(state.range(2)));
+
+  double referenceTime = 0.0;
+
+  solver.setPressurePrecision(mk::physics::kPressurePrecisionDouble);
+
+  for (int i = 0; i < kPressureReferenceSolves; i++)
+  {
+    referenceTime += benchmarks::timePressureSolve(solver);
+  }
+
+  referenceTime /= kPressureReferenceSolves;
+
+  solver.setPressurePrecision(static_cast<mk::physics::PressurePrecision>(state.range(1)));
+
+  double time = 0.0;
+  int numSolves = 0;
+
+  while (state.KeepRunning())
+  {
+    time += benchmarks::timePressureSolve(solver);
+    ++numSolves;
+  }
+
+  state.counters["iterations"] = solver.getPcgIterations();
+  state.counters["residual"] = solver.getPcgResidual();
+  state.counters["speedup"] = (numSolves > 0) ? (referenceTime * numSolves / time) : 0.0;
+}
+BENCHMARK(pressureSolve)->Apply(pressureSolveArguments)->Unit(benchmark::kMillisecond);
+
+static void stageScalingArguments(benchmark::internal::Benchmark* benchmark)
+{
+  // A stage equal to kSolverStageCount runs every stage in parallel
+
+  const int numThreads[] = { 1, 2, 4, 8 };
+
+  for (int stage = 0; stage <= mk::physics::kSolverStageCount; stage++)
+  for (int threads : numThreads)
+  {
+    benchmark->Args({ stage, threads });
+  }
+}
+
+static void stageScaling(benchmark::State& state)
+{
+  // Only the selected stage runs in parallel, so the time saved against a fully serial step is the gain of
+  // that stage alone with the given number of threads
+
+  mk::physics::FLIPSolver2D solver(kScalingGridSize, kScalingGridSize, 1.0f / kScalingGridSize);
+  benchmarks::setupDamBreak(solver, kScalingGridSize, 2, kWarmupSteps);
+
+  mk::physics::ExecutionPolicy policy;
+  policy.setNumThreads(static_cast<int>(state.range(1)));
+
+  for (int stage = 0; stage < mk::physics::kSolverStageCount; stage++)
+  {
+    policy.setParallel(static_cast<mk::physics::SolverStage>(stage), false);
+  }
+
+  solver.setExecutionPolicy(policy);
+
+  double referenceTime = 0.0;
+
+  for (int i = 0; i < kScalingReferenceSteps; i++)
+  {
+    referenceTime += benchmarks::timeStep(solver);
+  }
+
+  referenceTime /= kScalingReferenceSteps;
+
+  for (int stage = 0; stage < mk::physics::kSolverStageCount; stage++)
+  {
+    const bool parallel = (stage == state.range(0)) || (state.range(0) == mk::physics::kSolverStageCount);
+    policy.setParallel(static_cast<mk::physics::SolverStage>(stage), parallel);
+  }
+
+  solver.setExecutionPolicy(policy);
+
+  double time = 0.0;
+  int numSteps = 0;
+
+  while (state.KeepRunning())
+  {
+    time += benchmarks::timeStep(solver);
+    ++numSteps;
+  }
+
+  state.counters["savedMs"] = (numSteps > 0) ? (1000.0 * (referenceTime - time / numSteps)) : 0.0;
+  state.counters["speedup"] = (numSteps > 0) ? (referenceTime * numSteps / time) : 0.0;
+}
+BENCHMARK(stageScaling)->Apply(stageScalingArguments)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,488 @@
+#include "BenchmarkComparison.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include <boost/optional.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+namespace benchmarks
+{
+  namespace
+  {
+    // Scales the median absolute deviation of normally distributed samples to their standard deviation
+    const double kMadToStdDev = 1.4826;
+    const int kMinRobustRepetitions = 3;
+
+    struct PendingResult
+    {
+      PendingResult()
+      : mean(0.0),
+        median(0.0),
+        stdDev(0.0),
+        hasMean(false),
+        hasMedian(false),
+        hasStdDev(false)
+      {
+      }
+
+      std::string name;
+      std::string label;
+      std::vector<double> samples;
+      double mean;
+      double median;
+      double stdDev;
+      bool hasMean;
+      bool hasMedian;
+      bool hasStdDev;
+    };
+
+    double toNanoseconds(double time, const std::string& unit)
+    {
+      if (unit == "us")
+      {
+        return time * 1.0e3;
+      }
+      else if (unit == "ms")
+      {
+        return time * 1.0e6;
+      }
+      else if (unit == "s")
+      {
+        return time * 1.0e9;
+      }
+
+      return time;
+    }
+
+    double getMedian(std::vector<double> values)
+    {
+      std::sort(values.begin(), values.end());
+
+      const std::size_t half = values.size() / 2;
+
+      return (values.size() % 2 == 1) ? values[half] : 0.5 * (values[half - 1] + values[half]);
+    }
+
+    double getRelativeMad(const std::vector<double>& samples, double median)
+    {
+      std::vector<double> deviations(samples.size());
+
+      for (std::size_t i = 0; i < samples.size(); i++)
+      {
+        deviations[i] = std::abs(samples[i] - median);
+      }
+
+      return (median > 0.0) ? (kMadToStdDev * getMedian(deviations) / median) : 0.0;
+    }
+
+    bool containsIgnoringCase(const std::string& text, const std::string& pattern)
+    {
+      std::string lowerText(text);
+
+      std::transform(lowerText.begin(), lowerText.end(), lowerText.begin(),
+                     [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+      return lowerText.find(pattern) != std::string::npos;
+    }
+
+    bool startsWith(const std::string& text, const char* prefix)
+    {
+      return text.compare(0, std::string(prefix).size(), prefix) == 0;
+    }
+
+    std::string formatTime(double ns)
+    {
+      const char* units[] = { "ns", "us", "ms", "s" };
+      int unit = 0;
+
+      while ((unit < 3) && (ns >= 1000.0))
+      {
+        ns /= 1000.0;
+        ++unit;
+      }
+
+      char buffer[32];
+      std::snprintf(buffer, sizeof(buffer), "%.3f %s", ns, units[unit]);
+
+      return buffer;
+    }
+
+    std::string formatPercent(double value, bool sign)
+    {
+      char buffer[32];
+      std::snprintf(buffer, sizeof(buffer), sign ? "%+.1f%%" : "%.1f%%", 100.0 * value);
+
+      return buffer;
+    }
+
+    const char* getStatusName(ComparisonStatus status)
+    {
+      switch (status)
+      {
+        case kComparisonFaster:
+          return "faster";
+        case kComparisonSlower:
+          return "SLOWER";
+        case kComparisonAdded:
+          return "new";
+        case kComparisonRemoved:
+          return "removed";
+        default:
+          return "";
+      }
+    }
+
+    std::string getDisplayName(const BenchmarkDelta& delta)
+    {
+      return delta.label.empty() ? delta.name : (delta.name + " [" + delta.label + "]");
+    }
+  }
+
+  ComparisonOptions::ComparisonOptions()
+  : metric(kMetricRealTime),
+    minThreshold(0.05),
+    noiseFactor(3.0),
+    filter()
+  {
+  }
+
+  BenchmarkFileError::BenchmarkFileError(const std::string& path, const std::string& reason)
+  : mWhat("Cannot read benchmark results " + path + ": " + reason)
+  {
+  }
+
+  const char* BenchmarkFileError::what() const noexcept
+  {
+    return mWhat.c_str();
+  }
+
+  std::vector<BenchmarkResult> loadBenchmarkResults(const std::string& path, BenchmarkMetric metric)
+  {
+    std::ifstream file(path.c_str(), std::ios::binary);
+
+    if (!file)
+    {
+      throw BenchmarkFileError(path, "cannot open the file");
+    }
+
+    boost::property_tree::ptree document;
+
+    try
+    {
+      boost::property_tree::read_json(file, document);
+    }
+    catch (const boost::property_tree::json_parser_error& e)
+    {
+      throw BenchmarkFileError(path, e.message() + " at line " + std::to_string(e.line()));
+    }
+
+    // Property trees keep arrays as children with empty keys, and scalars as data without children
+
+    const boost::optional<boost::property_tree::ptree&> entries = document.get_child_optional("benchmarks");
+
+    if (!entries || (entries->empty() && !entries->data().empty()))
+    {
+      throw BenchmarkFileError(path, "there is no benchmarks array");
+    }
+
+    // Repetitions of a benchmark share its run name, and come either as iterations, as aggregates computed by
+    // the library, or both
+
+    const std::string timeKey = (metric == kMetricCpuTime) ? "cpu_time" : "real_time";
+
+    std::vector<PendingResult> pending;
+    std::map<std::string, std::size_t> indices;
+
+    for (const boost::property_tree::ptree::value_type& child : *entries)
+    {
+      if (!child.first.empty())
+      {
+        throw BenchmarkFileError(path, "there is no benchmarks array");
+      }
+
+      const boost::property_tree::ptree& entry = child.second;
+      const boost::optional<bool> failed = entry.get_optional<bool>("error_occurred");
+      const boost::optional<double> entryTime = entry.get_optional<double>(timeKey);
+
+      if ((failed && *failed) || !entryTime)
+      {
+        continue;
+      }
+
+      const std::string runName = entry.get<std::string>("run_name", entry.get<std::string>("name", ""));
+      const double time = toNanoseconds(*entryTime, entry.get<std::string>("time_unit", "ns"));
+
+      std::map<std::string, std::size_t>::const_iterator it = indices.find(runName);
+
+      if (it == indices.end())
+      {
+        it = indices.insert(std::make_pair(runName, pending.size())).first;
+        pending.push_back(PendingResult());
+        pending.back().name = runName;
+      }
+
+      PendingResult& result = pending[it->second];
+
+      if (entry.get<std::string>("run_type", "iteration") != "aggregate")
+      {
+        result.samples.push_back(time);
+
+        if (result.label.empty())
+        {
+          result.label = entry.get<std::string>("label", "");
+        }
+      }
+      else
+      {
+        const std::string aggregate = entry.get<std::string>("aggregate_name", "");
+
+        if (aggregate == "mean")
+        {
+          result.mean = time;
+          result.hasMean = true;
+        }
+        else if (aggregate == "median")
+        {
+          result.median = time;
+          result.hasMedian = true;
+        }
+        else if (aggregate == "stddev")
+        {
+          result.stdDev = time;
+          result.hasStdDev = true;
+        }
+      }
+    }
+
+    std::vector<BenchmarkResult> results;
+
+    for (const PendingResult& result : pending)
+    {
+      BenchmarkResult finished;
+
+      finished.name = result.name;
+      finished.label = result.label;
+      finished.noise = 0.0;
+      finished.numRepetitions = static_cast<int>(result.samples.size());
+
+      if (!result.samples.empty())
+      {
+        finished.medianNs = getMedian(result.samples);
+      }
+      else if (result.hasMedian)
+      {
+        finished.medianNs = result.median;
+      }
+      else if (result.hasMean)
+      {
+        finished.medianNs = result.mean;
+      }
+      else
+      {
+        continue;
+      }
+
+      // The median absolute deviation ignores the odd outlier, but means nothing with fewer than three samples
+
+      if (result.samples.size() >= static_cast<std::size_t>(kMinRobustRepetitions))
+      {
+        finished.noise = getRelativeMad(result.samples, finished.medianNs);
+      }
+      else if (result.hasStdDev && result.hasMean && (result.mean > 0.0))
+      {
+        finished.noise = result.stdDev / result.mean;
+      }
+
+      results.push_back(finished);
+    }
+
+    return results;
+  }
+
+  std::vector<BenchmarkDelta> compareBenchmarks(const std::vector<BenchmarkResult>& baseline,
+                                                const std::vector<BenchmarkResult>& current,
+                                                const ComparisonOptions& options)
+  {
+    std::map<std::string, const BenchmarkResult*> currentByName;
+
+    for (const BenchmarkResult& result : current)
+    {
+      currentByName[result.name] = &result;
+    }
+
+    std::map<std::string, bool> compared;
+    std::vector<BenchmarkDelta> deltas;
+
+    for (const BenchmarkResult& before : baseline)
+    {
+      if (before.name.find(options.filter) == std::string::npos)
+      {
+        continue;
+      }
+
+      std::map<std::string, const BenchmarkResult*>::const_iterator it = currentByName.find(before.name);
+
+      BenchmarkDelta delta;
+
+      delta.name = before.name;
+      delta.label = before.label;
+      delta.group = getBenchmarkGroup(before.name);
+      delta.baselineNs = before.medianNs;
+      delta.currentNs = 0.0;
+      delta.change = 0.0;
+      delta.threshold = 0.0;
+
+      if (it == currentByName.end())
+      {
+        delta.status = kComparisonRemoved;
+        deltas.push_back(delta);
+        continue;
+      }
+
+      const BenchmarkResult& after = *it->second;
+      const double noise = std::sqrt(before.noise * before.noise + after.noise * after.noise);
+
+      delta.currentNs = after.medianNs;
+      delta.change = (before.medianNs > 0.0) ? (after.medianNs / before.medianNs - 1.0) : 0.0;
+      delta.threshold = std::max(options.minThreshold, options.noiseFactor * noise);
+
+      if (delta.change > delta.threshold)
+      {
+        delta.status = kComparisonSlower;
+      }
+      else if (delta.change < -delta.threshold)
+      {
+        delta.status = kComparisonFaster;
+      }
+      else
+      {
+        delta.status = kComparisonUnchanged;
+      }
+
+      compared[before.name] = true;
+      deltas.push_back(delta);
+    }
+
+    for (const BenchmarkResult& after : current)
+    {
+      if ((after.name.find(options.filter) == std::string::npos) || compared.count(after.name))
+      {
+        continue;
+      }
+
+      BenchmarkDelta delta;
+
+      delta.name = after.name;
+      delta.label = after.label;
+      delta.group = getBenchmarkGroup(after.name);
+      delta.status = kComparisonAdded;
+      delta.baselineNs = 0.0;
+      delta.currentNs = after.medianNs;
+      delta.change = 0.0;
+      delta.threshold = 0.0;
+
+      deltas.push_back(delta);
+    }
+
+    return deltas;
+  }
+
+  BenchmarkGroup getBenchmarkGroup(const std::string& name)
+  {
+    if (startsWith(name, "simulateStep") || startsWith(name, "solverStage") || startsWith(name, "stageScaling"))
+    {
+      return kGroupFlipStages;
+    }
+    else if (startsWith(name, "pressureSolve") || startsWith(name, "pcg"))
+    {
+      return kGroupPcg;
+    }
+    else if (containsIgnoringCase(name, "fft"))
+    {
+      return kGroupFft;
+    }
+
+    return kGroupOther;
+  }
+
+  const char* getBenchmarkGroupName(BenchmarkGroup group)
+  {
+    switch (group)
+    {
+      case kGroupFlipStages:
+        return "FLIP stages";
+      case kGroupPcg:
+        return "PCG";
+      case kGroupFft:
+        return "FFT";
+      default:
+        return "Other";
+    }
+  }
+
+  int printComparison(std::ostream& out, const std::vector<BenchmarkDelta>& deltas)
+  {
+    std::size_t nameWidth = 9;
+
+    for (const BenchmarkDelta& delta : deltas)
+    {
+      nameWidth = std::max(nameWidth, getDisplayName(delta).size());
+    }
+
+    std::vector<int> statusCounts(kComparisonRemoved + 1, 0);
+
+    for (int group = 0; group < kGroupCount; group++)
+    {
+      bool header = false;
+
+      for (const BenchmarkDelta& delta : deltas)
+      {
+        if (delta.group != group)
+        {
+          continue;
+        }
+
+        if (!header)
+        {
+          char columns[128];
+          std::snprintf(columns, sizeof(columns), " %14s %14s %9s %9s  %s", "Baseline", "Current", "Change",
+                        "Threshold", "Status");
+
+          out << "\n" << getBenchmarkGroupName(static_cast<BenchmarkGroup>(group)) << "\n";
+          out << std::string(nameWidth, ' ') << columns << "\n";
+          out << std::string(nameWidth + 58, '-') << "\n";
+
+          header = true;
+        }
+
+        const std::string name = getDisplayName(delta);
+        const bool compared = (delta.status != kComparisonAdded) && (delta.status != kComparisonRemoved);
+
+        char row[160];
+        std::snprintf(row, sizeof(row), " %14s %14s %9s %9s  %s",
+                      (delta.status == kComparisonAdded) ? "-" : formatTime(delta.baselineNs).c_str(),
+                      (delta.status == kComparisonRemoved) ? "-" : formatTime(delta.currentNs).c_str(),
+                      compared ? formatPercent(delta.change, true).c_str() : "-",
+                      compared ? formatPercent(delta.threshold, false).c_str() : "-",
+                      getStatusName(delta.status));
+
+        out << name << std::string(nameWidth - name.size(), ' ') << row << "\n";
+
+        ++statusCounts[delta.status];
+      }
+    }
+
+    out << "\n" << deltas.size() << " benchmarks: " << statusCounts[kComparisonSlower] << " slower, "
+        << statusCounts[kComparisonFaster] << " faster, " << statusCounts[kComparisonUnchanged] << " unchanged, "
+        << statusCounts[kComparisonAdded] << " new, " << statusCounts[kComparisonRemoved] << " removed\n";
+
+    return statusCounts[kComparisonSlower];
+  }
+}
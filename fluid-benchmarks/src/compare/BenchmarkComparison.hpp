@@ -0,0 +1,146 @@
+#ifndef SRC_COMPARE_BENCHMARKCOMPARISON_H_
+#define SRC_COMPARE_BENCHMARKCOMPARISON_H_
+
+#include <exception>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace benchmarks
+{
+  enum BenchmarkMetric
+  {
+    kMetricRealTime = 0,
+    kMetricCpuTime
+  };
+
+  enum BenchmarkGroup
+  {
+    kGroupFlipStages = 0,
+    kGroupPcg,
+    kGroupFft,
+    kGroupOther,
+    kGroupCount
+  };
+
+  enum ComparisonStatus
+  {
+    kComparisonUnchanged = 0,
+    kComparisonFaster,
+    kComparisonSlower,
+    kComparisonAdded,
+    kComparisonRemoved
+  };
+
+  /**
+   * Timing of a benchmark gathered from all its repetitions in a Google Benchmark JSON file.
+   */
+  struct BenchmarkResult
+  {
+    std::string name;
+    std::string label;
+
+    /**
+     * Median time of the repetitions in nanoseconds.
+     */
+    double medianNs;
+
+    /**
+     * Spread of the repetitions relative to the median: the median absolute deviation scaled to match the
+     * standard deviation of normally distributed samples. Without the samples, the standard deviation
+     * aggregate over the mean.
+     */
+    double noise;
+
+    int numRepetitions;
+  };
+
+  /**
+   * Options of compareBenchmarks.
+   */
+  struct ComparisonOptions
+  {
+    ComparisonOptions();
+
+    BenchmarkMetric metric;
+
+    /**
+     * Smallest relative change that is significant, however stable the timings are.
+     */
+    double minThreshold;
+
+    /**
+     * The change must also exceed this many times the combined noise of both runs to be significant.
+     */
+    double noiseFactor;
+
+    /**
+     * Only benchmarks whose names contain this text are compared, all of them if empty.
+     */
+    std::string filter;
+  };
+
+  /**
+   * Change of a benchmark between a baseline and a current run.
+   */
+  struct BenchmarkDelta
+  {
+    std::string name;
+    std::string label;
+    BenchmarkGroup group;
+    ComparisonStatus status;
+    double baselineNs;
+    double currentNs;
+
+    /**
+     * Relative change of the median time, positive when the current run is slower.
+     */
+    double change;
+
+    /**
+     * Relative change above which the difference is significant.
+     */
+    double threshold;
+  };
+
+  class BenchmarkFileError : public std::exception
+  {
+  public:
+    BenchmarkFileError(const std::string& path, const std::string& reason);
+    virtual const char* what() const noexcept;
+
+  private:
+    const std::string mWhat;
+  };
+
+  /**
+   * Reads the results of a Google Benchmark JSON file, in the order they were run. Runs that failed are skipped.
+   *
+   * @throw BenchmarkFileError if the file cannot be read or does not hold benchmark results
+   */
+  std::vector<BenchmarkResult> loadBenchmarkResults(const std::string& path, BenchmarkMetric metric);
+
+  /**
+   * Compares the results of two runs. A change is significant when it is larger than both the minimum
+   * threshold and the combined noise of both runs times the noise factor.
+   */
+  std::vector<BenchmarkDelta> compareBenchmarks(const std::vector<BenchmarkResult>& baseline,
+                                                const std::vector<BenchmarkResult>& current,
+                                                const ComparisonOptions& options);
+
+  /**
+   * @return Group of the benchmark with the given name in the comparison table.
+   */
+  BenchmarkGroup getBenchmarkGroup(const std::string& name);
+
+  const char* getBenchmarkGroupName(BenchmarkGroup group);
+
+  /**
+   * Prints the deltas as a table per group, followed by a summary.
+   *
+   * @return Number of significant slowdowns.
+   */
+  int printComparison(std::ostream& out, const std::vector<BenchmarkDelta>& deltas);
+}
+
+#endif  // SRC_COMPARE_BENCHMARKCOMPARISON_H_
@@ -0,0 +1,120 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "BenchmarkComparison.hpp"
+
+namespace
+{
+  const int kExitRegression = 1;
+  const int kExitError = 2;
+
+  struct Options
+  {
+    Options()
+    : baselinePath(),
+      currentPath(),
+      comparison()
+    {
+    }
+
+    std::string baselinePath;
+    std::string currentPath;
+    benchmarks::ComparisonOptions comparison;
+  };
+
+  void printUsage(const char* program)
+  {
+    std::cerr << "Usage: " << program << " <baseline.json> <current.json> [--metric real|cpu]"
+              << " [--threshold <percent>] [--noise-factor <factor>] [--filter <text>]\n\n"
+              << "Compares two Google Benchmark JSON files benchmark by benchmark, using the median of the\n"
+              << "repetitions of each one. A change is significant when it is larger than --threshold (5% by\n"
+              << "default) and than --noise-factor (3 by default) times the combined spread of the repetitions\n"
+              << "of both runs, so run the benchmarks with --benchmark_repetitions for noisy machines. Exits\n"
+              << "with 1 if any benchmark got significantly slower, and with 2 on errors.\n";
+  }
+
+  bool parseOptions(int argc, char** argv, Options& options)
+  {
+    int numPaths = 0;
+
+    for (int a = 1; a < argc; a++)
+    {
+      const bool hasValue = (a + 1 < argc);
+
+      if ((std::strcmp(argv[a], "--metric") == 0) && hasValue)
+      {
+        const std::string metric = argv[++a];
+
+        if ((metric != "real") && (metric != "cpu"))
+        {
+          return false;
+        }
+
+        options.comparison.metric = (metric == "cpu") ? benchmarks::kMetricCpuTime : benchmarks::kMetricRealTime;
+      }
+      else if ((std::strcmp(argv[a], "--threshold") == 0) && hasValue)
+      {
+        options.comparison.minThreshold = std::atof(argv[++a]) / 100.0;
+      }
+      else if ((std::strcmp(argv[a], "--noise-factor") == 0) && hasValue)
+      {
+        options.comparison.noiseFactor = std::atof(argv[++a]);
+      }
+      else if ((std::strcmp(argv[a], "--filter") == 0) && hasValue)
+      {
+        options.comparison.filter = argv[++a];
+      }
+      else if ((argv[a][0] != '-') && (numPaths < 2))
+      {
+        (numPaths++ == 0 ? options.baselinePath : options.currentPath) = argv[a];
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    return (numPaths == 2) && (options.comparison.minThreshold >= 0.0) && (options.comparison.noiseFactor >= 0.0);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+
+  if (!parseOptions(argc, argv, options))
+  {
+    printUsage(argv[0]);
+    return kExitError;
+  }
+
+  try
+  {
+    const std::vector<benchmarks::BenchmarkResult> baseline =
+        benchmarks::loadBenchmarkResults(options.baselinePath, options.comparison.metric);
+    const std::vector<benchmarks::BenchmarkResult> current =
+        benchmarks::loadBenchmarkResults(options.currentPath, options.comparison.metric);
+
+    const std::vector<benchmarks::BenchmarkDelta> deltas =
+        benchmarks::compareBenchmarks(baseline, current, options.comparison);
+
+    if (deltas.empty())
+    {
+      std::cerr << "No benchmarks to compare\n";
+      return kExitError;
+    }
+
+    std::cout << "Baseline: " << options.baselinePath << "\nCurrent:  " << options.currentPath << "\n";
+
+    const int numSlower = benchmarks::printComparison(std::cout, deltas);
+
+    return (numSlower > 0) ? kExitRegression : 0;
+  }
+  catch (const benchmarks::BenchmarkFileError& e)
+  {
+    std::cerr << e.what() << "\n";
+    return kExitError;
+  }
+}
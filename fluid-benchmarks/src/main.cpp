@@ -1,110 +1,54 @@
-#include <cstddef>
-#include <cassert>
-#include <immintrin.h> // AVX2
+#include <cstring>
+#include <vector>
 
 #include <benchmark/benchmark.h>
-#include <boost/numeric/ublas/vector.hpp>
 
 namespace
 {
-  const std::size_t kVectorSize = 100000000;
+  const char* kDefaultOutput = "--benchmark_out=fluid-benchmarks.json";
+  const char* kDefaultOutputFormat = "--benchmark_out_format=json";
 
-  double doNaiveDotProduct(const std::vector<double>& v1, const std::vector<double>& v2)
+  bool hasArgument(int argc, char** argv, const char* prefix)
   {
-    assert((v1.size() == v2.size()) && "Dot product can only be done on vectors with the same size");
-
-    double dotProduct = 0.0;
-
-    for (std::size_t i = 0; i < v1.size(); ++i)
+    for (int a = 1; a < argc; a++)
     {
-      dotProduct += (v1[i] * v2[i]);
+      if (std::strncmp(argv[a], prefix, std::strlen(prefix)) == 0)
+      {
+        return true;
+      }
     }
 
-    return dotProduct;
-  }
-
-  double doBoostDotProduct(const boost::numeric::ublas::vector<double>& v1, const boost::numeric::ublas::vector<double>& v2)
-  {
-    return inner_prod(v1, v2);
+    return false;
   }
+}
 
-  double doSimdDotProduct(const std::vector<double>& v1, const std::vector<double>& v2)
-  {
-    assert((v1.size() == v2.size()) && "Dot product can only be done on vectors with the same size");
-
-    const std::size_t numPacks = v1.size() / 4; // 4 doubles per 256-bit register
-    const std::size_t lastPackSize = v1.size() % 4;
-
-    __m256d accumulated = _mm256_setzero_pd();
-    __m256d a;
-    __m256d b;
-
-    for (std::size_t i = 0; i < numPacks; ++i)
-    {
-      a.m256d_f64[0] = v1[i * 4];
-      a.m256d_f64[1] = v1[i * 4 + 1];
-      a.m256d_f64[2] = v1[i * 4 + 2];
-      a.m256d_f64[3] = v1[i * 4 + 3];
-
-      b.m256d_f64[0] = v2[i * 4];
-      b.m256d_f64[1] = v2[i * 4 + 1];
-      b.m256d_f64[2] = v2[i * 4 + 2];
-      b.m256d_f64[3] = v2[i * 4 + 3];
+int main(int argc, char** argv)
+{
+  // Results are also written as JSON for regression tracking, to fluid-benchmarks.json unless another output
+  // is given with --benchmark_out
 
-      accumulated = _mm256_fmaddsub_pd(a, b, accumulated);
-    }
+  std::vector<char*> arguments(argv, argv + argc);
 
-    const std::size_t lastPackOffset = numPacks * 4;
+  if (!hasArgument(argc, argv, "--benchmark_out="))
+  {
+    arguments.push_back(const_cast<char*>(kDefaultOutput));
 
-    for (std::size_t i = 0; i < 4; ++i)
+    if (!hasArgument(argc, argv, "--benchmark_out_format="))
     {
-      a.m256d_f64[i] = (i < lastPackSize) ? v1[lastPackOffset + i] : 0.0;
-      b.m256d_f64[i] = (i < lastPackSize) ? v2[lastPackOffset + i] : 0.0;
+      arguments.push_back(const_cast<char*>(kDefaultOutputFormat));
     }
-
-    accumulated = _mm256_fmaddsub_pd(a, b, accumulated);
-
-    __m128d accumulatedHigh = _mm256_extractf128_pd(accumulated, 1);
-    __m128d sum = _mm_add_pd(accumulatedHigh, _mm256_castpd256_pd128(accumulated));
-
-    return sum.m128d_f64[0] + sum.m128d_f64[1];
   }
-}
 
-static void naiveDotProduct(benchmark::State& state)
-{
-  std::vector<double> v1(kVectorSize);
-  std::vector<double> v2(kVectorSize);
+  int numArguments = static_cast<int>(arguments.size());
 
-  while (state.KeepRunning())
-  {
-    doNaiveDotProduct(v1, v2);
-  }
-}
-BENCHMARK(naiveDotProduct);
+  benchmark::Initialize(&numArguments, arguments.data());
 
-static void boostDotProduct(benchmark::State& state)
-{
-  boost::numeric::ublas::vector<double> v1(kVectorSize);
-  boost::numeric::ublas::vector<double> v2(kVectorSize);
-
-  while (state.KeepRunning())
+  if (benchmark::ReportUnrecognizedArguments(numArguments, arguments.data()))
   {
-    doBoostDotProduct(v1, v2);
+    return 1;
   }
-}
-BENCHMARK(boostDotProduct);
 
-static void simdDotProduct(benchmark::State& state)
-{
-  std::vector<double> v1(kVectorSize);
-  std::vector<double> v2(kVectorSize);
+  benchmark::RunSpecifiedBenchmarks();
 
-  while (state.KeepRunning())
-  {
-    doSimdDotProduct(v1, v2);
-  }
+  return 0;
 }
-BENCHMARK(simdDotProduct);
-
-BENCHMARK_MAIN();
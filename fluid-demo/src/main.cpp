@@ -13,6 +13,7 @@
 #include "renderer/gl/ShaderProgram.hpp"
 #include "renderer/assets/ResourceLoader.hpp"
 #include "physics/fluids/FLIPSolver2D.hpp"
+#include "trace/TraceRecorder.hpp"
 
 namespace
 {
@@ -31,6 +32,7 @@ namespace
 
   const float kSolverGridSize = 0.02f;
   const float kPicFlipFactor = 0.0f; // It's value must lie within [0, 1].
+  const float kCflNumber = 2.0f; // Cells travelled by the fastest particle in each substep.
 
   class RenderGrid2D
   {
@@ -157,17 +159,18 @@ namespace
     void update(const mk::physics::FLIPSolver2D& flipSolver)
     {  
       const float renderGridCellSize = static_cast<float>(kRenderGridCellSize);
+      const mk::physics::Particles2D::PositionView positions = flipSolver.mParticles.getPositions();
 
-      for (int p = 0; p < flipSolver.mParticles.numParticles; p++)
+      for (int p = 0; p < positions.size(); p++)
       {
-        const float x = flipSolver.mParticles.positions[p].x * (renderGridCellSize / kSolverGridSize);
-        const float y = flipSolver.mParticles.positions[p].y * (renderGridCellSize / kSolverGridSize);
+        const float x = positions[p].x * (renderGridCellSize / kSolverGridSize);
+        const float y = positions[p].y * (renderGridCellSize / kSolverGridSize);
 
         mParticles[p].mPos = glm::vec3(x, y, 0.0f);
         mParticles[p].mColour = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
       }
 
-      mActiveParticles = flipSolver.mParticles.numParticles;
+      mActiveParticles = positions.size();
     }
 
     void upload()
@@ -208,14 +211,17 @@ namespace
       mUniformDist(0.0f, 1.0f),
       mDrawParticles(false)
     {
-      // The solver grid is internally initialised as solid in the domain boundaries and fluid in the rest
-      // of cells (internal cells). Here, we set all internal cells as air (empty) cells.
+      // Every cell holds at most 4 particles, so reserving room for all of them avoids reallocations while painting
 
-      for (int j = 1; j < gridHeight - 1; j++)
-      for (int i = 1; i < gridWidth - 1; i++)
-      {
-        mFlipSolver.setCellType(i, j, mk::physics::kCellTypeAir);
-      }
+      mFlipSolver.mParticles.reserve(gridWidth * gridHeight * 4);
+
+      // Particles are added in painting order, keep them sorted so that the solver walks its grids in order
+
+      mFlipSolver.setParticleSortOrder(mk::physics::kParticleSortMorton);
+      mFlipSolver.setParticleSortInterval(10);
+
+      // The solver grid is internally initialised as solid in the domain boundaries and air (empty) in the
+      // rest of cells (internal cells)
 
       mFlipSolver.setPicFlipFactor(kPicFlipFactor);
 
@@ -366,23 +372,7 @@ namespace
 
     void simulate(double elapsedTime)
     {
-      double dt;
-      double t = 0;
-      bool finished = false;
-
-      while (!finished)
-      {
-        dt = 2. * mFlipSolver.timeStep();
-
-        if (t + dt >= elapsedTime)
-        {
-          dt = elapsedTime - t;
-          finished = true;
-        }
-
-        mFlipSolver.simulate(static_cast<float>(dt));
-        t += dt;
-      }
+      mFlipSolver.advance(static_cast<float>(elapsedTime), kCflNumber);
     }
 
   private:
@@ -402,5 +392,9 @@ int main(int argc, char** argv)
   FLIPDemo2D flipDemo2D("Fluid Fun", kGridWidth, kGridHeight, kRenderGridCellSize);
   flipDemo2D.doRenderLoop(kFramerate);
 
+#ifdef MK_TRACING
+  mk::trace::TraceRecorder::get().writeChromeTrace("fluid-demo.trace.json");
+#endif
+
   return 0;
 }
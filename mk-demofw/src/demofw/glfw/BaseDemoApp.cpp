@@ -7,6 +7,7 @@
 #include <GLFW/glfw3.h>
 
 #include "demofw/IntervalTimer.hpp"
+#include "trace/TraceRecorder.hpp"
 #include "KeyboardProvider.hpp"
 #include "MouseProvider.hpp"
 
@@ -118,6 +119,8 @@ namespace mk
 
       void BaseDemoApp::doRenderLoop(double framerate)
       {
+        MK_TRACE_THREAD_NAME("main");
+
         const double targetFrameTime = (framerate <= 0.0) ? 0.0 : (1.0 / framerate);
 
         IntervalTimer intervalTimer;
@@ -131,14 +134,27 @@ namespace mk
 
           if (elapsedFrameTime >= targetFrameTime)
           {
+            MK_TRACE_SCOPE("demofw", "frame");
+
             elapsedTotalTime += elapsedFrameTime;
-            update(elapsedFrameTime * 1e-9, elapsedTotalTime * 1e-9);
+
+            {
+              MK_TRACE_SCOPE("demofw", "update");
+              update(elapsedFrameTime * 1e-9, elapsedTotalTime * 1e-9);
+            }
 
             elapsedFrameTime = 0;
             intervalTimer.tick();
 
-            render();
-            glfwSwapBuffers(mWindow);
+            {
+              MK_TRACE_SCOPE("demofw", "render");
+              render();
+            }
+
+            {
+              MK_TRACE_SCOPE("demofw", "swap");
+              glfwSwapBuffers(mWindow);
+            }
           }
 
           glfwPollEvents();
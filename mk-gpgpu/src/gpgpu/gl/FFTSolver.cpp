@@ -5,6 +5,7 @@
 
 #include "glfft/glfft.hpp"
 #include "glfft/glfft_gl_interface.hpp"
+#include "trace/TraceRecorder.hpp"
 
 namespace mk
 {
@@ -96,6 +97,8 @@ namespace mk
 
       void FFTSolver::fft2D(DeviceMemory<std::complex<float>>& input, DeviceMemory<std::complex<float>>& output, int sizeX, int sizeY)
       {
+        MK_TRACE_SCOPE("gpgpu", "FFTSolver::fft2D");
+
         GLFFT::FFT& fft = mFFTSolverCache->getFFT(sizeX, sizeY);
 
         GLFFT::GLBuffer inputBuffer(input.getId());
@@ -110,6 +113,8 @@ namespace mk
 
       void FFTSolver::fftInv2D(DeviceMemory<std::complex<float>>& input, DeviceMemory<std::complex<float>>& output, int sizeX, int sizeY)
       {
+        MK_TRACE_SCOPE("gpgpu", "FFTSolver::fftInv2D");
+
         GLFFT::FFT& fft = mFFTSolverCache->getInvFFT(sizeX, sizeY);
 
         GLFFT::GLBuffer inputBuffer(input.getId());
@@ -0,0 +1,104 @@
+#ifndef SRC_MATH_ALIGNEDALLOCATOR_H_
+#define SRC_MATH_ALIGNEDALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace mk
+{
+  namespace math
+  {
+    /**
+     * Standard library compatible allocator that returns memory aligned to the given boundary.
+     *
+     * Useful for containers whose contents are processed with SIMD instructions.
+     *
+     * @tparam T Type of the allocated elements.
+     * @tparam Alignment Alignment in bytes. It must be a power of 2 and a multiple of sizeof(void*).
+     */
+    template <typename T, std::size_t Alignment = 32> class AlignedAllocator
+    {
+    public:
+      typedef T value_type;
+      typedef T* pointer;
+      typedef const T* const_pointer;
+      typedef T& reference;
+      typedef const T& const_reference;
+      typedef std::size_t size_type;
+      typedef std::ptrdiff_t difference_type;
+
+      template <typename U> struct rebind
+      {
+        typedef AlignedAllocator<U, Alignment> other;
+      };
+
+      AlignedAllocator()
+      {
+      }
+
+      template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+      {
+      }
+
+      T* allocate(std::size_t n)
+      {
+        if (0 == n)
+        {
+          return nullptr;
+        }
+
+        void* memory = nullptr;
+
+#ifdef _WIN32
+        memory = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+        if (0 != posix_memalign(&memory, Alignment, n * sizeof(T)))
+        {
+          memory = nullptr;
+        }
+#endif
+
+        if (!memory)
+        {
+          throw std::bad_alloc();
+        }
+
+        return static_cast<T*>(memory);
+      }
+
+      void deallocate(T* p, std::size_t)
+      {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+      }
+    };
+
+    template <typename T, typename U, std::size_t Alignment>
+    bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+    {
+      return true;
+    }
+
+    template <typename T, typename U, std::size_t Alignment>
+    bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+    {
+      return false;
+    }
+
+    /**
+     * std::vector whose storage is aligned to 32 bytes (AVX register size).
+     */
+    template <typename T> using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+  }
+}
+
+#endif  // SRC_MATH_ALIGNEDALLOCATOR_H_
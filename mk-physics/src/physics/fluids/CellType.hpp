@@ -0,0 +1,27 @@
+#ifndef SRC_PHYSICS_FLUIDS_CELLTYPE_H_
+#define SRC_PHYSICS_FLUIDS_CELLTYPE_H_
+
+#include "SparseGrid2D.hpp"
+
+namespace mk
+{
+  namespace physics
+  {
+    enum CellType
+    {
+      kCellTypeAir = 0,
+      kCellTypeFluid,
+      kCellTypeSolid
+    };
+
+    /**
+     * Side in cells of the tiles FLIPSolver2D stores its grids in. Its distance field and multigrid preconditioner
+     * take the cell types in the same tiles.
+     */
+    const int kFluidTileSize = 32;
+
+    typedef SparseGrid2D<CellType, kFluidTileSize> CellTypeGrid;
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_CELLTYPE_H_
@@ -0,0 +1,527 @@
+#include "DistanceField2D.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      const int kTileSize = kFluidTileSize;
+      const int kTileCells = kTileSize * kTileSize;
+      const int kSweepRounds = 2;
+      const float kDefaultBand = 8.0f;
+    }
+
+    DistanceField2D::DistanceField2D(int gridWidth, int gridHeight)
+    : mGridWidth(gridWidth),
+      mGridHeight(gridHeight),
+      mTilesX((gridWidth + kTileSize - 1) / kTileSize),
+      mTilesY((gridHeight + kTileSize - 1) / kTileSize),
+      mMethod(kDistanceFastSweeping),
+      mBand(kDefaultBand),
+      mExecutionPolicy(),
+      mFluidTiles(mTilesX * mTilesY, 0),
+      mActiveTiles(mTilesX * mTilesY, 0),
+      mActiveTileList(),
+      mKnown(gridWidth, gridHeight, 0),
+      mHeap(),
+      mRowDistance(gridWidth, gridHeight, 0)
+    {
+    }
+
+    void DistanceField2D::setMethod(DistanceMethod method)
+    {
+      mMethod = method;
+    }
+
+    DistanceMethod DistanceField2D::getMethod() const
+    {
+      return mMethod;
+    }
+
+    void DistanceField2D::setBand(float band)
+    {
+      mBand = std::max(1.0f, band);
+    }
+
+    float DistanceField2D::getBand() const
+    {
+      return mBand;
+    }
+
+    void DistanceField2D::setExecutionPolicy(const ExecutionPolicy& executionPolicy)
+    {
+      mExecutionPolicy = executionPolicy;
+    }
+
+    void DistanceField2D::compute(const CellTypeGrid& cellType, FloatGrid& phi)
+    {
+      initialise(cellType, phi);
+
+      switch (mMethod)
+      {
+        case kDistanceFastMarching:
+          fastMarching(cellType, phi);
+          break;
+
+        case kDistanceExact:
+          exact(cellType, phi);
+          break;
+
+        default:
+          fastSweeping(cellType, phi);
+          break;
+      }
+    }
+
+    void DistanceField2D::initialise(const CellTypeGrid& cellType, FloatGrid& phi)
+    {
+      const int numTiles = mTilesX * mTilesY;
+      const std::vector<int>& cellTypeTiles = cellType.getAllocatedTiles();
+      const int numCellTypeTiles = static_cast<int>(cellTypeTiles.size());
+
+      // Tiles are active when they are within the band of a tile holding fluid. Only the stored tiles of the cell
+      // types can hold fluid.
+
+      const int tileRadius = static_cast<int>(std::ceil((mBand + 1.0f) / kTileSize));
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStageDistance, numCellTypeTiles * kTileCells);
+
+      std::fill(mFluidTiles.begin(), mFluidTiles.end(), 0);
+
+      #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
+      {
+        #pragma omp for schedule(dynamic, 1)
+        for (int n = 0; n < numCellTypeTiles; n++)
+        {
+          const int t = cellTypeTiles[n];
+          const CellType* types = cellType.getTileData(t);
+
+          bool hasFluid = false;
+
+          for (int c = 0; (c < kTileCells) && !hasFluid; c++)
+          {
+            hasFluid = (types[c] == kCellTypeFluid);
+          }
+
+          mFluidTiles[t] = hasFluid ? 1 : 0;
+        }
+
+        #pragma omp for
+        for (int t = 0; t < numTiles; t++)
+        {
+          const int ti = t % mTilesX;
+          const int tj = t / mTilesX;
+
+          const int ni0 = std::max(0, ti - tileRadius);
+          const int nj0 = std::max(0, tj - tileRadius);
+          const int ni1 = std::min(mTilesX - 1, ti + tileRadius);
+          const int nj1 = std::min(mTilesY - 1, tj + tileRadius);
+
+          bool active = false;
+
+          for (int nj = nj0; (nj <= nj1) && !active; nj++)
+          for (int ni = ni0; (ni <= ni1) && !active; ni++)
+          {
+            active = (mFluidTiles[ni + nj * mTilesX] != 0);
+          }
+
+          mActiveTiles[t] = active ? 1 : 0;
+        }
+      }
+
+      mActiveTileList.clear();
+
+      for (int t = 0; t < numTiles; t++)
+      {
+        if (mActiveTiles[t])
+        {
+          mActiveTileList.push_back(t);
+        }
+      }
+
+      // Cells of the tiles outside the band read as the band
+
+      phi.setBackground(mBand);
+      allocateActiveTiles(phi);
+
+      const int numActiveTiles = static_cast<int>(mActiveTileList.size());
+      const int cellThreads = mExecutionPolicy.getNumThreads(kSolverStageDistance, numActiveTiles * kTileCells);
+
+      #pragma omp parallel for num_threads(cellThreads) if (cellThreads > 1)
+      for (int n = 0; n < numActiveTiles; n++)
+      {
+        const int t = mActiveTileList[n];
+        const CellType* types = cellType.getTileData(t);
+        float* data = phi.getTileData(t);
+
+        for (int c = 0; c < kTileCells; c++)
+        {
+          data[c] = (types && (types[c] == kCellTypeFluid)) ? -0.5f : mBand;
+        }
+      }
+    }
+
+    template <typename T> void DistanceField2D::allocateActiveTiles(SparseGrid2D<T, kFluidTileSize>& grid) const
+    {
+      const int numTiles = mTilesX * mTilesY;
+
+      for (int t = 0; t < numTiles; t++)
+      {
+        if (mActiveTiles[t])
+        {
+          grid.allocateTile(t);
+        }
+        else
+        {
+          grid.releaseTile(t);
+        }
+      }
+    }
+
+    void DistanceField2D::fastSweeping(const CellTypeGrid& cellType, FloatGrid& phi)
+    {
+      // A sweep in direction (di, dj) updates every cell from its (i - di, j) and (i, j - dj) neighbours, so
+      // the tiles lying on the same anti-diagonal (in the direction of the sweep) are independent. Inside a tile the
+      // cells are visited in the order of the sweep, so the result is identical to a serial sweep.
+
+      const int numActiveCells = static_cast<int>(mActiveTileList.size()) * kTileCells;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStageDistance, numActiveCells);
+      const int numDiagonals = mTilesX + mTilesY - 1;
+
+      static const int directions[4][2] = { { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 } };
+
+      #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
+      {
+        for (int r = 0; r < kSweepRounds; r++)
+        for (int s = 0; s < 4; s++)
+        {
+          const int di = directions[s][0];
+          const int dj = directions[s][1];
+
+          for (int d = 0; d < numDiagonals; d++)
+          {
+            const int tj0 = std::max(0, d - mTilesX + 1);
+            const int tj1 = std::min(d, mTilesY - 1);
+
+            #pragma omp for schedule(dynamic, 1)
+            for (int tj = tj0; tj <= tj1; tj++)
+            {
+              const int ti = d - tj;
+              const int tx = (di > 0) ? ti : (mTilesX - 1 - ti);
+              const int ty = (dj > 0) ? tj : (mTilesY - 1 - tj);
+              const int t = tx + ty * mTilesX;
+
+              if (mActiveTiles[t])
+              {
+                sweepTile(cellType, phi, t, di, dj);
+              }
+            }
+          }
+        }
+      }
+    }
+
+    void DistanceField2D::sweepTile(const CellTypeGrid& cellType, FloatGrid& phi, int tile, int di, int dj)
+    {
+      const int i0 = (tile % mTilesX) * kTileSize;
+      const int j0 = (tile / mTilesX) * kTileSize;
+      const int i1 = std::min(i0 + kTileSize, mGridWidth);
+      const int j1 = std::min(j0 + kTileSize, mGridHeight);
+
+      const CellType* types = cellType.getTileData(tile);
+      float* data = phi.getTileData(tile);
+
+      // Cells without an upwind neighbour in either direction are left for the other sweeps. Upwind neighbours in
+      // the next tile are read through the grid, the tiles outside the band reading as the band.
+
+      const int iBegin = (di > 0) ? std::max(i0, 1) : std::min(i1, mGridWidth - 1) - 1;
+      const int iEnd = (di > 0) ? i1 : (i0 - 1);
+      const int jBegin = (dj > 0) ? std::max(j0, 1) : std::min(j1, mGridHeight - 1) - 1;
+      const int jEnd = (dj > 0) ? j1 : (j0 - 1);
+
+      for (int j = jBegin; j != jEnd; j += dj)
+      for (int i = iBegin; i != iEnd; i += di)
+      {
+        const int c = (i - i0) + (j - j0) * kTileSize;
+
+        if (types && (types[c] == kCellTypeFluid))
+        {
+          continue;
+        }
+
+        const bool insideI = (i - di >= i0) && (i - di < i1);
+        const bool insideJ = (j - dj >= j0) && (j - dj < j1);
+        const float a = insideI ? data[c - di] : phi.get(i - di, j);
+        const float b = insideJ ? data[c - dj * kTileSize] : phi.get(i, j - dj);
+
+        data[c] = solveEikonal(a, b, data[c]);
+      }
+    }
+
+    void DistanceField2D::fastMarching(const CellTypeGrid& cellType, FloatGrid& phi)
+    {
+      const std::greater<std::pair<float, int> > compare;
+      const int numActiveTiles = static_cast<int>(mActiveTileList.size());
+
+      allocateActiveTiles(mKnown);
+      mHeap.clear();
+
+      for (int n = 0; n < numActiveTiles; n++)
+      {
+        const int t = mActiveTileList[n];
+        const CellType* types = cellType.getTileData(t);
+        unsigned char* known = mKnown.getTileData(t);
+
+        for (int c = 0; c < kTileCells; c++)
+        {
+          known[c] = (types && (types[c] == kCellTypeFluid)) ? 1 : 0;
+        }
+      }
+
+      // The cells next to the fluid are the initial front, and they all lie in active tiles
+
+      for (int n = 0; n < numActiveTiles; n++)
+      {
+        const int t = mActiveTileList[n];
+        const int i0 = (t % mTilesX) * kTileSize;
+        const int j0 = (t / mTilesX) * kTileSize;
+        const int i1 = std::min(i0 + kTileSize, mGridWidth);
+        const int j1 = std::min(j0 + kTileSize, mGridHeight);
+
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          if (mKnown.get(i, j))
+          {
+            continue;
+          }
+
+          if (((i > 0) && mKnown.get(i - 1, j)) || ((i < (mGridWidth - 1)) && mKnown.get(i + 1, j)) ||
+              ((j > 0) && mKnown.get(i, j - 1)) || ((j < (mGridHeight - 1)) && mKnown.get(i, j + 1)))
+          {
+            const float distance = solveMarching(phi, i, j);
+
+            phi.at(i, j) = distance;
+
+            mHeap.push_back(std::make_pair(distance, i + j * mGridWidth));
+            std::push_heap(mHeap.begin(), mHeap.end(), compare);
+          }
+        }
+      }
+
+      // Cells are accepted in order of increasing distance until the band is reached. Cells may be pushed several
+      // times, only the entry holding their current distance is used. Cells of the tiles outside the band are
+      // farther than the band, so they are never pushed.
+
+      while (!mHeap.empty())
+      {
+        const std::pair<float, int> front = mHeap.front();
+
+        std::pop_heap(mHeap.begin(), mHeap.end(), compare);
+        mHeap.pop_back();
+
+        const int i = front.second % mGridWidth;
+        const int j = front.second / mGridWidth;
+
+        if (mKnown.get(i, j) || (front.first > phi.get(i, j)))
+        {
+          continue;
+        }
+
+        if (front.first >= mBand)
+        {
+          break;
+        }
+
+        mKnown.at(i, j) = 1;
+
+        const int neighbours[4][2] = { { i - 1, j }, { i + 1, j }, { i, j - 1 }, { i, j + 1 } };
+
+        for (int n = 0; n < 4; n++)
+        {
+          const int ni = neighbours[n][0];
+          const int nj = neighbours[n][1];
+
+          if ((ni < 0) || (ni >= mGridWidth) || (nj < 0) || (nj >= mGridHeight) ||
+              !phi.getTileData(phi.getTile(ni, nj)) || mKnown.get(ni, nj))
+          {
+            continue;
+          }
+
+          const float distance = solveMarching(phi, ni, nj);
+          float& current = phi.at(ni, nj);
+
+          if (distance < current)
+          {
+            current = distance;
+
+            mHeap.push_back(std::make_pair(distance, ni + nj * mGridWidth));
+            std::push_heap(mHeap.begin(), mHeap.end(), compare);
+          }
+        }
+      }
+    }
+
+    float DistanceField2D::solveMarching(const FloatGrid& phi, int i, int j) const
+    {
+      // Upwind values are taken from the accepted neighbours only
+
+      float a = mBand;
+      float b = mBand;
+
+      if ((i > 0) && mKnown.get(i - 1, j))
+      {
+        a = std::min(a, phi.get(i - 1, j));
+      }
+      if ((i < (mGridWidth - 1)) && mKnown.get(i + 1, j))
+      {
+        a = std::min(a, phi.get(i + 1, j));
+      }
+      if ((j > 0) && mKnown.get(i, j - 1))
+      {
+        b = std::min(b, phi.get(i, j - 1));
+      }
+      if ((j < (mGridHeight - 1)) && mKnown.get(i, j + 1))
+      {
+        b = std::min(b, phi.get(i, j + 1));
+      }
+
+      return solveEikonal(a, b, mBand);
+    }
+
+    void DistanceField2D::exact(const CellTypeGrid& cellType, FloatGrid& phi)
+    {
+      // Separable distance transform limited to the band: the horizontal distance to the closest fluid cell of
+      // each row is found first, and then combined with the rows above and below within the band. Tiles outside
+      // the band hold no fluid, so the rows cross them in one step, and their distances read as far.
+
+      const int numActiveTiles = static_cast<int>(mActiveTileList.size());
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStageDistance, numActiveTiles * kTileCells);
+      const int radius = static_cast<int>(std::ceil(mBand + 0.5f));
+      const int farDistance = radius + 1;
+      const float maxDistance = mBand + 0.5f;
+
+      mRowDistance.setBackground(farDistance);
+      allocateActiveTiles(mRowDistance);
+
+      #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
+      {
+        #pragma omp for
+        for (int j = 0; j < mGridHeight; j++)
+        {
+          const int ty = j / kTileSize;
+          const int row = (j % kTileSize) * kTileSize;
+
+          int distance = farDistance;
+
+          for (int tx = 0; tx < mTilesX; tx++)
+          {
+            const int t = tx + ty * mTilesX;
+            const int width = std::min(kTileSize, mGridWidth - tx * kTileSize);
+            int* rowDistance = mRowDistance.getTileData(t);
+
+            if (!rowDistance)
+            {
+              distance = std::min(distance + width, farDistance);
+              continue;
+            }
+
+            const CellType* types = cellType.getTileData(t);
+
+            for (int i = 0; i < width; i++)
+            {
+              const bool fluid = types && (types[row + i] == kCellTypeFluid);
+
+              distance = fluid ? 0 : std::min(distance + 1, farDistance);
+              rowDistance[row + i] = distance;
+            }
+          }
+
+          distance = farDistance;
+
+          for (int tx = mTilesX - 1; tx >= 0; tx--)
+          {
+            const int t = tx + ty * mTilesX;
+            const int width = std::min(kTileSize, mGridWidth - tx * kTileSize);
+            int* rowDistance = mRowDistance.getTileData(t);
+
+            if (!rowDistance)
+            {
+              distance = std::min(distance + width, farDistance);
+              continue;
+            }
+
+            const CellType* types = cellType.getTileData(t);
+
+            for (int i = width - 1; i >= 0; i--)
+            {
+              const bool fluid = types && (types[row + i] == kCellTypeFluid);
+
+              distance = fluid ? 0 : std::min(distance + 1, farDistance);
+              rowDistance[row + i] = std::min(rowDistance[row + i], distance);
+            }
+          }
+        }
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int n = 0; n < numActiveTiles; n++)
+        {
+          const int t = mActiveTileList[n];
+          const int i0 = (t % mTilesX) * kTileSize;
+          const int j0 = (t / mTilesX) * kTileSize;
+          const int i1 = std::min(i0 + kTileSize, mGridWidth);
+          const int j1 = std::min(j0 + kTileSize, mGridHeight);
+
+          const CellType* types = cellType.getTileData(t);
+          float* data = phi.getTileData(t);
+
+          for (int j = j0; j < j1; j++)
+          {
+            const int nj0 = std::max(0, j - radius);
+            const int nj1 = std::min(mGridHeight - 1, j + radius);
+
+            for (int i = i0; i < i1; i++)
+            {
+              const int c = (i - i0) + (j - j0) * kTileSize;
+
+              if (types && (types[c] == kCellTypeFluid))
+              {
+                continue;
+              }
+
+              int best = farDistance * farDistance;
+
+              for (int nj = nj0; nj <= nj1; nj++)
+              {
+                const int di = mRowDistance.get(i, nj);
+                const int dj = nj - j;
+
+                best = std::min(best, di * di + dj * dj);
+              }
+
+              data[c] = std::min(mBand, std::min(maxDistance, std::sqrt(static_cast<float>(best))) - 0.5f);
+            }
+          }
+        }
+      }
+    }
+
+    float DistanceField2D::solveEikonal(float a, float b, float current) const
+    {
+      // Upwind solution of |grad phi| = 1 with unit spacing
+
+      const float dif = a - b;
+
+      if (std::fabs(dif) >= 1.0f)
+      {
+        return std::min(current, std::min(a, b) + 1.0f);
+      }
+
+      return std::min(current, (a + b + std::sqrt(2.0f - dif * dif)) / 2.0f);
+    }
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef SRC_PHYSICS_FLUIDS_DISTANCEFIELD2D_H_
+#define SRC_PHYSICS_FLUIDS_DISTANCEFIELD2D_H_
+
+#include <utility>
+#include <vector>
+
+#include "CellType.hpp"
+#include "ExecutionPolicy.hpp"
+#include "SparseGrid2D.hpp"
+
+namespace mk
+{
+  namespace physics
+  {
+    enum DistanceMethod
+    {
+      kDistanceFastSweeping = 0,
+      kDistanceFastMarching,
+      kDistanceExact
+    };
+
+    /**
+     * Distance from every cell of a grid to the fluid, measured in cells, as needed by FLIPSolver2D to
+     * extrapolate velocities out of the fluid.
+     *
+     * Fluid cells get a distance of -0.5, so the surface lies half a cell away from the centre of the outermost
+     * fluid cells. Only a band of the given width around the fluid is computed, every cell farther than that
+     * keeps the width of the band as distance. The field is stored in the tiles of the cell types, and only the
+     * tiles within the band of a tile holding fluid are allocated. The methods available are:
+     *
+     *  - Fast sweeping: Gauss-Seidel sweeps in the four diagonal directions, run on tiles so that the tiles on
+     *    the same anti-diagonal (in the direction of the sweep) are processed concurrently. Tiles farther than
+     *    the band from any fluid are skipped.
+     *  - Fast marching: the band is grown from the surface in order of increasing distance with a heap. Serial,
+     *    but it visits each cell of the band a constant number of times.
+     *  - Exact: euclidean distance to the centre of the closest fluid cell, minus half a cell, found with a
+     *    separable transform. Its cost per cell grows with the width of the band, so it is meant for thin bands.
+     */
+    class DistanceField2D
+    {
+    public:
+      /**
+       * @param gridWidth Width of the grid in cells.
+       * @param gridHeight Height of the grid in cells.
+       */
+      DistanceField2D(int gridWidth, int gridHeight);
+
+      void setMethod(DistanceMethod method);
+      DistanceMethod getMethod() const;
+
+      /**
+       * @param band Width in cells of the band around the fluid where distances are computed. Values under 1 are
+       *             clamped to 1.
+       */
+      void setBand(float band);
+      float getBand() const;
+
+      /**
+       * @param executionPolicy Policy deciding the threads used, as part of the distance stage.
+       */
+      void setExecutionPolicy(const ExecutionPolicy& executionPolicy);
+
+      /**
+       * Computes the distance field of the given cells. Tiles of phi outside the band are released, and read as
+       * the width of the band.
+       *
+       * @param cellType Type of every cell, cells of the tiles not stored being air.
+       * @param phi Output distance of every cell, with the size of cellType.
+       */
+      void compute(const CellTypeGrid& cellType, SparseGrid2D<float, kFluidTileSize>& phi);
+
+    private:
+      typedef SparseGrid2D<float, kFluidTileSize> FloatGrid;
+
+    private:
+      void initialise(const CellTypeGrid& cellType, FloatGrid& phi);
+      template <typename T> void allocateActiveTiles(SparseGrid2D<T, kFluidTileSize>& grid) const;
+      void fastSweeping(const CellTypeGrid& cellType, FloatGrid& phi);
+      void sweepTile(const CellTypeGrid& cellType, FloatGrid& phi, int tile, int di, int dj);
+      void fastMarching(const CellTypeGrid& cellType, FloatGrid& phi);
+      float solveMarching(const FloatGrid& phi, int i, int j) const;
+      void exact(const CellTypeGrid& cellType, FloatGrid& phi);
+      float solveEikonal(float a, float b, float current) const;
+
+    private:
+      int mGridWidth;
+      int mGridHeight;
+      int mTilesX;
+      int mTilesY;
+      DistanceMethod mMethod;
+      float mBand;
+      ExecutionPolicy mExecutionPolicy;
+      std::vector<unsigned char> mFluidTiles;
+      std::vector<unsigned char> mActiveTiles;
+      std::vector<int> mActiveTileList;
+      SparseGrid2D<unsigned char, kFluidTileSize> mKnown;
+      std::vector<std::pair<float, int> > mHeap;
+      SparseGrid2D<int, kFluidTileSize> mRowDistance;
+    };
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_DISTANCEFIELD2D_H_
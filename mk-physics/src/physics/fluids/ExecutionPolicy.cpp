@@ -0,0 +1,78 @@
+#include "ExecutionPolicy.hpp"
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      const int kMinParticlesPerThread = 2048;
+      const int kMinCellsPerThread = 4096;
+    }
+
+    ExecutionPolicy::ExecutionPolicy()
+    : mNumThreads(0)
+    {
+      for (int s = 0; s < kSolverStageCount; s++)
+      {
+        mParallel[s] = true;
+        mMinWorkPerThread[s] = kMinCellsPerThread;
+      }
+
+      mMinWorkPerThread[kSolverStageAdvection] = kMinParticlesPerThread;
+      mMinWorkPerThread[kSolverStageSort] = kMinParticlesPerThread;
+      mMinWorkPerThread[kSolverStageParticlesToGrid] = kMinParticlesPerThread;
+      mMinWorkPerThread[kSolverStageGridToParticles] = kMinParticlesPerThread;
+    }
+
+    void ExecutionPolicy::setNumThreads(int numThreads)
+    {
+      mNumThreads = std::max(0, numThreads);
+    }
+
+    int ExecutionPolicy::getNumThreads() const
+    {
+#ifdef _OPENMP
+      return (mNumThreads > 0) ? mNumThreads : omp_get_max_threads();
+#else
+      return 1;
+#endif
+    }
+
+    void ExecutionPolicy::setParallel(SolverStage stage, bool parallel)
+    {
+      mParallel[stage] = parallel;
+    }
+
+    bool ExecutionPolicy::isParallel(SolverStage stage) const
+    {
+      return mParallel[stage];
+    }
+
+    void ExecutionPolicy::setMinWorkPerThread(SolverStage stage, int minWorkPerThread)
+    {
+      mMinWorkPerThread[stage] = std::max(1, minWorkPerThread);
+    }
+
+    int ExecutionPolicy::getMinWorkPerThread(SolverStage stage) const
+    {
+      return mMinWorkPerThread[stage];
+    }
+
+    int ExecutionPolicy::getNumThreads(SolverStage stage, int workSize) const
+    {
+      if (!mParallel[stage])
+      {
+        return 1;
+      }
+
+      return std::max(1, std::min(getNumThreads(), workSize / mMinWorkPerThread[stage]));
+    }
+  }
+}
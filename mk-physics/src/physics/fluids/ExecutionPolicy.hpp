@@ -0,0 +1,71 @@
+#ifndef SRC_PHYSICS_FLUIDS_EXECUTIONPOLICY_H_
+#define SRC_PHYSICS_FLUIDS_EXECUTIONPOLICY_H_
+
+namespace mk
+{
+  namespace physics
+  {
+    enum SolverStage
+    {
+      kSolverStageAdvection = 0,
+      kSolverStageSort,
+      kSolverStageParticlesToGrid,
+      kSolverStageGridUpdate,
+      kSolverStageDistance,
+      kSolverStageExtrapolation,
+      kSolverStagePressure,
+      kSolverStageGridToParticles,
+      kSolverStageCount
+    };
+
+    /**
+     * Decides how many threads each stage of a simulation step runs on.
+     *
+     * Every stage can be made serial independently, and parallel regions never use more threads than the
+     * configured maximum, nor more than its amount of work allows: each thread gets at least a minimum number of
+     * items (particles or cells) of the stage, so small problems do not pay the cost of waking up threads.
+     */
+    class ExecutionPolicy
+    {
+    public:
+      /**
+       * Creates a policy running every stage in parallel using all the available threads.
+       */
+      ExecutionPolicy();
+
+      /**
+       * @param numThreads Maximum number of threads of any parallel region. 0 uses all the available threads.
+       */
+      void setNumThreads(int numThreads);
+
+      /**
+       * @return Maximum number of threads of any parallel region. Always 1 when built without OpenMP.
+       */
+      int getNumThreads() const;
+
+      void setParallel(SolverStage stage, bool parallel);
+      bool isParallel(SolverStage stage) const;
+
+      /**
+       * @param stage Stage of the simulation step.
+       * @param minWorkPerThread Minimum number of items processed by each thread of the stage.
+       */
+      void setMinWorkPerThread(SolverStage stage, int minWorkPerThread);
+      int getMinWorkPerThread(SolverStage stage) const;
+
+      /**
+       * @param stage Stage of the simulation step.
+       * @param workSize Number of items processed by the parallel region.
+       * @return Number of threads the region should use, 1 meaning it should be run serially.
+       */
+      int getNumThreads(SolverStage stage, int workSize) const;
+
+    private:
+      int mNumThreads;
+      bool mParallel[kSolverStageCount];
+      int mMinWorkPerThread[kSolverStageCount];
+    };
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_EXECUTIONPOLICY_H_
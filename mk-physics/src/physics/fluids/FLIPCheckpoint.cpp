@@ -0,0 +1,365 @@
+#include "FLIPCheckpoint.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      const char kMagic[8] = { 'M', 'K', 'F', 'L', 'I', 'P', 'C', 'K' };
+      const std::uint32_t kByteOrderMark = 0x01020304;
+
+      struct FileHeader
+      {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrderMark;
+        std::uint32_t headerSize;
+        std::uint32_t numSections;
+        std::uint64_t fileSize;
+      };
+
+      struct SectionEntry
+      {
+        std::uint32_t id;
+        std::uint32_t elementSize;
+        std::uint64_t count;
+        std::uint64_t offset;
+      };
+
+      static_assert(sizeof(FileHeader) == 32, "The checkpoint header must not have padding");
+      static_assert(sizeof(SectionEntry) == 24, "The checkpoint section entries must not have padding");
+      static_assert(sizeof(CheckpointParameters) == 104, "The checkpoint parameters must not have padding");
+
+      bool isLittleEndian()
+      {
+        const std::uint32_t value = 1;
+        unsigned char firstByte;
+
+        std::memcpy(&firstByte, &value, 1);
+
+        return firstByte == 1;
+      }
+
+      std::uint64_t alignOffset(std::uint64_t offset)
+      {
+        const std::uint64_t alignment = FLIPCheckpoint::kSectionAlignment;
+
+        return (offset + alignment - 1) / alignment * alignment;
+      }
+    }
+
+    FLIPCheckpoint::CheckpointInvalid::CheckpointInvalid(const std::string& path, const std::string& reason)
+    : mWhat("Invalid checkpoint " + path + ": " + reason)
+    {
+    }
+
+    const char* FLIPCheckpoint::CheckpointInvalid::what() const noexcept
+    {
+      return mWhat.c_str();
+    }
+
+    FLIPCheckpoint::FLIPCheckpoint(const std::string& path)
+    : mPath(path),
+      mData(nullptr),
+      mSize(0),
+      mParameters()
+    {
+      std::fill(mSectionElementSize, mSectionElementSize + kCheckpointSectionCount, 0);
+      std::fill(mSectionCount, mSectionCount + kCheckpointSectionCount, 0);
+      std::fill(mSectionOffset, mSectionOffset + kCheckpointSectionCount, 0);
+
+      if (!isLittleEndian())
+      {
+        throw CheckpointInvalid(path, "only little endian hosts are supported");
+      }
+
+#ifdef _WIN32
+      HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+
+      if (file == INVALID_HANDLE_VALUE)
+      {
+        throw CheckpointInvalid(path, "cannot open the file");
+      }
+
+      LARGE_INTEGER fileSize;
+
+      if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart < static_cast<LONGLONG>(sizeof(FileHeader))))
+      {
+        CloseHandle(file);
+        throw CheckpointInvalid(path, "the file is too small");
+      }
+
+      // The view keeps the mapping alive, so both handles can be closed right away
+
+      HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+      if (mapping)
+      {
+        CloseHandle(mapping);
+      }
+
+      CloseHandle(file);
+
+      if (!data)
+      {
+        throw CheckpointInvalid(path, "cannot map the file");
+      }
+
+      mData = static_cast<const unsigned char*>(data);
+      mSize = static_cast<std::size_t>(fileSize.QuadPart);
+#else
+      const int file = open(path.c_str(), O_RDONLY);
+
+      if (file < 0)
+      {
+        throw CheckpointInvalid(path, "cannot open the file");
+      }
+
+      struct stat fileStat;
+
+      if ((fstat(file, &fileStat) != 0) || (fileStat.st_size < static_cast<off_t>(sizeof(FileHeader))))
+      {
+        close(file);
+        throw CheckpointInvalid(path, "the file is too small");
+      }
+
+      // The mapping keeps its own reference to the file, so the descriptor can be closed right away
+
+      void* data = mmap(nullptr, static_cast<std::size_t>(fileStat.st_size), PROT_READ, MAP_SHARED, file, 0);
+      close(file);
+
+      if (data == MAP_FAILED)
+      {
+        throw CheckpointInvalid(path, "cannot map the file");
+      }
+
+      mData = static_cast<const unsigned char*>(data);
+      mSize = static_cast<std::size_t>(fileStat.st_size);
+#endif
+
+      // From here on the mapping must be released before throwing, as the destructor will not run
+
+      try
+      {
+        FileHeader header;
+        std::memcpy(&header, mData, sizeof(header));
+
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+        {
+          throw CheckpointInvalid(path, "not a checkpoint file");
+        }
+
+        if (header.version != kVersion)
+        {
+          throw CheckpointInvalid(path, "unsupported version " + std::to_string(header.version));
+        }
+
+        if ((header.byteOrderMark != kByteOrderMark) || (header.headerSize != sizeof(FileHeader)))
+        {
+          throw CheckpointInvalid(path, "unsupported byte order or header size");
+        }
+
+        if ((header.fileSize != mSize) ||
+            (header.numSections > (mSize - sizeof(FileHeader)) / sizeof(SectionEntry)))
+        {
+          throw CheckpointInvalid(path, "the file is truncated");
+        }
+
+        for (std::uint32_t s = 0; s < header.numSections; s++)
+        {
+          SectionEntry entry;
+          std::memcpy(&entry, mData + sizeof(FileHeader) + s * sizeof(SectionEntry), sizeof(entry));
+
+          // Sections unknown to this version are skipped
+
+          if (entry.id >= kCheckpointSectionCount)
+          {
+            continue;
+          }
+
+          const bool fits = (entry.offset <= mSize) && (entry.elementSize > 0) &&
+                            (entry.count <= (mSize - entry.offset) / entry.elementSize);
+
+          if (!fits || ((entry.offset % kSectionAlignment) != 0) || (mSectionElementSize[entry.id] != 0))
+          {
+            throw CheckpointInvalid(path, "section " + std::to_string(entry.id) + " is corrupt");
+          }
+
+          mSectionElementSize[entry.id] = entry.elementSize;
+          mSectionCount[entry.id] = entry.count;
+          mSectionOffset[entry.id] = entry.offset;
+        }
+
+        std::memcpy(&mParameters, getSection<CheckpointParameters>(kCheckpointSectionParameters, 1),
+                    sizeof(mParameters));
+      }
+      catch (...)
+      {
+        unmap();
+        throw;
+      }
+    }
+
+    FLIPCheckpoint::~FLIPCheckpoint()
+    {
+      unmap();
+    }
+
+    const std::string& FLIPCheckpoint::getPath() const
+    {
+      return mPath;
+    }
+
+    const CheckpointParameters& FLIPCheckpoint::getParameters() const
+    {
+      return mParameters;
+    }
+
+    std::size_t FLIPCheckpoint::getSectionCount(CheckpointSection section) const
+    {
+      return static_cast<std::size_t>(mSectionCount[section]);
+    }
+
+    Particles2D::PositionView FLIPCheckpoint::getParticlePositions() const
+    {
+      const std::size_t numParticles = static_cast<std::size_t>(mParameters.numParticles);
+
+      return Particles2D::PositionView(getSection<float>(kCheckpointSectionParticlesX, numParticles),
+                                       getSection<float>(kCheckpointSectionParticlesY, numParticles),
+                                       mParameters.numParticles);
+    }
+
+    const void* FLIPCheckpoint::getSectionData(CheckpointSection section, std::size_t elementSize,
+                                               std::size_t count) const
+    {
+      if ((mSectionElementSize[section] != elementSize) || (mSectionCount[section] != count))
+      {
+        throw CheckpointInvalid(mPath, "section " + std::to_string(static_cast<int>(section)) +
+                                       " is missing or has an unexpected size");
+      }
+
+      return mData + mSectionOffset[section];
+    }
+
+    void FLIPCheckpoint::unmap()
+    {
+      if (!mData)
+      {
+        return;
+      }
+
+#ifdef _WIN32
+      UnmapViewOfFile(mData);
+#else
+      munmap(const_cast<unsigned char*>(mData), mSize);
+#endif
+
+      mData = nullptr;
+      mSize = 0;
+    }
+
+    FLIPCheckpointWriter::FLIPCheckpointWriter()
+    : mSections()
+    {
+    }
+
+    void FLIPCheckpointWriter::addSection(CheckpointSection section, const void* data, std::size_t elementSize,
+                                          std::size_t count)
+    {
+      PendingSection pending;
+
+      pending.section = section;
+      pending.data = data;
+      pending.elementSize = elementSize;
+      pending.count = count;
+
+      mSections.push_back(pending);
+    }
+
+    void FLIPCheckpointWriter::write(const std::string& path) const
+    {
+      if (!isLittleEndian())
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(path, "only little endian hosts are supported");
+      }
+
+      // The data of each section starts aligned, so that arrays read from the mapping can be used with SIMD loads
+
+      std::vector<SectionEntry> entries(mSections.size());
+
+      std::uint64_t offset = sizeof(FileHeader) + entries.size() * sizeof(SectionEntry);
+
+      for (std::size_t s = 0; s < mSections.size(); s++)
+      {
+        offset = alignOffset(offset);
+
+        entries[s].id = static_cast<std::uint32_t>(mSections[s].section);
+        entries[s].elementSize = static_cast<std::uint32_t>(mSections[s].elementSize);
+        entries[s].count = mSections[s].count;
+        entries[s].offset = offset;
+
+        offset += static_cast<std::uint64_t>(mSections[s].elementSize) * mSections[s].count;
+      }
+
+      FileHeader header;
+
+      std::memcpy(header.magic, kMagic, sizeof(kMagic));
+      header.version = FLIPCheckpoint::kVersion;
+      header.byteOrderMark = kByteOrderMark;
+      header.headerSize = sizeof(FileHeader);
+      header.numSections = static_cast<std::uint32_t>(entries.size());
+      header.fileSize = offset;
+
+      std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+
+      if (!file)
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(path, "cannot create the file");
+      }
+
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+      if (!entries.empty())
+      {
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(SectionEntry));
+      }
+
+      const char padding[FLIPCheckpoint::kSectionAlignment] = {};
+
+      std::uint64_t position = sizeof(FileHeader) + entries.size() * sizeof(SectionEntry);
+
+      for (std::size_t s = 0; s < mSections.size(); s++)
+      {
+        const std::uint64_t size = static_cast<std::uint64_t>(mSections[s].elementSize) * mSections[s].count;
+
+        file.write(padding, static_cast<std::streamsize>(entries[s].offset - position));
+        file.write(static_cast<const char*>(mSections[s].data), static_cast<std::streamsize>(size));
+
+        position = entries[s].offset + size;
+      }
+
+      file.close();
+
+      if (!file)
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(path, "cannot write the file");
+      }
+    }
+  }
+}
@@ -0,0 +1,189 @@
+#ifndef SRC_PHYSICS_FLUIDS_FLIPCHECKPOINT_H_
+#define SRC_PHYSICS_FLUIDS_FLIPCHECKPOINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "Particles2D.hpp"
+
+namespace mk
+{
+  namespace physics
+  {
+    enum CheckpointSection
+    {
+      kCheckpointSectionParameters = 0,
+      kCheckpointSectionCellTypes,
+      kCheckpointSectionCellTypeTiles,
+      kCheckpointSectionFluidTiles,
+      kCheckpointSectionActiveTiles,
+      kCheckpointSectionVelocityX,
+      kCheckpointSectionVelocityY,
+      kCheckpointSectionFluidCells,
+      kCheckpointSectionPressure,
+      kCheckpointSectionParticlesX,
+      kCheckpointSectionParticlesY,
+      kCheckpointSectionParticlesU,
+      kCheckpointSectionParticlesV,
+      kCheckpointSectionParticlesC00,
+      kCheckpointSectionParticlesC01,
+      kCheckpointSectionParticlesC10,
+      kCheckpointSectionParticlesC11,
+      kCheckpointSectionCount
+    };
+
+    /**
+     * Parameters and scalar state of a FLIPSolver2D, stored as is in the parameters section of a checkpoint, so
+     * every field has a fixed size and the layout has no implicit padding.
+     */
+    struct CheckpointParameters
+    {
+      std::int32_t gridWidth;
+      std::int32_t gridHeight;
+      float dx;
+      float boundaryVelocityX;
+      float boundaryVelocityY;
+      float picFlipFactor;
+      std::int32_t stepCount;
+      std::int32_t particleSortOrder;
+      std::int32_t particleSortInterval;
+      std::int32_t pressurePreconditioner;
+      std::int32_t pressurePrecision;
+      std::int32_t pressureWarmStart;
+      std::int32_t velocityExtrapolation;
+      std::int32_t extrapolationLayers;
+      std::int32_t distanceMethod;
+      float distanceBand;
+      std::int32_t numParticles;
+      std::int32_t numFluidCells;
+      std::int32_t pcgIterations;
+      std::int32_t pcgIterationsSaved;
+      float lastPressureDt;
+      std::int32_t advectionIntegrator;
+      float advectionCfl;
+      std::int32_t velocityTransfer;
+      double pcgResidual;
+    };
+
+    /**
+     * Read only view of a checkpoint file written by FLIPSolver2D::saveCheckpoint.
+     *
+     * The file is a little endian header followed by a table of sections and their data, each section starting
+     * at a multiple of kSectionAlignment bytes. The file is memory mapped instead of read, so opening it costs
+     * the same whatever its size, and the arrays of a section, such as the particle positions, can be used in
+     * place straight from the mapping. Only the pages actually touched are read from disk.
+     *
+     * The format has a version number, and files of other versions are rejected.
+     */
+    class FLIPCheckpoint
+    {
+    public:
+      class CheckpointInvalid : public std::exception
+      {
+      public:
+        CheckpointInvalid(const std::string& path, const std::string& reason);
+        virtual const char* what() const noexcept;
+
+      private:
+        const std::string mWhat;
+      };
+
+    public:
+      static const std::uint32_t kVersion = 4;
+      static const std::size_t kSectionAlignment = 64;
+
+    public:
+      /**
+       * Maps a checkpoint file and checks its header and sections.
+       *
+       * @param path Path of the file.
+       * @throw FLIPCheckpoint::CheckpointInvalid if the file cannot be mapped or is not a valid checkpoint
+       */
+      explicit FLIPCheckpoint(const std::string& path);
+      ~FLIPCheckpoint();
+
+      FLIPCheckpoint(const FLIPCheckpoint&) = delete;
+      FLIPCheckpoint& operator=(const FLIPCheckpoint&) = delete;
+
+      const std::string& getPath() const;
+      const CheckpointParameters& getParameters() const;
+
+      /**
+       * @return Number of elements of a section, 0 if the file does not have it.
+       */
+      std::size_t getSectionCount(CheckpointSection section) const;
+
+      /**
+       * @return Elements of a section, pointing into the mapped file.
+       * @throw FLIPCheckpoint::CheckpointInvalid if the section is missing or does not hold count elements of T
+       */
+      template <typename T> const T* getSection(CheckpointSection section, std::size_t count) const;
+
+      /**
+       * @return View of the particle positions stored in the file, valid while the checkpoint is open.
+       */
+      Particles2D::PositionView getParticlePositions() const;
+
+    private:
+      const void* getSectionData(CheckpointSection section, std::size_t elementSize, std::size_t count) const;
+      void unmap();
+
+    private:
+      std::string mPath;
+      const unsigned char* mData;
+      std::size_t mSize;
+      std::uint32_t mSectionElementSize[kCheckpointSectionCount];
+      std::uint64_t mSectionCount[kCheckpointSectionCount];
+      std::uint64_t mSectionOffset[kCheckpointSectionCount];
+      CheckpointParameters mParameters;
+    };
+
+    /**
+     * Writes the sections of a checkpoint in the format read by FLIPCheckpoint. The sections are only referenced
+     * until write is called, so the data must stay alive until then.
+     */
+    class FLIPCheckpointWriter
+    {
+    public:
+      FLIPCheckpointWriter();
+
+      FLIPCheckpointWriter(const FLIPCheckpointWriter&) = delete;
+      FLIPCheckpointWriter& operator=(const FLIPCheckpointWriter&) = delete;
+
+      /**
+       * @param section Section to add, each one may only be added once.
+       * @param data Array of count elements.
+       * @param elementSize Size of each element in bytes.
+       * @param count Number of elements.
+       */
+      void addSection(CheckpointSection section, const void* data, std::size_t elementSize, std::size_t count);
+
+      /**
+       * @throw FLIPCheckpoint::CheckpointInvalid if the file cannot be written
+       */
+      void write(const std::string& path) const;
+
+    private:
+      struct PendingSection
+      {
+        CheckpointSection section;
+        const void* data;
+        std::size_t elementSize;
+        std::size_t count;
+      };
+
+    private:
+      std::vector<PendingSection> mSections;
+    };
+
+    template <typename T> const T* FLIPCheckpoint::getSection(CheckpointSection section, std::size_t count) const
+    {
+      return static_cast<const T*>(getSectionData(section, sizeof(T), count));
+    }
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_FLIPCHECKPOINT_H_
@@ -1,6 +1,11 @@
 #include "FLIPSolver2D.hpp"
 
 #include <algorithm>
+#include <cmath>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace mk
 {
@@ -13,27 +18,208 @@ namespace mk
       const int kPcgMaxIterations = 100;
       const double kPcgTolerance = 1e-4;
       const double kPcgEpsilon = 1e-6;
-    }
+      const int kMaxRefinementSteps = 5;
+      const int kTileSize = kFluidTileSize;
+      const int kTileActivityMargin = 1;
+      const int kKernelBlockSize = 4096;
+      const int kDefaultExtrapolationLayers = 4;
+      const int kMaxExtrapolationLayers = kTileActivityMargin * kTileSize - 1;
+      const int kSweepExtrapolationRounds = 4;
+      const int kDefaultMaxSubsteps = 64;
+      const float kDefaultAdvectionCfl = 1.0f;
+      const int kMaxAdvectionSubsteps = 8;
+      const int kAdvectionChunkSize = 256;
+
+      const unsigned char kFaceUnknown = 0;
+      const unsigned char kFaceQueued = 1;
+      const unsigned char kFaceKnown = 2;
+      const unsigned char kFaceFixed = 3;
+
+      int getNumThreads()
+      {
+#ifdef _OPENMP
+        return omp_get_num_threads();
+#else
+        return 1;
+#endif
+      }
 
-    FLIPSolver2D::Particles::Particles()
-    : numParticles(0)
-    {
-    }
+      int getThreadIndex()
+      {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+      }
 
-    void FLIPSolver2D::Particles::addParticle(const glm::fvec2& pos, const glm::fvec2& vel)
-    {
-      positions.push_back(pos);
-      velocities.push_back(vel);
+      double sumBlocks(const double* blockSums, int numBlocks)
+      {
+        // The partial sums of the blocks are added in block order instead of by an OpenMP reduction, so the
+        // result does not depend on the number of threads
 
-      ++numParticles;
-    }
+        double result = 0.0;
 
-    void FLIPSolver2D::Particles::clearParticles()
-    {
-      positions.clear();
-      velocities.clear();
+        for (int block = 0; block < numBlocks; block++)
+        {
+          result += blockSums[block];
+        }
+
+        return result;
+      }
+
+      unsigned int spreadBits(unsigned int x)
+      {
+        // Inserts a 0 bit between each of the lower 16 bits of x
+
+        x &= 0x0000ffff;
+        x = (x | (x << 8)) & 0x00ff00ff;
+        x = (x | (x << 4)) & 0x0f0f0f0f;
+        x = (x | (x << 2)) & 0x33333333;
+        x = (x | (x << 1)) & 0x55555555;
+
+        return x;
+      }
+
+      template <typename Grid>
+      void interpolatePair(const Grid& gridA, const Grid& gridB, int maxI, int maxJ, float i, float j, float& a,
+                           float& b)
+      {
+        // Bilinear interpolation of two grids with the same layout at the same point, sharing the weights.
+        // The coordinates are relative to the first sample and clamped to [0, maxI] x [0, maxJ], and the
+        // last cell is reused at the upper bounds so that no sample falls outside of the grid.
+
+        const int i0 = std::min(static_cast<int>(i), maxI - 1);
+        const int j0 = std::min(static_cast<int>(j), maxJ - 1);
+
+        const float t0 = i - static_cast<float>(i0);
+        const float t1 = 1.0f - t0;
+        const float s0 = j - static_cast<float>(j0);
+        const float s1 = 1.0f - s0;
+
+        float a00, a10, a01, a11;
+        float b00, b10, b01, b11;
+
+        gridA.get2x2(i0, j0, a00, a10, a01, a11);
+        gridB.get2x2(i0, j0, b00, b10, b01, b11);
+
+        a = s1 * (t1 * a00 + t0 * a10) + s0 * (t1 * a01 + t0 * a11);
+        b = s1 * (t1 * b00 + t0 * b10) + s0 * (t1 * b01 + t0 * b11);
+      }
+
+      template <typename Grid> float interpolate(const Grid& grid, int maxI, int maxJ, float i, float j)
+      {
+        // Same as interpolatePair, for a single grid
+
+        const int i0 = std::min(static_cast<int>(i), maxI - 1);
+        const int j0 = std::min(static_cast<int>(j), maxJ - 1);
+
+        const float t0 = i - static_cast<float>(i0);
+        const float t1 = 1.0f - t0;
+        const float s0 = j - static_cast<float>(j0);
+        const float s1 = 1.0f - s0;
+
+        float g00, g10, g01, g11;
+
+        grid.get2x2(i0, j0, g00, g10, g01, g11);
+
+        return s1 * (t1 * g00 + t0 * g10) + s0 * (t1 * g01 + t0 * g11);
+      }
+
+      template <typename Grid>
+      float interpolateWithGradient(const Grid& grid, int maxI, int maxJ, float i, float j, float& gradI,
+                                    float& gradJ)
+      {
+        // Same as interpolate, also giving the derivatives of the bilinear interpolant along i and j
+
+        const int i0 = std::min(static_cast<int>(i), maxI - 1);
+        const int j0 = std::min(static_cast<int>(j), maxJ - 1);
+
+        const float t0 = i - static_cast<float>(i0);
+        const float t1 = 1.0f - t0;
+        const float s0 = j - static_cast<float>(j0);
+        const float s1 = 1.0f - s0;
+
+        float g00, g10, g01, g11;
+
+        grid.get2x2(i0, j0, g00, g10, g01, g11);
+
+        gradI = s1 * (g10 - g00) + s0 * (g11 - g01);
+        gradJ = t1 * (g01 - g00) + t0 * (g11 - g10);
+
+        return s1 * (t1 * g00 + t0 * g10) + s0 * (t1 * g01 + t0 * g11);
+      }
+
+      template <typename Grid> class VelocitySampler
+      {
+      public:
+        // Samples the staggered velocity grids at a point in grid units, giving the velocity in cells per second
+
+        VelocitySampler(const Grid& velX, const Grid& velY, int width, int height, float overDx)
+        : mVelX(velX),
+          mVelY(velY),
+          mWidth(width),
+          mHeight(height),
+          mOverDx(overDx)
+        {
+        }
+
+        void operator()(float i, float j, float& u, float& v) const
+        {
+          const float width = static_cast<float>(mWidth);
+          const float height = static_cast<float>(mHeight);
+
+          const float ic = glm::clamp(i, 0.0f, width);
+          const float jc = glm::clamp(j, 0.0f, height);
+
+          u = mOverDx * interpolate(mVelX, mWidth, mHeight - 1, ic, glm::clamp(jc - 0.5f, 0.0f, height - 1.0f));
+          v = mOverDx * interpolate(mVelY, mWidth - 1, mHeight, glm::clamp(ic - 0.5f, 0.0f, width - 1.0f), jc);
+        }
+
+      private:
+        const Grid& mVelX;
+        const Grid& mVelY;
+        int mWidth;
+        int mHeight;
+        float mOverDx;
+      };
+
+      template <typename Sampler>
+      void integrateSubstep(const Sampler& velocity, AdvectionIntegrator integrator, float h, float i, float j,
+                            float u1, float v1, float& iEnd, float& jEnd)
+      {
+        // Explicit Runge-Kutta step of length h from (i, j), given the velocity (u1, v1) at that point. RK3 is
+        // Ralston's third order method, which has a small error bound for its cost.
+
+        float u2, v2, u3, v3, u4, v4;
+
+        switch (integrator)
+        {
+          case kAdvectionRK2:
+            velocity(i + 0.5f * h * u1, j + 0.5f * h * v1, u2, v2);
+
+            iEnd = i + h * u2;
+            jEnd = j + h * v2;
+            break;
+
+          case kAdvectionRK4:
+            velocity(i + 0.5f * h * u1, j + 0.5f * h * v1, u2, v2);
+            velocity(i + 0.5f * h * u2, j + 0.5f * h * v2, u3, v3);
+            velocity(i + h * u3, j + h * v3, u4, v4);
+
+            iEnd = i + (h / 6.0f) * (u1 + 2.0f * u2 + 2.0f * u3 + u4);
+            jEnd = j + (h / 6.0f) * (v1 + 2.0f * v2 + 2.0f * v3 + v4);
+            break;
 
-      numParticles = 0;
+          default:
+            velocity(i + 0.5f * h * u1, j + 0.5f * h * v1, u2, v2);
+            velocity(i + 0.75f * h * u2, j + 0.75f * h * v2, u3, v3);
+
+            iEnd = i + (h / 9.0f) * (2.0f * u1 + 3.0f * u2 + 4.0f * u3);
+            jEnd = j + (h / 9.0f) * (2.0f * v1 + 3.0f * v2 + 4.0f * v3);
+            break;
+        }
+      }
     }
 
     FLIPSolver2D::FLIPSolver2D(int gridWidth, int gridHeight, float dx)
@@ -44,75 +230,217 @@ namespace mk
       mOverDx(1.0f / dx),
       mBoundaryVelocity(0.0f),
       mPicFlipFactor(1.0f),
-      mVelX((gridWidth + 1) * gridHeight),
-      mVelY(gridWidth * (gridHeight + 1)),
-      mDeltaVelX(mVelX.size()),
-      mDeltaVelY(mVelY.size()),
-      mWeightSum((gridWidth + 1) * (gridHeight + 1)),
-      mPhi(gridWidth * gridHeight),
-      mCellType(gridWidth * gridHeight),
-      mCellTypeAux(gridWidth * gridHeight),
-      mP(gridWidth * gridHeight),
-      mR(gridWidth * gridHeight),
-      mS(gridWidth * gridHeight),
-      mZ(gridWidth * gridHeight),
-      mAux(gridWidth * gridHeight),
-      mRhs(gridWidth * gridHeight),
-      mPrecond(gridWidth * gridHeight),
-      mCoefDiag(gridWidth * gridHeight),
-      mCoefPlusI(gridWidth * gridHeight),
-      mCoefPlusJ(gridWidth * gridHeight)
-    {
-      std::fill(mVelX.begin(), mVelX.end(), 0.0f);
-      std::fill(mVelY.begin(), mVelY.end(), 0.0f);
-      std::fill(mDeltaVelX.begin(), mDeltaVelX.end(), 0.0f);
-      std::fill(mDeltaVelY.begin(), mDeltaVelY.end(), 0.0f);
-
-      std::fill(mCellType.begin(), mCellType.end(), kCellTypeFluid);
-
-      // Solid square surrounding the whole area and rectangle in the middle
+      mVelocityTransfer(kVelocityTransferPicFlip),
+      mExecutionPolicy(),
+      mStats(),
+      mStepCount(0),
+      mFrameCount(0),
+      mMaxSubsteps(kDefaultMaxSubsteps),
+      mLastSubsteps(0),
+      mMaxSpeedSquared(0.0f),
+      mMaxSpeedParticles(0),
+      mParticleSortOrder(kParticleSortRowMajor),
+      mParticleSortInterval(0),
+      mNumSortedParticles(-1),
+      mParticleKeys(),
+      mCellParticleStart(),
+      mPressurePreconditioner(kPreconditionerMIC),
+      mPressurePrecision(kPressurePrecisionDouble),
+      mPressureWarmStart(false),
+      mPressureWarmStartReference(false),
+      mPcgIterations(0),
+      mPcgIterationsSaved(0),
+      mPcgResidual(0.0),
+      mLastPressureDt(0.0f),
+      mVelX(gridWidth + 1, gridHeight, 0.0f),
+      mVelY(gridWidth, gridHeight + 1, 0.0f),
+      mDeltaVelX(gridWidth + 1, gridHeight, 0.0f),
+      mDeltaVelY(gridWidth, gridHeight + 1, 0.0f),
+      mWeightSum(gridWidth + 1, gridHeight + 1, 0.0f),
+      mTransferGrids(),
+      mPhi(gridWidth, gridHeight, 0.0f),
+      mDistanceField(gridWidth, gridHeight),
+      mVelocityExtrapolation(kExtrapolationLayered),
+      mExtrapolationLayers(kDefaultExtrapolationLayers),
+      mAdvectionIntegrator(kAdvectionRK3),
+      mAdvectionCfl(kDefaultAdvectionCfl),
+      mExtrapolationU(gridWidth + 1, gridHeight),
+      mExtrapolationV(gridWidth, gridHeight + 1),
+      mCellType(gridWidth, gridHeight, kCellTypeAir),
+      mCellTypeAux(gridWidth, gridHeight, kCellTypeAir),
+      mTilesX((gridWidth + kTileSize - 1) / kTileSize),
+      mTilesY((gridHeight + kTileSize - 1) / kTileSize),
+      mSolidTileMask(mTilesX * mTilesY),
+      mFluidTileMask(mTilesX * mTilesY),
+      mActiveTileMask(mTilesX * mTilesY),
+      mActiveTiles(),
+      mNumFluidCells(0),
+      mFluidCells(),
+      mCompactIndex(gridWidth, gridHeight, -1),
+      mTileFluidStart(),
+      mNeighbourMinusI(),
+      mNeighbourPlusI(),
+      mNeighbourMinusJ(),
+      mNeighbourPlusJ(),
+      mP(),
+      mColdStartPressure(),
+      mRhs(),
+      mResidual(),
+      mPcgDouble(),
+      mPcgFloat(),
+      mLastPressure(gridWidth, gridHeight, 0.0),
+      mMultigrid()
+    {
+      // Every cell starts as air, so no tile is active until fluid is added, and the solid square surrounding the
+      // whole area is all the grids store
 
       for (int i = 0; i < gridWidth; i++)
       {
-        mCellType[ix(i, 0)] = kCellTypeSolid;
-        mCellType[ix(i, gridHeight - 1)] = kCellTypeSolid;
+        setCellType(i, 0, kCellTypeSolid);
+        setCellType(i, gridHeight - 1, kCellTypeSolid);
       }
 
       for (int j = 0; j < gridHeight; j++)
       {
-        mCellType[ix(0, j)] = kCellTypeSolid;
-        mCellType[ix(gridWidth - 1, j)] = kCellTypeSolid;
+        setCellType(0, j, kCellTypeSolid);
+        setCellType(gridWidth - 1, j, kCellTypeSolid);
       }
     }
 
+    FLIPSolver2D::ExtrapolationFront::ExtrapolationFront(int width, int height)
+    : state(width, height, kFaceFixed),
+      current(),
+      next(),
+      values()
+    {
+    }
+
     void FLIPSolver2D::setBoundaryVel(const glm::fvec2& vel)
     {
       mBoundaryVelocity = vel;
     }
 
+    int FLIPSolver2D::advance(float frameDt, float cflNumber)
+    {
+      MK_TRACE_SCOPE("fluids", "advance");
+
+      // Each substep is as long as the CFL number allows for the fastest particle at its start. When less than
+      // two substeps are left, the remaining time is split in halves instead of leaving a tiny last substep. The
+      // last allowed substep takes whatever time is left, so a frame never costs more than mMaxSubsteps steps.
+
+      const int frame = mFrameCount++;
+      float time = 0.0f;
+      int substep = 0;
+      bool finished = (frameDt <= 0.0f);
+
+      while (!finished)
+      {
+        const float remaining = frameDt - time;
+        float dt = cflNumber * timeStep();
+
+        if ((dt >= remaining) || (substep == mMaxSubsteps - 1))
+        {
+          dt = remaining;
+          finished = true;
+        }
+        else if (2.0f * dt > remaining)
+        {
+          dt = 0.5f * remaining;
+        }
+
+        step(dt, frame, substep++);
+        time += dt;
+      }
+
+      mLastSubsteps = substep;
+
+      return substep;
+    }
+
     void FLIPSolver2D::simulate(float dt)
     {
+      step(dt, -1, 0);
+    }
+
+    void FLIPSolver2D::setMaxSubsteps(int substeps)
+    {
+      mMaxSubsteps = std::max(substeps, 1);
+    }
+
+    int FLIPSolver2D::getLastSubsteps() const
+    {
+      return mLastSubsteps;
+    }
+
+    void FLIPSolver2D::step(float dt, int frame, int substep)
+    {
+      MK_TRACE_SCOPE("fluids", "simulate");
+
+#ifdef MK_PHYSICS_PROFILING
+      mStats.beginStep(dt, frame, substep, dt * std::sqrt(getMaxSpeedSquared()) * mOverDx);
+#else
+      (void)frame;
+      (void)substep;
+#endif
+
       advectParticles(dt);
+
+      if ((mParticleSortInterval > 0) && ((mStepCount % mParticleSortInterval) == 0))
+      {
+        sortParticles();
+      }
+
+      ++mStepCount;
+
       particlesToGrid();
-      storeVel();
+
+      if (mVelocityTransfer == kVelocityTransferPicFlip)
+      {
+        storeVel();
+      }
+
       applyForce(dt, 0.0f, -kGravity);
-      computeGridPhi();
+      if (mVelocityExtrapolation == kExtrapolationSweeping)
+      {
+        computeGridPhi();
+      }
+
       extrapolateVel();
       setBoundary();
       project(dt);
       extrapolateVel();
-      subtractVel();
+
+      if (mVelocityTransfer == kVelocityTransferPicFlip)
+      {
+        subtractVel();
+      }
+
       gridToParticles();
+
+#ifdef MK_PHYSICS_PROFILING
+      mStats.endStep(mParticles.getNumParticles(), mNumFluidCells, mPcgIterations, mPcgResidual, getActiveTileRatio());
+#endif
     }
 
     float FLIPSolver2D::getPressure(int i, int j)
     {
-      return static_cast<float>(mP[ix(i, j)]);
+      // Pressure is only stored for the cells that were fluid in the last projection
+
+      const int ix_ = ix(i, j);
+      const int k = mCompactIndex.get(i, j);
+
+      if ((k < 0) || (k >= mNumFluidCells) || (mFluidCells[k] != ix_))
+      {
+        return 0.0f;
+      }
+
+      return static_cast<float>(mP[k]);
     }
 
     glm::fvec2 FLIPSolver2D::getVelocity(int i, int j)
     {
-      return glm::fvec2((u(i, j) + u(i + 1, j)) * 0.5f, (v(i, j) + v(i, j + 1)) * 0.5f);
+      return glm::fvec2((mVelX.get(i, j) + mVelX.get(i + 1, j)) * 0.5f,
+                        (mVelY.get(i, j) + mVelY.get(i, j + 1)) * 0.5f);
     }
 
     glm::fvec2 FLIPSolver2D::getVelocity(float i, float j)
@@ -122,12 +450,49 @@ namespace mk
 
     CellType FLIPSolver2D::getCellType(int i, int j) const
     {
-      return mCellType[ix(i, j)];
+      return mCellType.get(i, j);
+    }
+
+    void FLIPSolver2D::getCellTypes(CellType* cellTypes) const
+    {
+      // Cells of the tiles that are not stored are air
+
+      mCellType.copyTo(cellTypes);
     }
 
     void FLIPSolver2D::setCellType(int i, int j, CellType type)
     {
-      mCellType[ix(i, j)] = type;
+      const int tile = (i / kTileSize) + (j / kTileSize) * mTilesX;
+
+      if ((type == kCellTypeAir) && !mCellType.getTileData(tile))
+      {
+        return;
+      }
+
+      mCellType.at(i, j) = type;
+
+      // Tiles with solid cells are kept even while inactive, as the cells they hold are not air. A tile with new
+      // fluid stays active until the next step has reset its cells and found whether it still has fluid.
+
+      if (type == kCellTypeSolid)
+      {
+        mSolidTileMask[tile] = 1;
+      }
+      else if ((type == kCellTypeFluid) && !mActiveTileMask[tile])
+      {
+        mActiveTileMask[tile] = 1;
+        mActiveTiles.push_back(tile);
+
+        FloatGrid* const grids[] = { &mVelX, &mVelY, &mDeltaVelX, &mDeltaVelY, &mWeightSum };
+
+        for (FloatGrid* grid : grids)
+        {
+          allocateGridTiles(*grid, tile);
+        }
+
+        allocateGridTiles(mCellTypeAux, tile);
+        allocateGridTiles(mCompactIndex, tile);
+      }
     }
 
     void FLIPSolver2D::setPicFlipFactor(float factor)
@@ -135,1010 +500,2855 @@ namespace mk
       mPicFlipFactor = glm::clamp(factor, 0.0f, 1.0f);
     }
 
-    float& FLIPSolver2D::u(int i, int j)
+    void FLIPSolver2D::setVelocityTransfer(VelocityTransfer transfer)
     {
-      return mVelX[i + j * (mGridWidth + 1)];
+      // APIC replaces the PIC/FLIP blend, so the factor is ignored while it is used. The affine matrices only
+      // exist while they are needed, and start at 0, which makes the first transfer a plain PIC one.
+
+      mVelocityTransfer = transfer;
+      mParticles.setAffineEnabled(transfer == kVelocityTransferApic);
     }
 
-    float& FLIPSolver2D::v(int i, int j)
+    void FLIPSolver2D::setPressureSolverMode(PressureSolverMode mode)
     {
-      return mVelY[i + j * mGridWidth];
+      mExecutionPolicy.setParallel(kSolverStagePressure, mode == kPressureSolverParallel);
     }
 
-    int FLIPSolver2D::ix(int i, int j) const
+    void FLIPSolver2D::setPressurePreconditioner(PressurePreconditioner preconditioner)
     {
-      return i + j * mGridWidth;
+      mPressurePreconditioner = preconditioner;
     }
 
-    int FLIPSolver2D::ixBig(int i, int j)
+    void FLIPSolver2D::setPressurePrecision(PressurePrecision precision)
     {
-      return i + j * (mGridWidth + 1);
+      mPressurePrecision = precision;
     }
 
-    float FLIPSolver2D::timeStep()
+    void FLIPSolver2D::setPressureWarmStart(bool warmStart)
     {
-      float max_u = 0.0f;
-      float max_v = 0.0f;
-
-      for (std::size_t i = 0; i < mVelX.size(); i++)
-      {
-        max_u = std::max(max_u, std::fabs(mVelX[i]));
-      }
-
-      for (std::size_t i = 0; i < mVelY.size(); i++)
-      {
-        max_v = std::max(max_v, std::fabs(mVelY[i]));
-      }
+      // Forget the last pressure, so that a guess from an unrelated step is never used
 
-      const float max_vel = std::max(kGravity * mDx, max_u * max_u + max_v * max_v);
-
-      return mDx / sqrt(std::max(max_vel, kEpsilon));
+      mPressureWarmStart = warmStart;
+      mLastPressureDt = 0.0f;
     }
 
-    void FLIPSolver2D::swapVel()
+    void FLIPSolver2D::setPressureWarmStartReference(bool reference)
     {
-      std::swap(mVelX, mDeltaVelX);
-      std::swap(mVelY, mDeltaVelY);
+      mPressureWarmStartReference = reference;
     }
 
-    float FLIPSolver2D::uVel(float i, float j)
+    void FLIPSolver2D::setParticleTransferMode(ParticleTransferMode mode)
     {
-      i = glm::clamp(i, 0.0f, static_cast<float>(mGridWidth));
-      j = glm::clamp(j, 0.0f, static_cast<float>(mGridHeight));
-
-      if ((j < 0.5f) || (j > (mGridHeight - 0.5f)))
-      {
-        const int i0 = static_cast<int>(i);
-        const int i1 = i0 + 1;
-        const int jj = (j <= 0.5f) ? 0 : (mGridHeight - 1);
-
-        const float t0 = i - static_cast<float>(i0);
-        const float t1 = 1.0f - t0;
+      mExecutionPolicy.setParallel(kSolverStageParticlesToGrid, mode == kParticleTransferParallel);
+      mExecutionPolicy.setParallel(kSolverStageGridToParticles, mode == kParticleTransferParallel);
+    }
 
-        return t1 * u(i0, jj) + t0 * u(i1, jj);
-      }
-      else
-      {
-        const int i0 = static_cast<int>(i);
-        const int j0 = static_cast<int>(j - 0.5f);
-        const int i1 = i0 + 1;
-        const int j1 = j0 + 1;
+    void FLIPSolver2D::setDistanceMethod(DistanceMethod method)
+    {
+      mDistanceField.setMethod(method);
+    }
 
-        const float t0 = i - static_cast<float>(i0);
-        const float t1 = 1.0f - t0;
-        const float s0 = (j - 0.5f) - static_cast<float>(j0);
-        const float s1 = 1.0f - s0;
+    void FLIPSolver2D::setDistanceBand(float band)
+    {
+      mDistanceField.setBand(band);
+    }
 
-        return	s1 * (t1 * u(i0, j0) + t0 * u(i1, j0)) + s0 * (t1 * u(i0, j1) + t0 * u(i1, j1));
-      }
+    void FLIPSolver2D::setVelocityExtrapolation(VelocityExtrapolation extrapolation)
+    {
+      mVelocityExtrapolation = extrapolation;
     }
 
-    float FLIPSolver2D::vVel(float i, float j)
+    void FLIPSolver2D::setExtrapolationLayers(int layers)
     {
-      i = glm::clamp(i, 0.0f, static_cast<float>(mGridWidth));
-      j = glm::clamp(j, 0.0f, static_cast<float>(mGridHeight));
+      // The front must not leave the margin of active tiles around the fluid
 
-      if ((i < 0.5f) || (i > (mGridWidth - 0.5f)))
-      {
-        const int ii = (i <= 0.5f) ? 0 : (mGridWidth - 1);
-        const int j0 = static_cast<int>(j);
-        const int j1 = j0 + 1;
+      mExtrapolationLayers = glm::clamp(layers, 1, kMaxExtrapolationLayers);
+    }
 
-        const float t0 = j - static_cast<float>(j0);
-        const float t1 = 1.0f - t0;
+    void FLIPSolver2D::setAdvectionIntegrator(AdvectionIntegrator integrator)
+    {
+      mAdvectionIntegrator = integrator;
+    }
 
-        return t1 * v(ii, j0) + t0 * v(ii, j1);
-      }
-      else
-      {
-        const int i0 = static_cast<int>(i - 0.5f);
-        const int j0 = static_cast<int>(j);
-        const int i1 = i0 + 1;
-        const int j1 = j0 + 1;
+    void FLIPSolver2D::setAdvectionCfl(float cells)
+    {
+      // Particles still take at most kMaxAdvectionSubsteps substeps, whatever the CFL number
 
-        const float t0 = (i - 0.5f) - static_cast<float>(i0);
-        const float t1 = 1.0f - t0;
-        const float s0 = j - static_cast<float>(j0);
-        const float s1 = 1.0f - s0;
+      mAdvectionCfl = std::max(cells, 0.01f);
+    }
 
-        return	s1 * (t1 * v(i0, j0) + t0 * v(i1, j0)) + s0 * (t1 * v(i0, j1) + t0 * v(i1, j1));
-      }
+    void FLIPSolver2D::setExecutionPolicy(const ExecutionPolicy& executionPolicy)
+    {
+      mExecutionPolicy = executionPolicy;
     }
 
-    int FLIPSolver2D::uIndex_x(float x, float& wx)
+    const ExecutionPolicy& FLIPSolver2D::getExecutionPolicy() const
     {
-      const float x_ = glm::clamp(x * mOverDx, 0.0f, static_cast<float>(mGridWidth) - mDx * 1e-5f);
+      return mExecutionPolicy;
+    }
 
-      const int i = static_cast<int>(x_);
-      wx = x_ - i;
+    void FLIPSolver2D::setNumThreads(int numThreads)
+    {
+      mExecutionPolicy.setNumThreads(numThreads);
+    }
 
-      return i;
+    void FLIPSolver2D::setParticleSortInterval(int steps)
+    {
+      mParticleSortInterval = steps;
     }
 
-    int FLIPSolver2D::uIndex_y(float y, float& wy)
+    void FLIPSolver2D::setParticleSortOrder(ParticleSortOrder order)
     {
-      const float y_ = y * mOverDx - 0.5f;
+      mParticleSortOrder = order;
+      mNumSortedParticles = -1;
+    }
 
-      const int j = static_cast<int>(y_);
+    bool FLIPSolver2D::getCellParticles(int i, int j, int& begin, int& end) const
+    {
+      // The table is only valid from the sort to the next time the particles move or are added or removed
 
-      if (j < 0)
+      if (mNumSortedParticles != mParticles.getNumParticles())
       {
-        wy = 0.0;
-        return 0;
+        return false;
       }
 
-      if (j > (mGridHeight - 2))
-      {
-        wy = 1.0f;
-        return mGridHeight - 2;
-      }
+      const int key = cellKey(i, j);
 
-      wy = y_ - j;
+      begin = mCellParticleStart[key];
+      end = mCellParticleStart[key + 1];
 
-      return j;
+      return true;
     }
 
-    int FLIPSolver2D::vIndex_x(float x, float& wx)
+    void FLIPSolver2D::setSimdLevel(SimdLevel simdLevel)
     {
-      const float x_ = x * mOverDx - 0.5f;
+      mPcgDouble.kernels = &getPcgKernels<double>(simdLevel);
+      mPcgFloat.kernels = &getPcgKernels<float>(simdLevel);
+    }
 
-      const int i = static_cast<int>(x_);
+    int FLIPSolver2D::getPcgIterations() const
+    {
+      return mPcgIterations;
+    }
 
-      if (i < 0)
-      {
-        wx = 0.0;
-        return 0;
-      }
+    int FLIPSolver2D::getPcgIterationsSaved() const
+    {
+      return mPcgIterationsSaved;
+    }
+
+    double FLIPSolver2D::getPcgResidual() const
+    {
+      return mPcgResidual;
+    }
+
+    int FLIPSolver2D::getGridWidth() const
+    {
+      return mGridWidth;
+    }
+
+    int FLIPSolver2D::getGridHeight() const
+    {
+      return mGridHeight;
+    }
+
+    int FLIPSolver2D::getNumActiveTiles() const
+    {
+      return static_cast<int>(mActiveTiles.size());
+    }
+
+    float FLIPSolver2D::getActiveTileRatio() const
+    {
+      return static_cast<float>(mActiveTiles.size()) / static_cast<float>(mTilesX * mTilesY);
+    }
+
+    SolverStats& FLIPSolver2D::getStats()
+    {
+      return mStats;
+    }
+
+    const SolverStats& FLIPSolver2D::getStats() const
+    {
+      return mStats;
+    }
+
+    void FLIPSolver2D::saveCheckpoint(const std::string& path) const
+    {
+      CheckpointParameters parameters;
+
+      parameters.gridWidth = mGridWidth;
+      parameters.gridHeight = mGridHeight;
+      parameters.dx = mDx;
+      parameters.boundaryVelocityX = mBoundaryVelocity.x;
+      parameters.boundaryVelocityY = mBoundaryVelocity.y;
+      parameters.picFlipFactor = mPicFlipFactor;
+      parameters.stepCount = mStepCount;
+      parameters.particleSortOrder = mParticleSortOrder;
+      parameters.particleSortInterval = mParticleSortInterval;
+      parameters.pressurePreconditioner = mPressurePreconditioner;
+      parameters.pressurePrecision = mPressurePrecision;
+      parameters.pressureWarmStart = mPressureWarmStart ? 1 : 0;
+      parameters.velocityExtrapolation = mVelocityExtrapolation;
+      parameters.extrapolationLayers = mExtrapolationLayers;
+      parameters.distanceMethod = mDistanceField.getMethod();
+      parameters.distanceBand = mDistanceField.getBand();
+      parameters.numParticles = mParticles.getNumParticles();
+      parameters.numFluidCells = mNumFluidCells;
+      parameters.pcgIterations = mPcgIterations;
+      parameters.pcgIterationsSaved = mPcgIterationsSaved;
+      parameters.lastPressureDt = mLastPressureDt;
+      parameters.advectionIntegrator = mAdvectionIntegrator;
+      parameters.advectionCfl = mAdvectionCfl;
+      parameters.velocityTransfer = mVelocityTransfer;
+      parameters.pcgResidual = mPcgResidual;
+
+      // Only the stored tiles of the grids are saved. Cell types are stored as bytes, so that the size of the file
+      // does not depend on the size of the enum, along with the indices of their tiles in increasing order. The
+      // velocity is stored for the tiles covering the active ones, which the loader finds from the active tiles.
+
+      std::vector<int> cellTypeTiles(mCellType.getAllocatedTiles());
+      std::sort(cellTypeTiles.begin(), cellTypeTiles.end());
+
+      std::vector<unsigned char> cellTypes;
+      cellTypes.reserve(cellTypeTiles.size() * CellTypeGrid::kTileCells);
+
+      for (int tile : cellTypeTiles)
+      {
+        const CellType* data = mCellType.getTileData(tile);
+
+        cellTypes.insert(cellTypes.end(), data, data + CellTypeGrid::kTileCells);
+      }
+
+      std::vector<float> velocity[2];
+      const FloatGrid* const velocityGrids[2] = { &mVelX, &mVelY };
+
+      for (int c = 0; c < 2; c++)
+      {
+        std::vector<int> tiles;
+        getGridTiles(*velocityGrids[c], mActiveTileMask.data(), tiles);
+
+        velocity[c].reserve(tiles.size() * FloatGrid::kTileCells);
+
+        for (int tile : tiles)
+        {
+          const float* data = velocityGrids[c]->getTileData(tile);
+
+          velocity[c].insert(velocity[c].end(), data, data + FloatGrid::kTileCells);
+        }
+      }
+
+      const std::size_t numParticles = mParticles.getNumParticles();
+      const std::size_t numTiles = mFluidTileMask.size();
+
+      // The pressure warm start guess is the pressure of the last projection, so it is rebuilt from it on load
+
+      FLIPCheckpointWriter writer;
+
+      writer.addSection(kCheckpointSectionParameters, &parameters, sizeof(parameters), 1);
+      writer.addSection(kCheckpointSectionCellTypes, cellTypes.data(), sizeof(unsigned char), cellTypes.size());
+      writer.addSection(kCheckpointSectionCellTypeTiles, cellTypeTiles.data(), sizeof(int), cellTypeTiles.size());
+      writer.addSection(kCheckpointSectionFluidTiles, mFluidTileMask.data(), sizeof(unsigned char), numTiles);
+      writer.addSection(kCheckpointSectionActiveTiles, mActiveTileMask.data(), sizeof(unsigned char), numTiles);
+      writer.addSection(kCheckpointSectionVelocityX, velocity[0].data(), sizeof(float), velocity[0].size());
+      writer.addSection(kCheckpointSectionVelocityY, velocity[1].data(), sizeof(float), velocity[1].size());
+      writer.addSection(kCheckpointSectionFluidCells, mFluidCells.data(), sizeof(int), mNumFluidCells);
+      writer.addSection(kCheckpointSectionPressure, mP.data(), sizeof(double), mNumFluidCells);
+      writer.addSection(kCheckpointSectionParticlesX, mParticles.x(), sizeof(float), numParticles);
+      writer.addSection(kCheckpointSectionParticlesY, mParticles.y(), sizeof(float), numParticles);
+      writer.addSection(kCheckpointSectionParticlesU, mParticles.u(), sizeof(float), numParticles);
+      writer.addSection(kCheckpointSectionParticlesV, mParticles.v(), sizeof(float), numParticles);
+
+      if (mParticles.isAffineEnabled())
+      {
+        writer.addSection(kCheckpointSectionParticlesC00, mParticles.c00(), sizeof(float), numParticles);
+        writer.addSection(kCheckpointSectionParticlesC01, mParticles.c01(), sizeof(float), numParticles);
+        writer.addSection(kCheckpointSectionParticlesC10, mParticles.c10(), sizeof(float), numParticles);
+        writer.addSection(kCheckpointSectionParticlesC11, mParticles.c11(), sizeof(float), numParticles);
+      }
+
+      writer.write(path);
+    }
+
+    void FLIPSolver2D::loadCheckpoint(const FLIPCheckpoint& checkpoint)
+    {
+      const CheckpointParameters& parameters = checkpoint.getParameters();
+
+      if ((parameters.gridWidth != mGridWidth) || (parameters.gridHeight != mGridHeight) || (parameters.dx != mDx))
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "the grid does not match the solver");
+      }
+
+      // Every section is fetched before changing anything, so that an invalid file leaves the solver untouched
+
+      const std::size_t numParticles = static_cast<std::size_t>(std::max(parameters.numParticles, 0));
+      const std::size_t numFluidCells = static_cast<std::size_t>(std::max(parameters.numFluidCells, 0));
+      const std::size_t numTiles = mFluidTileMask.size();
+      const std::size_t numCellTypeTiles = checkpoint.getSectionCount(kCheckpointSectionCellTypeTiles);
+      const std::size_t numCellTypes = numCellTypeTiles * CellTypeGrid::kTileCells;
+
+      const int* cellTypeTiles = checkpoint.getSection<int>(kCheckpointSectionCellTypeTiles, numCellTypeTiles);
+      const unsigned char* cellTypes = checkpoint.getSection<unsigned char>(kCheckpointSectionCellTypes, numCellTypes);
+      const unsigned char* fluidTiles = checkpoint.getSection<unsigned char>(kCheckpointSectionFluidTiles, numTiles);
+      const unsigned char* activeTiles = checkpoint.getSection<unsigned char>(kCheckpointSectionActiveTiles, numTiles);
+
+      // The velocity tiles follow from the active ones
+
+      std::vector<int> velocityTilesX, velocityTilesY;
+
+      getGridTiles(mVelX, activeTiles, velocityTilesX);
+      getGridTiles(mVelY, activeTiles, velocityTilesY);
+
+      const float* velX = checkpoint.getSection<float>(kCheckpointSectionVelocityX,
+                                                       velocityTilesX.size() * FloatGrid::kTileCells);
+      const float* velY = checkpoint.getSection<float>(kCheckpointSectionVelocityY,
+                                                       velocityTilesY.size() * FloatGrid::kTileCells);
+      const int* fluidCells = checkpoint.getSection<int>(kCheckpointSectionFluidCells, numFluidCells);
+      const double* pressure = checkpoint.getSection<double>(kCheckpointSectionPressure, numFluidCells);
+      const float* particlesX = checkpoint.getSection<float>(kCheckpointSectionParticlesX, numParticles);
+      const float* particlesY = checkpoint.getSection<float>(kCheckpointSectionParticlesY, numParticles);
+      const float* particlesU = checkpoint.getSection<float>(kCheckpointSectionParticlesU, numParticles);
+      const float* particlesV = checkpoint.getSection<float>(kCheckpointSectionParticlesV, numParticles);
+
+      // The affine matrices are only stored by solvers using APIC
+
+      const bool apic = (parameters.velocityTransfer == kVelocityTransferApic);
+      const float* affine[4] = { nullptr, nullptr, nullptr, nullptr };
+
+      if (apic)
+      {
+        affine[0] = checkpoint.getSection<float>(kCheckpointSectionParticlesC00, numParticles);
+        affine[1] = checkpoint.getSection<float>(kCheckpointSectionParticlesC01, numParticles);
+        affine[2] = checkpoint.getSection<float>(kCheckpointSectionParticlesC10, numParticles);
+        affine[3] = checkpoint.getSection<float>(kCheckpointSectionParticlesC11, numParticles);
+      }
+
+      for (std::size_t n = 0; n < numCellTypeTiles; n++)
+      {
+        if ((cellTypeTiles[n] < 0) || (cellTypeTiles[n] >= static_cast<int>(numTiles)) ||
+            ((n > 0) && (cellTypeTiles[n] <= cellTypeTiles[n - 1])))
+        {
+          throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid cell type tile");
+        }
+      }
+
+      for (std::size_t c = 0; c < numCellTypes; c++)
+      {
+        if (cellTypes[c] > kCellTypeSolid)
+        {
+          throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid cell type");
+        }
+      }
+
+      for (std::size_t k = 0; k < numFluidCells; k++)
+      {
+        if ((fluidCells[k] < 0) || (fluidCells[k] >= mGridSize))
+        {
+          throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid fluid cell");
+        }
+      }
+
+      // The settings are checked against the same ranges as their setters, the enumerations are cast below. A NaN
+      // factor fails both comparisons.
+
+      if (!(parameters.picFlipFactor >= 0.0f) ||
+          !(parameters.picFlipFactor <= 1.0f) ||
+          (parameters.velocityTransfer < kVelocityTransferPicFlip) ||
+          (parameters.velocityTransfer > kVelocityTransferApic))
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid velocity transfer settings");
+      }
+
+      if (parameters.stepCount < 0)
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid step count");
+      }
+
+      if ((parameters.particleSortOrder < kParticleSortRowMajor) ||
+          (parameters.particleSortOrder > kParticleSortMorton) ||
+          (parameters.particleSortInterval < 0))
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid particle sorting");
+      }
+
+      if ((parameters.pressurePreconditioner < kPreconditionerMIC) ||
+          (parameters.pressurePreconditioner > kPreconditionerMultigrid) ||
+          (parameters.pressurePrecision < kPressurePrecisionDouble) ||
+          (parameters.pressurePrecision > kPressurePrecisionFloatRefined))
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid pressure solver settings");
+      }
+
+      if ((parameters.velocityExtrapolation < kExtrapolationSweeping) ||
+          (parameters.velocityExtrapolation > kExtrapolationLayered) ||
+          (parameters.extrapolationLayers < 1) ||
+          (parameters.extrapolationLayers > kMaxExtrapolationLayers) ||
+          (parameters.distanceMethod < kDistanceFastSweeping) ||
+          (parameters.distanceMethod > kDistanceExact))
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid velocity extrapolation settings");
+      }
+
+      // A NaN CFL number fails the comparison, an infinite one would never split the advection into substeps
+
+      if ((parameters.advectionIntegrator < kAdvectionRK2) ||
+          (parameters.advectionIntegrator > kAdvectionRK4) ||
+          !(parameters.advectionCfl >= 0.01f) ||
+          !std::isfinite(parameters.advectionCfl))
+      {
+        throw FLIPCheckpoint::CheckpointInvalid(checkpoint.getPath(), "invalid advection settings");
+      }
+
+      mBoundaryVelocity = glm::fvec2(parameters.boundaryVelocityX, parameters.boundaryVelocityY);
+      mPicFlipFactor = parameters.picFlipFactor;
+      mVelocityTransfer = apic ? kVelocityTransferApic : kVelocityTransferPicFlip;
+      mStepCount = parameters.stepCount;
+      mParticleSortOrder = static_cast<ParticleSortOrder>(parameters.particleSortOrder);
+      mParticleSortInterval = parameters.particleSortInterval;
+      mNumSortedParticles = -1;
+      mPressurePreconditioner = static_cast<PressurePreconditioner>(parameters.pressurePreconditioner);
+      mPressurePrecision = static_cast<PressurePrecision>(parameters.pressurePrecision);
+      mPressureWarmStart = (parameters.pressureWarmStart != 0);
+      mVelocityExtrapolation = static_cast<VelocityExtrapolation>(parameters.velocityExtrapolation);
+      mExtrapolationLayers = parameters.extrapolationLayers;
+      mDistanceField.setMethod(static_cast<DistanceMethod>(parameters.distanceMethod));
+      mDistanceField.setBand(parameters.distanceBand);
+      mPcgIterations = parameters.pcgIterations;
+      mPcgIterationsSaved = parameters.pcgIterationsSaved;
+      mPcgResidual = parameters.pcgResidual;
+      mLastPressureDt = parameters.lastPressureDt;
+      mAdvectionIntegrator = static_cast<AdvectionIntegrator>(parameters.advectionIntegrator);
+      mAdvectionCfl = parameters.advectionCfl;
+
+      mCellType.clear();
+      std::fill(mSolidTileMask.begin(), mSolidTileMask.end(), 0);
+
+      for (std::size_t n = 0; n < numCellTypeTiles; n++)
+      {
+        const int tile = cellTypeTiles[n];
+        CellType* data = mCellType.allocateTile(tile);
+
+        for (int c = 0; c < CellTypeGrid::kTileCells; c++)
+        {
+          data[c] = static_cast<CellType>(cellTypes[n * CellTypeGrid::kTileCells + c]);
+
+          if (data[c] == kCellTypeSolid)
+          {
+            mSolidTileMask[tile] = 1;
+          }
+        }
+      }
+
+      std::copy(fluidTiles, fluidTiles + numTiles, mFluidTileMask.begin());
+      std::copy(activeTiles, activeTiles + numTiles, mActiveTileMask.begin());
+
+      mActiveTiles.clear();
+
+      for (int t = 0; t < static_cast<int>(numTiles); t++)
+      {
+        if (mActiveTileMask[t])
+        {
+          mActiveTiles.push_back(t);
+        }
+      }
+
+      updateGridTiles();
+
+      for (std::size_t n = 0; n < velocityTilesX.size(); n++)
+      {
+        std::copy(velX + n * FloatGrid::kTileCells, velX + (n + 1) * FloatGrid::kTileCells,
+                  mVelX.getTileData(velocityTilesX[n]));
+      }
+
+      for (std::size_t n = 0; n < velocityTilesY.size(); n++)
+      {
+        std::copy(velY + n * FloatGrid::kTileCells, velY + (n + 1) * FloatGrid::kTileCells,
+                  mVelY.getTileData(velocityTilesY[n]));
+      }
+
+      // The pressure of the last projection, with the trailing slot that buildFluidCellList adds
+
+      mNumFluidCells = static_cast<int>(numFluidCells);
+      mFluidCells.assign(fluidCells, fluidCells + numFluidCells);
+      mP.resize(numFluidCells + 1);
+      std::copy(pressure, pressure + numFluidCells, mP.begin());
+      mP[numFluidCells] = 0.0;
+
+      mCompactIndex.fill(-1);
+
+      for (int k = 0; k < mNumFluidCells; k++)
+      {
+        mCompactIndex.at(mFluidCells[k] % mGridWidth, mFluidCells[k] / mGridWidth) = k;
+      }
+
+      mLastPressure.clear();
+
+      if (mPressureWarmStart && (mLastPressureDt > 0.0f))
+      {
+        storePressureGuess(mLastPressureDt);
+      }
+
+      mParticles.clearParticles();
+      mParticles.setAffineEnabled(apic);
+      mParticles.addParticles(particlesX, particlesY, particlesU, particlesV, parameters.numParticles);
+
+      if (apic)
+      {
+        float* const components[] = { mParticles.c00(), mParticles.c01(), mParticles.c10(), mParticles.c11() };
+
+        for (int c = 0; c < 4; c++)
+        {
+          std::copy(affine[c], affine[c] + numParticles, components[c]);
+        }
+      }
+
+      // The largest speed is found again from the particles by the next time step
+
+      mMaxSpeedSquared = 0.0f;
+      mMaxSpeedParticles = 0;
+    }
+
+    void FLIPSolver2D::loadCheckpoint(const std::string& path)
+    {
+      const FLIPCheckpoint checkpoint(path);
+
+      loadCheckpoint(checkpoint);
+    }
+
+    float& FLIPSolver2D::u(int i, int j)
+    {
+      return mVelX.at(i, j);
+    }
+
+    float& FLIPSolver2D::v(int i, int j)
+    {
+      return mVelY.at(i, j);
+    }
+
+    int FLIPSolver2D::ix(int i, int j) const
+    {
+      return i + j * mGridWidth;
+    }
+
+    float FLIPSolver2D::timeStep()
+    {
+      // Time for the fastest particle to cross a cell. Fluid at rest still falls, so the speed is never taken as
+      // lower than the one gained by falling half a cell.
+
+      const float maxSpeed = std::max(std::sqrt(getMaxSpeedSquared()), std::sqrt(kGravity * mDx));
+
+      return mDx / maxSpeed;
+    }
+
+    float FLIPSolver2D::getMaxSpeedSquared()
+    {
+      // The grid to particle transfer finds the speed of every particle it updates. Particles added since then
+      // are appended at the end, so only those need to be checked here.
+
+      const int numParticles = mParticles.getNumParticles();
+      const float* particlesU = mParticles.u();
+      const float* particlesV = mParticles.v();
+
+      mMaxSpeedParticles = std::min(mMaxSpeedParticles, numParticles);
+
+      for (int p = mMaxSpeedParticles; p < numParticles; p++)
+      {
+        mMaxSpeedSquared = std::max(mMaxSpeedSquared, particlesU[p] * particlesU[p] + particlesV[p] * particlesV[p]);
+      }
+
+      mMaxSpeedParticles = numParticles;
+
+      return mMaxSpeedSquared;
+    }
+
+    float FLIPSolver2D::uVel(float i, float j)
+    {
+      // The last face is reused at the upper bound, so that no sample falls outside of the grid
+
+      i = glm::clamp(i, 0.0f, static_cast<float>(mGridWidth));
+      j = glm::clamp(j, 0.0f, static_cast<float>(mGridHeight));
+
+      if ((j < 0.5f) || (j > (mGridHeight - 0.5f)))
+      {
+        const int i0 = std::min(static_cast<int>(i), mGridWidth - 1);
+        const int i1 = i0 + 1;
+        const int jj = (j <= 0.5f) ? 0 : (mGridHeight - 1);
+
+        const float t0 = i - static_cast<float>(i0);
+        const float t1 = 1.0f - t0;
+
+        return t1 * mVelX.get(i0, jj) + t0 * mVelX.get(i1, jj);
+      }
+      else
+      {
+        const int i0 = std::min(static_cast<int>(i), mGridWidth - 1);
+        const int j0 = static_cast<int>(j - 0.5f);
+        const int i1 = i0 + 1;
+        const int j1 = j0 + 1;
+
+        const float t0 = i - static_cast<float>(i0);
+        const float t1 = 1.0f - t0;
+        const float s0 = (j - 0.5f) - static_cast<float>(j0);
+        const float s1 = 1.0f - s0;
+
+        return s1 * (t1 * mVelX.get(i0, j0) + t0 * mVelX.get(i1, j0)) +
+               s0 * (t1 * mVelX.get(i0, j1) + t0 * mVelX.get(i1, j1));
+      }
+    }
+
+    float FLIPSolver2D::vVel(float i, float j)
+    {
+      i = glm::clamp(i, 0.0f, static_cast<float>(mGridWidth));
+      j = glm::clamp(j, 0.0f, static_cast<float>(mGridHeight));
+
+      if ((i < 0.5f) || (i > (mGridWidth - 0.5f)))
+      {
+        const int ii = (i <= 0.5f) ? 0 : (mGridWidth - 1);
+        const int j0 = std::min(static_cast<int>(j), mGridHeight - 1);
+        const int j1 = j0 + 1;
+
+        const float t0 = j - static_cast<float>(j0);
+        const float t1 = 1.0f - t0;
+
+        return t1 * mVelY.get(ii, j0) + t0 * mVelY.get(ii, j1);
+      }
+      else
+      {
+        const int i0 = static_cast<int>(i - 0.5f);
+        const int j0 = std::min(static_cast<int>(j), mGridHeight - 1);
+        const int i1 = i0 + 1;
+        const int j1 = j0 + 1;
+
+        const float t0 = (i - 0.5f) - static_cast<float>(i0);
+        const float t1 = 1.0f - t0;
+        const float s0 = j - static_cast<float>(j0);
+        const float s1 = 1.0f - s0;
+
+        return s1 * (t1 * mVelY.get(i0, j0) + t0 * mVelY.get(i1, j0)) +
+               s0 * (t1 * mVelY.get(i0, j1) + t0 * mVelY.get(i1, j1));
+      }
+    }
+
+    int FLIPSolver2D::uIndex_x(float x, float& wx)
+    {
+      const float x_ = glm::clamp(x * mOverDx, 0.0f, static_cast<float>(mGridWidth) - mDx * 1e-5f);
+
+      const int i = static_cast<int>(x_);
+      wx = x_ - i;
+
+      return i;
+    }
+
+    int FLIPSolver2D::uIndex_y(float y, float& wy)
+    {
+      const float y_ = y * mOverDx - 0.5f;
+
+      const int j = static_cast<int>(y_);
+
+      if (j < 0)
+      {
+        wy = 0.0;
+        return 0;
+      }
+
+      if (j > (mGridHeight - 2))
+      {
+        wy = 1.0f;
+        return mGridHeight - 2;
+      }
+
+      wy = y_ - j;
+
+      return j;
+    }
+
+    int FLIPSolver2D::vIndex_x(float x, float& wx)
+    {
+      const float x_ = x * mOverDx - 0.5f;
+
+      const int i = static_cast<int>(x_);
+
+      if (i < 0)
+      {
+        wx = 0.0;
+        return 0;
+      }
 
       if (i > (mGridWidth - 2))
       {
-        wx = 1.0f;
-        return mGridWidth - 2;
+        wx = 1.0f;
+        return mGridWidth - 2;
+      }
+
+      wx = x_ - i;
+
+      return i;
+    }
+
+    int FLIPSolver2D::vIndex_y(float y, float& wy)
+    {
+      const float y_ = glm::clamp(y * mOverDx, 0.0f, static_cast<float>(mGridHeight) - mDx * 1e-5f);
+
+      const int j = static_cast<int>(y_);
+      wy = y_ - j;
+
+      return j;
+    }
+
+    void FLIPSolver2D::applyForce(float dt, float ax, float ay)
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageGridUpdate);
+
+      forEachActiveTile(mGridWidth, mGridHeight, kSolverStageGridUpdate, [=](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; ++j)
+        for (int i = i0; i < i1; ++i)
+        {
+          if (mCellType.get(i, j) == kCellTypeFluid)
+          {
+            u(i, j) += (dt * ax);
+            v(i, j) += (dt * ay);
+          }
+        }
+      });
+    }
+
+    void FLIPSolver2D::setBoundary()
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageGridUpdate);
+
+      applyBoundary();
+    }
+
+    void FLIPSolver2D::applyBoundary()
+    {
+      // Every face touching a solid cell takes the boundary velocity. Faces are visited instead of cells, so
+      // that no face is written by two threads.
+
+      forEachActiveTile(mGridWidth + 1, mGridHeight, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; ++j)
+        for (int i = i0; i < i1; ++i)
+        {
+          if (((i > 0) && (mCellType.get(i - 1, j) == kCellTypeSolid)) ||
+              ((i < mGridWidth) && (mCellType.get(i, j) == kCellTypeSolid)))
+          {
+            u(i, j) = mBoundaryVelocity.x;
+          }
+        }
+      });
+
+      forEachActiveTile(mGridWidth, mGridHeight + 1, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; ++j)
+        for (int i = i0; i < i1; ++i)
+        {
+          if (((j > 0) && (mCellType.get(i, j - 1) == kCellTypeSolid)) ||
+              ((j < mGridHeight) && (mCellType.get(i, j) == kCellTypeSolid)))
+          {
+            v(i, j) = mBoundaryVelocity.y;
+          }
+        }
+      });
+    }
+
+    void FLIPSolver2D::checkBoundary(float i_init_, float j_init_, float& i_end_, float& j_end_)
+    {
+      i_end_ = glm::clamp(i_end_, 0.0f, mGridWidth - 1.0f);
+      j_end_ = glm::clamp(j_end_, 0.0f, mGridHeight - 1.0f);
+
+      const int i_init = static_cast<int>(i_init_);
+      const int j_init = static_cast<int>(j_init_);
+      const int i_end = static_cast<int>(i_end_);
+      const int j_end = static_cast<int>(j_end_);
+
+      if ((i_init == i_end) && (j_init == j_end))
+      {
+        return;
+      }
+
+      if (mCellType.get(i_end, j_end) == kCellTypeSolid)
+      {
+        int i_sub = i_init - i_end;
+        int j_sub = j_init - j_end;
+
+        if ((i_sub != 0) || (j_sub != 0))
+        {
+          if (mCellType.get(i_init + i_sub, j_init) != kCellTypeSolid)
+          {
+            j_sub = 0;
+          }
+          else if (mCellType.get(i_init, j_init + j_sub) != kCellTypeSolid)
+          {
+            i_sub = 0;
+          }
+        }
+
+        if (i_sub != 0)
+        {
+          i_end_ += ((i_end_ - i_end) + 0.1f) * i_sub;
+        }
+        if (j_sub != 0)
+        {
+          j_end_ += ((j_end_ - j_end) + 0.1f) * j_sub;
+        }
+      }
+    }
+
+    void FLIPSolver2D::advectParticles(float dt)
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageAdvection);
+
+      // Particles are traced through the grid velocity with a Runge-Kutta integrator. Each particle takes as many
+      // substeps as it needs to move at most mAdvectionCfl cells in each of them at its starting velocity, so
+      // slow particles take a single substep, and solid cells are only checked at the end of each substep.
+
+      const int numParticles = mParticles.getNumParticles();
+
+      float* particlesX = mParticles.x();
+      float* particlesY = mParticles.y();
+
+      const VelocitySampler<FloatGrid> velocity(mVelX, mVelY, mGridWidth, mGridHeight, mOverDx);
+      const AdvectionIntegrator integrator = mAdvectionIntegrator;
+      const float overCfl = 1.0f / mAdvectionCfl;
+      const float dx = mDx;
+      const float overDx = mOverDx;
+
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStageAdvection, numParticles);
+
+      mNumSortedParticles = -1;
+
+      #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
+      {
+        MK_TRACE_SCOPE("fluids", "advection_thread");
+
+        // The number of substeps changes between particles, so they are handed out in chunks to balance the load
+
+        #pragma omp for schedule(dynamic, kAdvectionChunkSize)
+        for (int p = 0; p < numParticles; p++)
+        {
+          float i_p = particlesX[p] * overDx;
+          float j_p = particlesY[p] * overDx;
+
+          float u_p, v_p;
+          velocity(i_p, j_p, u_p, v_p);
+
+          const float cells = std::sqrt(u_p * u_p + v_p * v_p) * dt;
+          const int substeps = glm::clamp(static_cast<int>(std::ceil(cells * overCfl)), 1, kMaxAdvectionSubsteps);
+          const float h = dt / static_cast<float>(substeps);
+
+          for (int s = 0; s < substeps; s++)
+          {
+            if (s > 0)
+            {
+              velocity(i_p, j_p, u_p, v_p);
+            }
+
+            float i_end, j_end;
+
+            integrateSubstep(velocity, integrator, h, i_p, j_p, u_p, v_p, i_end, j_end);
+            checkBoundary(i_p, j_p, i_end, j_end);
+
+            i_p = i_end;
+            j_p = j_end;
+          }
+
+          particlesX[p] = i_p * dx;
+          particlesY[p] = j_p * dx;
+        }
+      }
+    }
+
+    void FLIPSolver2D::sortParticles()
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageSort);
+
+      // Counting sort by the cell containing each particle, so that the particle passes walk the grids almost
+      // sequentially. Morton order also keeps vertically adjacent cells close in memory.
+
+      const int numParticles = mParticles.getNumParticles();
+      const float* particlesX = mParticles.x();
+      const float* particlesY = mParticles.y();
+
+      int numKeys = mGridSize;
+
+      if (mParticleSortOrder == kParticleSortMorton)
+      {
+        int side = 1;
+
+        while ((side < mGridWidth) || (side < mGridHeight))
+        {
+          side *= 2;
+        }
+
+        numKeys = side * side;
+      }
+
+      mParticleKeys.resize(numParticles);
+      mCellParticleStart.resize(numKeys + 1);
+
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStageSort, numParticles);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int p = 0; p < numParticles; p++)
+      {
+        const int i = glm::clamp(static_cast<int>(particlesX[p] * mOverDx), 0, mGridWidth - 1);
+        const int j = glm::clamp(static_cast<int>(particlesY[p] * mOverDx), 0, mGridHeight - 1);
+
+        mParticleKeys[p] = cellKey(i, j);
+      }
+
+      mParticles.sortByKey(mParticleKeys.data(), numKeys, mCellParticleStart.data(), numThreads);
+
+      mNumSortedParticles = numParticles;
+    }
+
+    int FLIPSolver2D::cellKey(int i, int j) const
+    {
+      if (mParticleSortOrder == kParticleSortMorton)
+      {
+        return static_cast<int>(spreadBits(i) | (spreadBits(j) << 1));
+      }
+
+      return ix(i, j);
+    }
+
+    void FLIPSolver2D::particlesToGrid()
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageParticlesToGrid);
+
+      const int numParticles = mParticles.getNumParticles();
+      const float* particlesX = mParticles.x();
+      const float* particlesY = mParticles.y();
+
+      // Mark fluid particles first, so that the grids store the tiles around the new fluid before the velocity is
+      // splatted. Many particles share a cell, so only the reset runs in parallel. Tiles that were not active hold
+      // no fluid, so their cells are already reset.
+
+      forEachActiveTile(mGridWidth, mGridHeight, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          CellType& type = mCellType.at(i, j);
+
+          if (type != kCellTypeSolid)
+          {
+            type = kCellTypeAir;
+          }
+        }
+      });
+
+      std::fill(mFluidTileMask.begin(), mFluidTileMask.end(), 0);
+
+      for (int p = 0; p < numParticles; p++)
+      {
+        float wx, wy;
+
+        const int i = uIndex_x(particlesX[p], wx);
+        const int j = vIndex_y(particlesY[p], wy);
+
+        if (mCellType.get(i, j) != kCellTypeSolid)
+        {
+          mCellType.at(i, j) = kCellTypeFluid;
+          mFluidTileMask[(i / kTileSize) + (j / kTileSize) * mTilesX] = 1;
+        }
+      }
+
+      updateActiveTiles();
+      fillHoles();
+
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStageParticlesToGrid, numParticles);
+
+      if (numThreads > 1)
+      {
+        particlesToGridParallel(numThreads);
+      }
+      else
+      {
+        // Update u component
+
+        mVelX.fill(0.0f);
+        mWeightSum.fill(0.0f);
+
+        splatVelX(0, numParticles, [this](int i, int j, float vel, float weight)
+        {
+          mVelX.at(i, j) += vel;
+          mWeightSum.at(i, j) += weight;
+        });
+
+        normaliseVel(mVelX);
+
+        // Update v component
+
+        mVelY.fill(0.0f);
+        mWeightSum.fill(0.0f);
+
+        splatVelY(0, numParticles, [this](int i, int j, float vel, float weight)
+        {
+          mVelY.at(i, j) += vel;
+          mWeightSum.at(i, j) += weight;
+        });
+
+        normaliseVel(mVelY);
+      }
+    }
+
+    void FLIPSolver2D::normaliseVel(FloatGrid& vel)
+    {
+      // Divides the splatted velocity of every stored face by its weight
+
+      const int width = vel.getWidth();
+      const int height = vel.getHeight();
+
+      for (int tile : vel.getAllocatedTiles())
+      {
+        const int i0 = (tile % vel.getTilesX()) * kTileSize;
+        const int j0 = (tile / vel.getTilesX()) * kTileSize;
+        const int i1 = std::min(i0 + kTileSize, width);
+        const int j1 = std::min(j0 + kTileSize, height);
+
+        float* data = vel.getTileData(tile);
+
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          const float weight = mWeightSum.get(i, j);
+
+          if (weight != 0)
+          {
+            data[(i - i0) + (j - j0) * kTileSize] /= weight;
+          }
+        }
+      }
+    }
+
+    void FLIPSolver2D::particlesToGridParallel(int numThreads)
+    {
+      // Every thread splats a contiguous range of particles into its own sparse grid, which are then added up in
+      // thread order. The result does not depend on scheduling, and with a single thread it matches the serial
+      // path. Each grid only holds the tiles its particles touch, so memory follows the fluid and not the domain.
+
+      const int numParticles = mParticles.getNumParticles();
+
+      while (static_cast<int>(mTransferGrids.size()) < numThreads)
+      {
+        mTransferGrids.push_back(SparseGrid2D<glm::fvec2, kTileSize>(mGridWidth + 1, mGridHeight + 1,
+                                                                     glm::fvec2(0.0f)));
+      }
+
+      #pragma omp parallel num_threads(numThreads)
+      {
+        MK_TRACE_SCOPE("fluids", "particles_to_grid_thread");
+
+        const int thread = getThreadIndex();
+        const int teamSize = getNumThreads();
+        const int begin = static_cast<int>((static_cast<long long>(numParticles) * thread) / teamSize);
+        const int end = static_cast<int>((static_cast<long long>(numParticles) * (thread + 1)) / teamSize);
+
+        SparseGrid2D<glm::fvec2, kTileSize>& grid = mTransferGrids[thread];
+
+        const auto accumulate = [&grid](int i, int j, float vel, float weight)
+        {
+          glm::fvec2& cell = grid.at(i, j);
+
+          cell.x += vel;
+          cell.y += weight;
+        };
+
+        // Update u component
+
+        grid.clear();
+        splatVelX(begin, end, accumulate);
+
+        #pragma omp barrier
+
+        reduceTransferGrids(mVelX, teamSize);
+
+        // Update v component
+
+        grid.clear();
+        splatVelY(begin, end, accumulate);
+
+        #pragma omp barrier
+
+        reduceTransferGrids(mVelY, teamSize);
+      }
+    }
+
+    void FLIPSolver2D::reduceTransferGrids(FloatGrid& vel, int numThreads)
+    {
+      // Called from inside the parallel region of particlesToGridParallel, it adds the grids of all the threads and
+      // normalises the result tile by tile. The transfer grids have the tiles of the velocity grid, so the tiles
+      // touched by any thread are allocated first, by a single thread as allocation is not thread safe. Stored
+      // tiles no thread touched end up empty.
+
+      const int tileCells = FloatGrid::kTileCells;
+
+      #pragma omp single
+      {
+        for (int thread = 0; thread < numThreads; thread++)
+        {
+          for (int tile : mTransferGrids[thread].getAllocatedTiles())
+          {
+            const int tx = tile % mTransferGrids[thread].getTilesX();
+            const int ty = tile / mTransferGrids[thread].getTilesX();
+
+            vel.allocateTile(tx + ty * vel.getTilesX());
+          }
+        }
+      }
+
+      const std::vector<int>& tiles = vel.getAllocatedTiles();
+      const int numTiles = static_cast<int>(tiles.size());
+      const int gridTilesX = mTransferGrids[0].getTilesX();
+
+      #pragma omp for
+      for (int n = 0; n < numTiles; n++)
+      {
+        const int tile = tiles[n];
+        const int gridTile = (tile % vel.getTilesX()) + (tile / vel.getTilesX()) * gridTilesX;
+
+        glm::fvec2 sum[FloatGrid::kTileCells];
+
+        std::fill(sum, sum + tileCells, glm::fvec2(0.0f));
+
+        for (int thread = 0; thread < numThreads; thread++)
+        {
+          const glm::fvec2* data = mTransferGrids[thread].getTileData(gridTile);
+
+          if (data)
+          {
+            for (int c = 0; c < tileCells; c++)
+            {
+              sum[c] += data[c];
+            }
+          }
+        }
+
+        float* data = vel.getTileData(tile);
+
+        for (int c = 0; c < tileCells; c++)
+        {
+          data[c] = (sum[c].y != 0) ? (sum[c].x / sum[c].y) : sum[c].x;
+        }
+      }
+    }
+
+    template <typename Accumulator>
+    void FLIPSolver2D::splatVelX(int begin, int end, Accumulator accumulate)
+    {
+      const float* particlesX = mParticles.x();
+      const float* particlesY = mParticles.y();
+      const float* particlesU = mParticles.u();
+      const float* affineI = mParticles.c00();
+      const float* affineJ = mParticles.c01();
+      const float dx = mDx;
+
+      // With APIC, each face gets the velocity of the particle plus its change along the offset from the particle
+      // to the face, given by the affine matrix. Without it the change is 0 and the velocity is splatted as is.
+
+      for (int p = begin; p < end; p++)
+      {
+        float wx, wy, w;
+
+        const int i = uIndex_x(particlesX[p], wx);
+        const int j = uIndex_y(particlesY[p], wy);
+
+        const float vel = particlesU[p];
+        const float di = affineI ? (affineI[p] * dx) : 0.0f;
+        const float dj = affineJ ? (affineJ[p] * dx) : 0.0f;
+
+        w = (1.0f - wx) * (1.0f - wy);
+        accumulate(i, j, (vel - di * wx - dj * wy) * w, w);
+
+        w = wx * (1.0f - wy);
+        accumulate(i + 1, j, (vel + di * (1.0f - wx) - dj * wy) * w, w);
+
+        w = (1.0f - wx) * wy;
+        accumulate(i, j + 1, (vel - di * wx + dj * (1.0f - wy)) * w, w);
+
+        w = wx * wy;
+        accumulate(i + 1, j + 1, (vel + di * (1.0f - wx) + dj * (1.0f - wy)) * w, w);
+      }
+    }
+
+    template <typename Accumulator>
+    void FLIPSolver2D::splatVelY(int begin, int end, Accumulator accumulate)
+    {
+      const float* particlesX = mParticles.x();
+      const float* particlesY = mParticles.y();
+      const float* particlesV = mParticles.v();
+      const float* affineI = mParticles.c10();
+      const float* affineJ = mParticles.c11();
+      const float dx = mDx;
+
+      for (int p = begin; p < end; p++)
+      {
+        float wx, wy, w;
+
+        const int i = vIndex_x(particlesX[p], wx);
+        const int j = vIndex_y(particlesY[p], wy);
+
+        const float vel = particlesV[p];
+        const float di = affineI ? (affineI[p] * dx) : 0.0f;
+        const float dj = affineJ ? (affineJ[p] * dx) : 0.0f;
+
+        w = (1.0f - wx) * (1.0f - wy);
+        accumulate(i, j, (vel - di * wx - dj * wy) * w, w);
+
+        w = wx * (1.0f - wy);
+        accumulate(i + 1, j, (vel + di * (1.0f - wx) - dj * wy) * w, w);
+
+        w = (1.0f - wx) * wy;
+        accumulate(i, j + 1, (vel - di * wx + dj * (1.0f - wy)) * w, w);
+
+        w = wx * wy;
+        accumulate(i + 1, j + 1, (vel + di * (1.0f - wx) + dj * (1.0f - wy)) * w, w);
+      }
+    }
+
+    void FLIPSolver2D::gridToParticles()
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageGridToParticles);
+
+      const int numParticles = mParticles.getNumParticles();
+      const float* particlesX = mParticles.x();
+      const float* particlesY = mParticles.y();
+      float* particlesU = mParticles.u();
+      float* particlesV = mParticles.v();
+
+      float* affine00 = mParticles.c00();
+      float* affine01 = mParticles.c01();
+      float* affine10 = mParticles.c10();
+      float* affine11 = mParticles.c11();
+      const bool apic = (mVelocityTransfer == kVelocityTransferApic) && (affine00 != nullptr);
+
+      const float width = static_cast<float>(mGridWidth);
+      const float height = static_cast<float>(mGridHeight);
+      const float picFactor = mPicFlipFactor;
+      const float flipFactor = 1.0f - mPicFlipFactor;
+      const float overDx = mOverDx;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStageGridToParticles, numParticles);
+
+      // Every particle only reads the grids and writes its own velocity, so the loop only synchronises to find
+      // the largest speed, used to pick the next time step
+
+      float maxSpeedSquared = 0.0f;
+
+      #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
+      {
+        float localMax = 0.0f;
+
+        #pragma omp for
+        for (int p = 0; p < numParticles; p++)
+        {
+          const float i_p = glm::clamp(particlesX[p] * overDx, 0.0f, width);
+          const float j_p = glm::clamp(particlesY[p] * overDx, 0.0f, height);
+
+          if (apic)
+          {
+            // APIC takes the PIC velocity, and keeps the gradient of the bilinear interpolant as the affine
+            // matrix, which carries the rotation and shear that PIC alone would dissipate
+
+            float gradI, gradJ;
+
+            particlesU[p] = interpolateWithGradient(mVelX, mGridWidth, mGridHeight - 1, i_p,
+                                                    glm::clamp(j_p - 0.5f, 0.0f, height - 1.0f), gradI, gradJ);
+            affine00[p] = gradI * overDx;
+            affine01[p] = gradJ * overDx;
+
+            particlesV[p] = interpolateWithGradient(mVelY, mGridWidth - 1, mGridHeight,
+                                                    glm::clamp(i_p - 0.5f, 0.0f, width - 1.0f), j_p, gradI, gradJ);
+            affine10[p] = gradI * overDx;
+            affine11[p] = gradJ * overDx;
+
+            localMax = std::max(localMax, particlesU[p] * particlesU[p] + particlesV[p] * particlesV[p]);
+            continue;
+          }
+
+          // The velocity and its change in the last step are interpolated together, giving the PIC velocity
+          // and the FLIP delta
+
+          float u_pic, u_delta;
+          float v_pic, v_delta;
+
+          interpolatePair(mVelX, mDeltaVelX, mGridWidth, mGridHeight - 1,
+                          i_p, glm::clamp(j_p - 0.5f, 0.0f, height - 1.0f), u_pic, u_delta);
+
+          interpolatePair(mVelY, mDeltaVelY, mGridWidth - 1, mGridHeight,
+                          glm::clamp(i_p - 0.5f, 0.0f, width - 1.0f), j_p, v_pic, v_delta);
+
+          // Lerp between both to control numerical viscosity
+
+          particlesU[p] = picFactor * u_pic + flipFactor * (particlesU[p] + u_delta);
+          particlesV[p] = picFactor * v_pic + flipFactor * (particlesV[p] + v_delta);
+
+          localMax = std::max(localMax, particlesU[p] * particlesU[p] + particlesV[p] * particlesV[p]);
+        }
+
+        #pragma omp critical
+        maxSpeedSquared = std::max(maxSpeedSquared, localMax);
+      }
+
+      mMaxSpeedSquared = maxSpeedSquared;
+      mMaxSpeedParticles = numParticles;
+
+      fillHoles();
+    }
+
+    void FLIPSolver2D::fillHoles()
+    {
+      // Air cells with at least three non air neighbours become fluid. Candidates are only looked for in active
+      // tiles, which surround every fluid cell.
+
+      forEachActiveTile(mGridWidth, mGridHeight, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; ++j)
+        for (int i = i0; i < i1; ++i)
+        {
+          CellType& aux = mCellTypeAux.at(i, j);
+
+          aux = kCellTypeAir;
+
+          if (mCellType.get(i, j) == kCellTypeAir)
+          {
+            int adjacentNonAirCells = 0;
+
+            if ((i == 0) || (mCellType.get(i - 1, j) != kCellTypeAir))
+            {
+              ++adjacentNonAirCells;
+            }
+            if ((i == (mGridWidth - 1)) || (mCellType.get(i + 1, j) != kCellTypeAir))
+            {
+              ++adjacentNonAirCells;
+            }
+            if ((j == 0) || (mCellType.get(i, j - 1) != kCellTypeAir))
+            {
+              ++adjacentNonAirCells;
+            }
+            if ((j == (mGridHeight - 1)) || (mCellType.get(i, j + 1) != kCellTypeAir))
+            {
+              ++adjacentNonAirCells;
+            }
+            if (adjacentNonAirCells >= 3)
+            {
+              aux = kCellTypeFluid;
+            }
+          }
+        }
+      });
+
+      forEachActiveTile(mGridWidth, mGridHeight, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; ++j)
+        for (int i = i0; i < i1; ++i)
+        {
+          if (mCellTypeAux.get(i, j) == kCellTypeFluid)
+          {
+            mCellType.at(i, j) = kCellTypeFluid;
+            mFluidTileMask[(i0 / kTileSize) + (j0 / kTileSize) * mTilesX] = 1;
+          }
+        }
+      });
+
+      updateActiveTiles();
+    }
+
+    void FLIPSolver2D::updateActiveTiles()
+    {
+      // Tiles with fluid are active, and so are their neighbours up to the margin, which hold the faces read by
+      // the transfers, the pressure stencil and the velocity extrapolation around the fluid.
+
+      std::fill(mActiveTileMask.begin(), mActiveTileMask.end(), 0);
+
+      for (int ty = 0; ty < mTilesY; ty++)
+      for (int tx = 0; tx < mTilesX; tx++)
+      {
+        if (mFluidTileMask[tx + ty * mTilesX])
+        {
+          const int tx0 = std::max(tx - kTileActivityMargin, 0);
+          const int tx1 = std::min(tx + kTileActivityMargin, mTilesX - 1);
+          const int ty0 = std::max(ty - kTileActivityMargin, 0);
+          const int ty1 = std::min(ty + kTileActivityMargin, mTilesY - 1);
+
+          for (int y = ty0; y <= ty1; y++)
+          for (int x = tx0; x <= tx1; x++)
+          {
+            mActiveTileMask[x + y * mTilesX] = 1;
+          }
+        }
+      }
+
+      mActiveTiles.clear();
+
+      for (int t = 0; t < mTilesX * mTilesY; t++)
+      {
+        if (mActiveTileMask[t])
+        {
+          mActiveTiles.push_back(t);
+        }
+      }
+
+      updateGridTiles();
+    }
+
+    void FLIPSolver2D::updateGridTiles()
+    {
+      // The grids store the tiles covering the active ones, and the cell types also the tiles with solid cells.
+      // The distance field and the extrapolation fronts follow the velocity grids on their own.
+
+      FloatGrid* const grids[] = { &mVelX, &mVelY, &mDeltaVelX, &mDeltaVelY, &mWeightSum };
+
+      for (FloatGrid* grid : grids)
+      {
+        updateGridTiles(*grid, false);
+      }
+
+      updateGridTiles(mCellType, true);
+      updateGridTiles(mCellTypeAux, false);
+      updateGridTiles(mCompactIndex, false);
+    }
+
+    template <typename T>
+    void FLIPSolver2D::updateGridTiles(SparseGrid2D<T, kTileSize>& grid, bool keepSolidTiles)
+    {
+      const int numGridTiles = grid.getNumTiles();
+
+      for (int tile = 0; tile < numGridTiles; tile++)
+      {
+        const int t = getSolverTile(tile, grid.getTilesX());
+
+        if (mActiveTileMask[t])
+        {
+          grid.allocateTile(tile);
+        }
+        else if (!keepSolidTiles || !mSolidTileMask[t])
+        {
+          grid.releaseTile(tile);
+        }
+      }
+    }
+
+    template <typename T>
+    void FLIPSolver2D::allocateGridTiles(SparseGrid2D<T, kTileSize>& grid, int tile)
+    {
+      // The last column and row of tiles also cover the extra faces of the staggered grids, which can fall in one
+      // more tile of the grid
+
+      const int tx = tile % mTilesX;
+      const int ty = tile / mTilesX;
+      const int tx1 = (tx == (mTilesX - 1)) ? (grid.getTilesX() - 1) : tx;
+      const int ty1 = (ty == (mTilesY - 1)) ? (grid.getTilesY() - 1) : ty;
+
+      for (int y = ty; y <= ty1; y++)
+      for (int x = tx; x <= tx1; x++)
+      {
+        grid.allocateTile(x + y * grid.getTilesX());
+      }
+    }
+
+    void FLIPSolver2D::getGridTiles(const FloatGrid& grid, const unsigned char* activeTileMask,
+                                    std::vector<int>& tiles) const
+    {
+      // Tiles of a velocity grid covering the active tiles of the given mask, in increasing order
+
+      tiles.clear();
+
+      for (int tile = 0; tile < grid.getNumTiles(); tile++)
+      {
+        if (activeTileMask[getSolverTile(tile, grid.getTilesX())])
+        {
+          tiles.push_back(tile);
+        }
+      }
+    }
+
+    int FLIPSolver2D::getSolverTile(int gridTile, int gridTilesX) const
+    {
+      // Solver tile covering a tile of a grid, the extra faces of the staggered grids going to the last tiles
+
+      const int tx = std::min(gridTile % gridTilesX, mTilesX - 1);
+      const int ty = std::min(gridTile / gridTilesX, mTilesY - 1);
+
+      return tx + ty * mTilesX;
+    }
+
+    void FLIPSolver2D::getTileBounds(int tile, int width, int height, int& i0, int& i1, int& j0, int& j1) const
+    {
+      // The tiles of the last column and row also take the extra faces of the staggered grids
+
+      const int tx = tile % mTilesX;
+      const int ty = tile / mTilesX;
+
+      i0 = tx * kTileSize;
+      j0 = ty * kTileSize;
+      i1 = (tx == (mTilesX - 1)) ? width : std::min(i0 + kTileSize, width);
+      j1 = (ty == (mTilesY - 1)) ? height : std::min(j0 + kTileSize, height);
+    }
+
+    template <typename Function>
+    void FLIPSolver2D::forEachActiveTile(int width, int height, SolverStage stage, Function function)
+    {
+      // Calls function(i0, i1, j0, j1) with the range of every active tile in a grid of width x height cells or
+      // faces. Tiles do not overlap, so the calls run concurrently.
+
+      const int numActiveTiles = static_cast<int>(mActiveTiles.size());
+      const int numThreads = mExecutionPolicy.getNumThreads(stage, numActiveTiles * kTileSize * kTileSize);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int n = 0; n < numActiveTiles; n++)
+      {
+        int i0, i1, j0, j1;
+
+        getTileBounds(mActiveTiles[n], width, height, i0, i1, j0, j1);
+        function(i0, i1, j0, j1);
+      }
+    }
+
+    void FLIPSolver2D::storeVel()
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageGridUpdate);
+
+      forEachActiveTile(mGridWidth + 1, mGridHeight, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          mDeltaVelX.at(i, j) = mVelX.get(i, j);
+        }
+      });
+
+      forEachActiveTile(mGridWidth, mGridHeight + 1, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          mDeltaVelY.at(i, j) = mVelY.get(i, j);
+        }
+      });
+    }
+
+    void FLIPSolver2D::subtractVel()
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageGridUpdate);
+
+      forEachActiveTile(mGridWidth + 1, mGridHeight, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          float& delta = mDeltaVelX.at(i, j);
+
+          delta = mVelX.get(i, j) - delta;
+        }
+      });
+
+      forEachActiveTile(mGridWidth, mGridHeight + 1, kSolverStageGridUpdate, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          float& delta = mDeltaVelY.at(i, j);
+
+          delta = mVelY.get(i, j) - delta;
+        }
+      });
+    }
+
+    void FLIPSolver2D::computeGridPhi()
+    {
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageDistance);
+
+      mDistanceField.setExecutionPolicy(mExecutionPolicy);
+      mDistanceField.compute(mCellType, mPhi);
+    }
+
+    void FLIPSolver2D::sweepU(int di, int dj)
+    {
+      // Gauss-Seidel sweep along (di, dj) over the faces of the stored tiles, skipping the border of the grid. The
+      // tiles are visited in the order of the sweep, so every face still reads its (i - di) and (j - dj) neighbours
+      // after they are updated, as a sweep over the whole grid does.
+
+      const int tilesX = mVelX.getTilesX();
+      const int tilesY = mVelX.getTilesY();
+
+      float dp, dq, alpha;
+
+      for (int n = 0; n < tilesY; n++)
+      for (int m = 0; m < tilesX; m++)
+      {
+        const int tx = (di > 0) ? m : (tilesX - 1 - m);
+        const int ty = (dj > 0) ? n : (tilesY - 1 - n);
+
+        if (!mVelX.getTileData(tx + ty * tilesX))
+        {
+          continue;
+        }
+
+        const int i0 = std::max(tx * kTileSize, 1);
+        const int i1 = std::min((tx + 1) * kTileSize, mGridWidth);
+        const int j0 = std::max(ty * kTileSize, 1);
+        const int j1 = std::min((ty + 1) * kTileSize, mGridHeight - 1);
+
+        for (int j = (dj > 0) ? j0 : (j1 - 1); (j >= j0) && (j < j1); j += dj)
+        for (int i = (di > 0) ? i0 : (i1 - 1); (i >= i0) && (i < i1); i += di)
+        {
+          if ((mCellType.get(i - 1, j) == kCellTypeAir) && (mCellType.get(i, j) == kCellTypeAir))
+          {
+            dp = di * (mPhi.get(i, j) - mPhi.get(i - 1, j));
+
+            if (dp < 0)
+            {
+              continue;
+            }
+
+            dq = 0.5f * (mPhi.get(i - 1, j) + mPhi.get(i, j) - mPhi.get(i - 1, j - dj) - mPhi.get(i, j - dj));
+
+            if (dq < 0)
+            {
+              continue;
+            }
+
+            if ((dp + dq) < kEpsilon)
+            {
+              alpha = 0.5f;
+            }
+            else
+            {
+              alpha = dp / (dp + dq);
+            }
+
+            mVelX.at(i, j) = alpha * mVelX.get(i - di, j) + (1.0f - alpha) * mVelX.get(i, j - dj);
+          }
+        }
       }
+    }
+
+    void FLIPSolver2D::sweepV(int di, int dj)
+    {
+      // Same as sweepU, for the v faces
+
+      const int tilesX = mVelY.getTilesX();
+      const int tilesY = mVelY.getTilesY();
+
+      float dp, dq, alpha;
+
+      for (int n = 0; n < tilesY; n++)
+      for (int m = 0; m < tilesX; m++)
+      {
+        const int tx = (di > 0) ? m : (tilesX - 1 - m);
+        const int ty = (dj > 0) ? n : (tilesY - 1 - n);
 
-      wx = x_ - i;
+        if (!mVelY.getTileData(tx + ty * tilesX))
+        {
+          continue;
+        }
 
-      return i;
+        const int i0 = std::max(tx * kTileSize, 1);
+        const int i1 = std::min((tx + 1) * kTileSize, mGridWidth - 1);
+        const int j0 = std::max(ty * kTileSize, 1);
+        const int j1 = std::min((ty + 1) * kTileSize, mGridHeight);
+
+        for (int j = (dj > 0) ? j0 : (j1 - 1); (j >= j0) && (j < j1); j += dj)
+        for (int i = (di > 0) ? i0 : (i1 - 1); (i >= i0) && (i < i1); i += di)
+        {
+          if ((mCellType.get(i, j - 1) == kCellTypeAir) && (mCellType.get(i, j) == kCellTypeAir))
+          {
+            dq = dj * (mPhi.get(i, j) - mPhi.get(i, j - 1));
+
+            if (dq < 0)
+            {
+              continue;
+            }
+
+            dp = 0.5f * (mPhi.get(i, j - 1) + mPhi.get(i, j) - mPhi.get(i - di, j - 1) - mPhi.get(i - di, j));
+
+            if (dp < 0)
+            {
+              continue;
+            }
+
+            if (std::fabs(dp + dq) < kEpsilon)
+            {
+              alpha = 0.5f;
+            }
+            else
+            {
+              alpha = dp / (dp + dq);
+            }
+
+            mVelY.at(i, j) = alpha * mVelY.get(i - di, j) + (1.0f - alpha) * mVelY.get(i, j - dj);
+          }
+        }
+      }
     }
 
-    int FLIPSolver2D::vIndex_y(float y, float& wy)
+    void FLIPSolver2D::extrapolateVel()
     {
-      const float y_ = glm::clamp(y * mOverDx, 0.0f, static_cast<float>(mGridHeight) - mDx * 1e-5f);
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStageExtrapolation);
 
-      const int j = static_cast<int>(y_);
-      wy = y_ - j;
+      // The u and v components are extrapolated independently, so both can run at the same time
 
-      return j;
+      const int numThreads = std::min(2, mExecutionPolicy.getNumThreads(kSolverStageExtrapolation, mGridSize));
+
+      #pragma omp parallel sections num_threads(numThreads) if (numThreads > 1)
+      {
+        #pragma omp section
+        extrapolateU();
+
+        #pragma omp section
+        extrapolateV();
+      }
     }
 
-    void FLIPSolver2D::applyForce(float dt, float ax, float ay)
+    void FLIPSolver2D::extrapolateU()
     {
-      for (int j = 0; j < mGridHeight; ++j)
-      for (int i = 0; i < mGridWidth; ++i)
+      const bool layered = (mVelocityExtrapolation == kExtrapolationLayered);
+      const int rounds = layered ? 1 : kSweepExtrapolationRounds;
+
+      for (int r = 0; r < rounds; r++)
       {
-        if (mCellType[ix(i, j)] == kCellTypeFluid)
+        if (layered)
+        {
+          extrapolateLayered(mVelX, 1, 0, mExtrapolationU);
+        }
+        else
         {
-          u(i, j) += (dt * ax);
-          v(i, j) += (dt * ay);
+          sweepU(1, 1);
+          sweepU(1, -1);
+          sweepU(-1, 1);
+          sweepU(-1, -1);
         }
+
+        copyBorderFaces(mVelX);
       }
     }
 
-    void FLIPSolver2D::setBoundary()
+    void FLIPSolver2D::extrapolateV()
     {
-      for (int j = 0; j < mGridHeight; ++j)
-      for (int i = 0; i < mGridWidth; ++i)
+      const bool layered = (mVelocityExtrapolation == kExtrapolationLayered);
+      const int rounds = layered ? 1 : kSweepExtrapolationRounds;
+
+      for (int r = 0; r < rounds; r++)
       {
-        if (mCellType[ix(i, j)] == kCellTypeSolid)
+        if (layered)
+        {
+          extrapolateLayered(mVelY, 0, 1, mExtrapolationV);
+        }
+        else
         {
-          u(i, j) = mBoundaryVelocity.x;
-          u(i + 1, j) = mBoundaryVelocity.x;
+          sweepV(1, 1);
+          sweepV(1, -1);
+          sweepV(-1, 1);
+          sweepV(-1, -1);
+        }
+
+        copyBorderFaces(mVelY);
+      }
+    }
 
-          v(i, j) = mBoundaryVelocity.y;
-          v(i, j + 1) = mBoundaryVelocity.y;
+    void FLIPSolver2D::copyBorderFaces(FloatGrid& vel)
+    {
+      // Faces on the border of the grid take the velocity of the next face inwards, rows first. Faces of tiles
+      // that are not stored are only read around inactive tiles, so they are not written.
+
+      const int width = vel.getWidth();
+      const int height = vel.getHeight();
+
+      const auto copy = [&vel](int i, int j, int si, int sj)
+      {
+        if (vel.getTileData(vel.getTile(i, j)))
+        {
+          vel.at(i, j) = vel.get(si, sj);
         }
+      };
+
+      for (int i = 0; i < width; i++)
+      {
+        copy(i, 0, i, 1);
+        copy(i, height - 1, i, height - 2);
+      }
+
+      for (int j = 0; j < height; j++)
+      {
+        copy(0, j, 1, j);
+        copy(width - 1, j, width - 2, j);
       }
     }
 
-    void FLIPSolver2D::checkBoundary(float i_init_, float j_init_, float& i_end_, float& j_end_)
+    void FLIPSolver2D::extrapolateLayered(FloatGrid& vel, int offsetI, int offsetJ, ExtrapolationFront& front)
     {
-      i_end_ = glm::clamp(i_end_, 0.0f, mGridWidth - 1.0f);
-      j_end_ = glm::clamp(j_end_, 0.0f, mGridHeight - 1.0f);
+      // Faces touching a fluid cell are known, and faces touching a solid cell keep their boundary velocity. Only
+      // faces between two air cells are extrapolated, one layer at a time: every face next to a known one gets the
+      // average of its known neighbours, all of them computed before any is written so that the order of the
+      // front does not matter. The work done by the layers is proportional to the length of the surface. Faces
+      // the front does not reach within the layer count are set to 0.
+      //
+      // Only faces of active tiles are classified. The state only stores the tiles the velocity does, and faces
+      // of the rest read as fixed, so the front never leaves the stored tiles.
 
-      const int i_init = static_cast<int>(i_init_);
-      const int j_init = static_cast<int>(j_init_);
-      const int i_end = static_cast<int>(i_end_);
-      const int j_end = static_cast<int>(j_end_);
+      const int width = vel.getWidth();
+      const int height = vel.getHeight();
+      const int numActiveTiles = static_cast<int>(mActiveTiles.size());
 
-      if ((i_init == i_end) && (j_init == j_end))
+      SparseGrid2D<unsigned char, kTileSize>& state = front.state;
+
+      state.clear();
+
+      for (int tile : vel.getAllocatedTiles())
       {
-        return;
+        state.allocateTile(tile);
       }
 
-      if (mCellType[ix(i_end, j_end)] == kCellTypeSolid)
+      front.current.clear();
+
+      for (int n = 0; n < numActiveTiles; n++)
       {
-        int i_sub = i_init - i_end;
-        int j_sub = j_init - j_end;
+        int i0, i1, j0, j1;
 
-        if ((i_sub != 0) || (j_sub != 0))
+        getTileBounds(mActiveTiles[n], width, height, i0, i1, j0, j1);
+
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
         {
-          if (mCellType[ix(i_init + i_sub, j_init)] != kCellTypeSolid)
+          const int ia = i - offsetI;
+          const int ja = j - offsetJ;
+
+          const bool insideA = (ia >= 0) && (ja >= 0);
+          const bool insideB = (i < mGridWidth) && (j < mGridHeight);
+          const CellType typeA = insideA ? mCellType.get(ia, ja) : kCellTypeSolid;
+          const CellType typeB = insideB ? mCellType.get(i, j) : kCellTypeSolid;
+
+          if ((typeA == kCellTypeFluid) || (typeB == kCellTypeFluid))
           {
-            j_sub = 0;
+            state.at(i, j) = kFaceKnown;
           }
-          else if (mCellType[ix(i_init, j_init + j_sub)] != kCellTypeSolid)
+          else if ((typeA == kCellTypeAir) && (typeB == kCellTypeAir))
           {
-            i_sub = 0;
+            state.at(i, j) = kFaceUnknown;
+          }
+          else
+          {
+            state.at(i, j) = kFaceFixed;
           }
         }
+      }
 
-        if (i_sub != 0)
+      // The first front are the unknown faces next to the surface
+
+      for (int n = 0; n < numActiveTiles; n++)
+      {
+        int i0, i1, j0, j1;
+
+        getTileBounds(mActiveTiles[n], width, height, i0, i1, j0, j1);
+
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
         {
-          i_end_ += ((i_end_ - i_end) + 0.1f) * i_sub;
+          if ((state.get(i, j) == kFaceUnknown) &&
+              (((i > 0) && (state.get(i - 1, j) == kFaceKnown)) ||
+               ((i < (width - 1)) && (state.get(i + 1, j) == kFaceKnown)) ||
+               ((j > 0) && (state.get(i, j - 1) == kFaceKnown)) ||
+               ((j < (height - 1)) && (state.get(i, j + 1) == kFaceKnown))))
+          {
+            state.at(i, j) = kFaceQueued;
+            front.current.push_back(i + j * width);
+          }
         }
-        if (j_sub != 0)
+      }
+
+      for (int layer = 0; (layer < mExtrapolationLayers) && !front.current.empty(); layer++)
+      {
+        const int frontSize = static_cast<int>(front.current.size());
+
+        front.values.resize(frontSize);
+        front.next.clear();
+
+        for (int n = 0; n < frontSize; n++)
         {
-          j_end_ += ((j_end_ - j_end) + 0.1f) * j_sub;
+          const int f = front.current[n];
+          const int i = f % width;
+          const int j = f / width;
+
+          float sum = 0.0f;
+          int count = 0;
+
+          if ((i > 0) && (state.get(i - 1, j) == kFaceKnown))
+          {
+            sum += vel.get(i - 1, j);
+            ++count;
+          }
+          if ((i < (width - 1)) && (state.get(i + 1, j) == kFaceKnown))
+          {
+            sum += vel.get(i + 1, j);
+            ++count;
+          }
+          if ((j > 0) && (state.get(i, j - 1) == kFaceKnown))
+          {
+            sum += vel.get(i, j - 1);
+            ++count;
+          }
+          if ((j < (height - 1)) && (state.get(i, j + 1) == kFaceKnown))
+          {
+            sum += vel.get(i, j + 1);
+            ++count;
+          }
+
+          front.values[n] = sum / static_cast<float>(count);
         }
-      }
-    }
 
-    void FLIPSolver2D::advectParticles(float dt)
-    {
-      // Advect particles with five substeps of ( 0.2f * dt ) timestep
+        for (int n = 0; n < frontSize; n++)
+        {
+          const int f = front.current[n];
 
-      const int substeps = 5;
-      const float stepFraction = 1.0f / static_cast<float>(substeps);
+          vel.at(f % width, f / width) = front.values[n];
+          state.at(f % width, f / width) = kFaceKnown;
+        }
 
-      for (int r = 0; r < substeps; r++)
-      {
-        #pragma omp for
-        for (int p = 0; p < mParticles.numParticles; p++)
+        for (int n = 0; n < frontSize; n++)
         {
-          const float i_p = mParticles.positions[p].x * mOverDx;
-          const float j_p = mParticles.positions[p].y * mOverDx;
+          const int f = front.current[n];
+          const int i = f % width;
+          const int j = f / width;
+
+          const int neighbours[4][2] = { { i - 1, j }, { i + 1, j }, { i, j - 1 }, { i, j + 1 } };
+
+          for (const int* g : neighbours)
+          {
+            if ((g[0] >= 0) && (g[0] < width) && (g[1] >= 0) && (g[1] < height) &&
+                (state.get(g[0], g[1]) == kFaceUnknown))
+            {
+              state.at(g[0], g[1]) = kFaceQueued;
+              front.next.push_back(g[0] + g[1] * width);
+            }
+          }
+        }
+
+        front.current.swap(front.next);
+      }
 
-          float i_mid = (i_p * mDx + uVel(i_p, j_p)	* dt * stepFraction * 0.5f) * mOverDx;
-          float j_mid = (j_p * mDx + vVel(i_p, j_p)	* dt * stepFraction * 0.5f) * mOverDx;
+      // Faces the front did not reach still hold what the particles splatted, if anything. They are set to 0, so
+      // that no stale velocity is left next to the extrapolated band.
 
-          checkBoundary(i_p, j_p, i_mid, j_mid);
+      for (int n = 0; n < numActiveTiles; n++)
+      {
+        int i0, i1, j0, j1;
 
-          float i_final = (i_p * mDx + uVel(i_mid, j_mid) * dt * stepFraction * 0.5f) * mOverDx;
-          float j_final = (j_p * mDx + vVel(i_mid, j_mid) * dt * stepFraction * 0.5f) * mOverDx;
+        getTileBounds(mActiveTiles[n], width, height, i0, i1, j0, j1);
 
-          checkBoundary(i_p, j_p, i_final, j_final);
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          const unsigned char faceState = state.get(i, j);
 
-          mParticles.positions[p].x = i_final * mDx;
-          mParticles.positions[p].y = j_final * mDx;
+          if ((faceState == kFaceUnknown) || (faceState == kFaceQueued))
+          {
+            vel.at(i, j) = 0.0f;
+          }
         }
       }
     }
 
-    void FLIPSolver2D::particlesToGrid()
+    void FLIPSolver2D::project(float dt)
     {
-      // Update u component
+      MK_PHYSICS_PROFILE_STAGE(mStats, kSolverStagePressure);
+
+      buildFluidCellList();
 
-      std::fill(mVelX.begin(), mVelX.end(), 0.0f);
-      std::fill(mWeightSum.begin(), mWeightSum.end(), 0.0f);
+      const int numFluidCells = mNumFluidCells;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, numFluidCells);
 
-      for (int p = 0; p < mParticles.numParticles; p++)
+      double* coefDiag = mPcgDouble.coefDiag.data();
+      double* coefPlusI = mPcgDouble.coefPlusI.data();
+      double* coefPlusJ = mPcgDouble.coefPlusJ.data();
+
+      // Set the right hand side of the equation system and the coefficients
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int k = 0; k < numFluidCells; k++)
       {
-        float wx, wy, w;
+        const int ix_ = mFluidCells[k];
+        const int i = ix_ % mGridWidth;
+        const int j = ix_ / mGridWidth;
 
-        const int i = uIndex_x(mParticles.positions[p].x, wx);
-        const int j = uIndex_y(mParticles.positions[p].y, wy);
+        const float u0 = mVelX.get(i, j);
+        const float u1 = mVelX.get(i + 1, j);
+        const float v0 = mVelY.get(i, j);
+        const float v1 = mVelY.get(i, j + 1);
 
-        w = (1.0f - wx) * (1.0f - wy);
-        u(i, j) += mParticles.velocities[p].x * w;
-        mWeightSum[ixBig(i, j)] += w;
+        mRhs[k] = (u1 - u0 + v1 - v0);
 
-        w = wx * (1.0f - wy);
-        u(i + 1, j) += mParticles.velocities[p].x * w;
-        mWeightSum[ixBig(i + 1, j)] += w;
+        if ((i > 0) && (mCellType.get(i - 1, j) == kCellTypeSolid))
+        {
+          mRhs[k] -= (mBoundaryVelocity.x - u0);
+        }
+        if ((i < (mGridWidth - 1)) && (mCellType.get(i + 1, j) == kCellTypeSolid))
+        {
+          mRhs[k] -= (u1 - mBoundaryVelocity.x);
+        }
+        if ((j > 0) && (mCellType.get(i, j - 1) == kCellTypeSolid))
+        {
+          mRhs[k] -= (mBoundaryVelocity.y - v0);
+        }
+        if ((j < (mGridHeight - 1)) && (mCellType.get(i, j + 1) == kCellTypeSolid))
+        {
+          mRhs[k] -= (v1 - mBoundaryVelocity.y);
+        }
 
-        w = (1.0f - wx) * wy;
-        u(i, j + 1) += mParticles.velocities[p].x * w;
-        mWeightSum[ixBig(i, j + 1)] += w;
+        coefDiag[k] = 0.0;
+        coefPlusI[k] = 0.0;
+        coefPlusJ[k] = 0.0;
 
-        w = wx * wy;
-        u(i + 1, j + 1) += mParticles.velocities[p].x * w;
-        mWeightSum[ixBig(i + 1, j + 1)] += w;
-      }
+        if (mCellType.get(i + 1, j) != kCellTypeSolid)
+        {
+          coefDiag[k] += 1.0f;
 
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth + 1; i++)
-      {
-        const int ix = ixBig(i, j);
+          if (mCellType.get(i + 1, j) == kCellTypeFluid)
+          {
+            coefPlusI[k] = -1.0f;
+          }
+        }
+
+        if (mCellType.get(i - 1, j) != kCellTypeSolid)
+        {
+          coefDiag[k] += 1.0f;
+        }
+
+        if (mCellType.get(i, j + 1) != kCellTypeSolid)
+        {
+          coefDiag[k] += 1.0f;
+
+          if (mCellType.get(i, j + 1) == kCellTypeFluid)
+          {
+            coefPlusJ[k] = -1.0f;
+          }
+        }
 
-        if (mWeightSum[ix] != 0)
+        if (mCellType.get(i, j - 1) != kCellTypeSolid)
         {
-          u(i, j) /= mWeightSum[ix];
+          coefDiag[k] += 1.0f;
         }
       }
 
-      // Update v component
+      // Solve for pressure with PCG algorithm
+
+      if (mPressureWarmStart)
+      {
+        loadPressureGuess(dt);
+      }
 
-      std::fill(mVelY.begin(), mVelY.end(), 0.0f);
-      std::fill(mWeightSum.begin(), mWeightSum.end(), 0.0f);
+      solvePressure();
 
-      for (int p = 0; p < mParticles.numParticles; p++)
+      if (mPressureWarmStart)
       {
-        float wx, wy, w;
+        storePressureGuess(dt);
+      }
 
-        const int i = vIndex_x(mParticles.positions[p].x, wx);
-        const int j = vIndex_y(mParticles.positions[p].y, wy);
+      // Apply pressure to update velocity. Every face gathers the pressure of the cells on both sides, so faces are
+      // written by a single thread. Every face next to a fluid cell lies in an active tile.
 
-        w = (1.0f - wx) * (1.0f - wy);
-        v(i, j) += mParticles.velocities[p].y * w;
-        mWeightSum[ix(i, j)] += w;
+      forEachActiveTile(mGridWidth + 1, mGridHeight, kSolverStagePressure, [this](int i0, int i1, int j0, int j1)
+      {
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
+        {
+          const int kMinus = (i > 0) ? mCompactIndex.get(i - 1, j) : -1;
+          const int kPlus = (i < mGridWidth) ? mCompactIndex.get(i, j) : -1;
 
-        w = wx * (1.0f - wy);
-        v(i + 1, j) += mParticles.velocities[p].y * w;
-        mWeightSum[ix(i + 1, j)] += w;
+          if ((kMinus < 0) && (kPlus < 0))
+          {
+            continue;
+          }
 
-        w = (1.0f - wx) * wy;
-        v(i, j + 1) += mParticles.velocities[p].y * w;
-        mWeightSum[ix(i, j + 1)] += w;
+          float& face = mVelX.at(i, j);
 
-        w = wx * wy;
-        v(i + 1, j + 1) += mParticles.velocities[p].y * w;
-        mWeightSum[ix(i + 1, j + 1)] += w;
-      }
+          if (kMinus >= 0)
+          {
+            face -= static_cast<float>(mP[kMinus]);
+          }
+          if (kPlus >= 0)
+          {
+            face += static_cast<float>(mP[kPlus]);
+          }
+        }
+      });
 
-      for (int j = 0; j < mGridHeight + 1; j++)
-      for (int i = 0; i < mGridWidth; i++)
+      forEachActiveTile(mGridWidth, mGridHeight + 1, kSolverStagePressure, [this](int i0, int i1, int j0, int j1)
       {
-        const int ix_ = ix(i, j);
-
-        if (mWeightSum[ix_] != 0)
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
         {
-          v(i, j) /= mWeightSum[ix_];
+          const int kMinus = (j > 0) ? mCompactIndex.get(i, j - 1) : -1;
+          const int kPlus = (j < mGridHeight) ? mCompactIndex.get(i, j) : -1;
+
+          if ((kMinus < 0) && (kPlus < 0))
+          {
+            continue;
+          }
+
+          float& face = mVelY.at(i, j);
+
+          if (kMinus >= 0)
+          {
+            face -= static_cast<float>(mP[kMinus]);
+          }
+          if (kPlus >= 0)
+          {
+            face += static_cast<float>(mP[kPlus]);
+          }
         }
-      }
+      });
+
+      // Counted in the pressure stage, timing it as a grid update too would count it twice
+
+      applyBoundary();
+    }
+
+    void FLIPSolver2D::buildFluidCellList()
+    {
+      // Fluid cells are numbered tile by tile, and in lexicographic order inside each tile. That keeps the
+      // (i - 1, j) and (i, j - 1) neighbours of every cell before it, as MIC(0) requires, and makes every tile a
+      // contiguous range of the list for the wavefront schedule. Fluid cells only lie in active tiles, so the cells
+      // of the rest are not looked at. The other cells of active tiles get -1 as compact index.
+
+      const int numTiles = mTilesX * mTilesY;
+      const int numActiveCells = static_cast<int>(mActiveTiles.size()) * kTileSize * kTileSize;
+      const int gridThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, numActiveCells);
 
-      // Mark fluid particles
+      mTileFluidStart.resize(numTiles + 1);
+      mTileFluidStart[0] = 0;
 
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth; i++)
+      #pragma omp parallel for num_threads(gridThreads) if (gridThreads > 1)
+      for (int t = 0; t < numTiles; t++)
       {
-        const int ix_ = ix(i, j);
+        const int i0 = (t % mTilesX) * kTileSize;
+        const int j0 = (t / mTilesX) * kTileSize;
+        const int i1 = std::min(i0 + kTileSize, mGridWidth);
+        const int j1 = std::min(j0 + kTileSize, mGridHeight);
+
+        int count = 0;
+
+        if (!mActiveTileMask[t])
+        {
+          mTileFluidStart[t + 1] = count;
+          continue;
+        }
 
-        if (mCellType[ix_] != kCellTypeSolid)
+        const CellType* types = mCellType.getTileData(t);
+
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
         {
-          mCellType[ix_] = kCellTypeAir;
+          if (types[(i - i0) + (j - j0) * kTileSize] == kCellTypeFluid)
+          {
+            ++count;
+          }
         }
+
+        mTileFluidStart[t + 1] = count;
       }
 
-      for (int p = 0; p < mParticles.numParticles; p++)
+      for (int t = 0; t < numTiles; t++)
       {
-        float wx, wy;
+        mTileFluidStart[t + 1] += mTileFluidStart[t];
+      }
+
+      const int numFluidCells = mTileFluidStart[numTiles];
+
+      mNumFluidCells = numFluidCells;
+      mFluidCells.resize(numFluidCells);
+
+      #pragma omp parallel for num_threads(gridThreads) if (gridThreads > 1)
+      for (int t = 0; t < numTiles; t++)
+      {
+        const int i0 = (t % mTilesX) * kTileSize;
+        const int j0 = (t / mTilesX) * kTileSize;
+        const int i1 = std::min(i0 + kTileSize, mGridWidth);
+        const int j1 = std::min(j0 + kTileSize, mGridHeight);
 
-        const int i = uIndex_x(mParticles.positions[p].x, wx);
-        const int j = vIndex_y(mParticles.positions[p].y, wy);
+        if (!mActiveTileMask[t])
+        {
+          continue;
+        }
 
-        const int ix_ = ix(i, j);
+        const CellType* types = mCellType.getTileData(t);
+        int* compactIndex = mCompactIndex.getTileData(t);
+        int k = mTileFluidStart[t];
 
-        if (mCellType[ix_] != kCellTypeSolid)
+        for (int j = j0; j < j1; j++)
+        for (int i = i0; i < i1; i++)
         {
-          mCellType[ix_] = kCellTypeFluid;
+          const int c = (i - i0) + (j - j0) * kTileSize;
+
+          if (types[c] == kCellTypeFluid)
+          {
+            mFluidCells[k] = ix(i, j);
+            compactIndex[c] = k;
+            ++k;
+          }
+          else
+          {
+            compactIndex[c] = -1;
+          }
         }
       }
 
-      fillHoles();
-    }
+      // All vectors get an extra trailing slot, always 0, that absent neighbours point to. The system is always
+      // assembled in double, the PCG work vectors are resized when solving, only for the precision in use.
 
-    void FLIPSolver2D::gridToParticles()
-    {
-      for (int p = 0; p < mParticles.numParticles; p++)
-      {
-        const float i_p = mParticles.positions[p].x * mOverDx;
-        const float j_p = mParticles.positions[p].y * mOverDx;
+      const std::size_t compactSize = numFluidCells + 1;
 
-        // PIC
+      math::AlignedVector<double>* vectors[] = { &mP, &mRhs, &mResidual, &mPcgDouble.coefDiag,
+                                                 &mPcgDouble.coefPlusI, &mPcgDouble.coefPlusJ };
 
-        const float u_pic = uVel(i_p, j_p);
-        const float v_pic = vVel(i_p, j_p);
+      for (math::AlignedVector<double>* vector : vectors)
+      {
+        vector->resize(compactSize);
+        (*vector)[numFluidCells] = 0.0;
+      }
 
-        // FLIP
+      mNeighbourMinusI.resize(compactSize);
+      mNeighbourPlusI.resize(compactSize);
+      mNeighbourMinusJ.resize(compactSize);
+      mNeighbourPlusJ.resize(compactSize);
 
-        swapVel();
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, numFluidCells);
 
-        const float u_flip = mParticles.velocities[p].x + uVel(i_p, j_p);
-        const float v_flip = mParticles.velocities[p].y + vVel(i_p, j_p);
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int k = 0; k < numFluidCells; k++)
+      {
+        const int ix_ = mFluidCells[k];
+        const int i = ix_ % mGridWidth;
+        const int j = ix_ / mGridWidth;
+
+        const bool fluidMinusI = (i > 0) && (mCellType.get(i - 1, j) == kCellTypeFluid);
+        const bool fluidPlusI = (i < (mGridWidth - 1)) && (mCellType.get(i + 1, j) == kCellTypeFluid);
+        const bool fluidMinusJ = (j > 0) && (mCellType.get(i, j - 1) == kCellTypeFluid);
+        const bool fluidPlusJ = (j < (mGridHeight - 1)) && (mCellType.get(i, j + 1) == kCellTypeFluid);
+
+        mNeighbourMinusI[k] = fluidMinusI ? mCompactIndex.get(i - 1, j) : numFluidCells;
+        mNeighbourPlusI[k] = fluidPlusI ? mCompactIndex.get(i + 1, j) : numFluidCells;
+        mNeighbourMinusJ[k] = fluidMinusJ ? mCompactIndex.get(i, j - 1) : numFluidCells;
+        mNeighbourPlusJ[k] = fluidPlusJ ? mCompactIndex.get(i, j + 1) : numFluidCells;
+      }
+    }
 
-        swapVel();
+    template <typename T>
+    FLIPSolver2D::PcgSystem<T>::PcgSystem()
+    : kernels(&getPcgKernels<T>(detectSimdLevel())),
+      p(),
+      r(),
+      s(),
+      z(),
+      aux(),
+      precond(),
+      coefDiag(),
+      coefPlusI(),
+      coefPlusJ(),
+      blockSums()
+    {
+    }
 
-        // Lerp between both to control numerical viscosity
+    template <typename T>
+    void FLIPSolver2D::PcgSystem<T>::resize(std::size_t size)
+    {
+      math::AlignedVector<T>* vectors[] = { &p, &r, &s, &z, &aux, &precond, &coefDiag, &coefPlusI, &coefPlusJ };
 
-        mParticles.velocities[p].x = mPicFlipFactor * u_pic + (1.0f - mPicFlipFactor) * u_flip;
-        mParticles.velocities[p].y = mPicFlipFactor * v_pic + (1.0f - mPicFlipFactor) * v_flip;
+      for (math::AlignedVector<T>* vector : vectors)
+      {
+        vector->resize(size);
+        vector->back() = 0;
       }
 
-      fillHoles();
+      blockSums.resize((size + kKernelBlockSize - 1) / kKernelBlockSize);
     }
 
-    void FLIPSolver2D::fillHoles()
+    void FLIPSolver2D::solvePressure()
     {
-      #pragma omp for
-      for (int i = 0; i < mGridSize; ++i)
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const bool warmStart = mPressureWarmStart;
+      const bool countColdStart = warmStart && mPressureWarmStartReference;
+      const int numFluidCells = mNumFluidCells;
+
+      mPcgIterations = 0;
+      mPcgIterationsSaved = 0;
+      mPcgResidual = 0.0;
+
+      double r_max = 0.0;
+
+      #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
       {
-        mCellTypeAux[i] = kCellTypeAir;
+        double localMax = 0.0;
 
-        if (mCellType[i] == kCellTypeAir)
+        #pragma omp for
+        for (int i = 0; i < numFluidCells; i++)
         {
-          const int column = (i % mGridWidth);
-          const int row = (i / mGridWidth);
-          int adjacentNonAirCells = 0;
-
-          if ((column == 0) || (mCellType[i - 1] != kCellTypeAir))
-          {
-            ++adjacentNonAirCells;
-          }
-          if ((column == (mGridWidth - 1)) || (mCellType[i + 1] != kCellTypeAir))
-          {
-            ++adjacentNonAirCells;
-          }
-          if ((row == 0) || (mCellType[i - mGridWidth] != kCellTypeAir))
-          {
-            ++adjacentNonAirCells;
-          }
-          if ((row == (mGridHeight - 1)) || (mCellType[i + mGridWidth] != kCellTypeAir))
-          {
-            ++adjacentNonAirCells;
-          }
-          if (adjacentNonAirCells >= 3)
+          if (!warmStart)
           {
-            mCellTypeAux[i] = kCellTypeFluid;
+            mP[i] = 0.0;
           }
+
+          localMax = std::max(localMax, std::fabs(mRhs[i]));
         }
+
+        #pragma omp critical
+        r_max = std::max(r_max, localMax);
       }
 
-      #pragma omp for
-      for (int i = 0; i < mGridSize; ++i)
+      if (r_max == 0.0)
       {
-        if (mCellTypeAux[i] == kCellTypeFluid)
-        {
-          mCellType[i] = kCellTypeFluid;
-        }
+        std::fill(mP.begin(), mP.end(), 0.0);
+        return;
       }
-    }
 
-    void FLIPSolver2D::storeVel()
-    {
-      mDeltaVelX.assign(mVelX.begin(), mVelX.end());
-      mDeltaVelY.assign(mVelY.begin(), mVelY.end());
-    }
+      const double tolerance = kPcgTolerance * r_max;
 
-    void FLIPSolver2D::subtractVel()
-    {
-      const int numVelsX = static_cast<int>(mVelX.size());
-      const int numVelsY = static_cast<int>(mVelY.size());
+      // PCG always solves for a correction of the current pressure. When warm starting, the residual of the initial
+      // guess is computed in double, otherwise the guess is 0 and the residual is the right hand side itself.
 
-      #pragma omp for
-      for (int i = 0; i < numVelsX; i++)
+      const double initialError = warmStart ? computeResidual() : r_max;
+
+      if ((initialError > tolerance) || countColdStart)
       {
-        mDeltaVelX[i] = mVelX[i] - mDeltaVelX[i];
+        setupPcgSystem();
       }
 
-      #pragma omp for
-      for (int i = 0; i < numVelsY; i++)
+      const double error = solvePressureCorrection(warmStart ? mResidual : mRhs, initialError, tolerance);
+
+      mPcgResidual = error / r_max;
+
+      if (countColdStart)
       {
-        mDeltaVelY[i] = mVelY[i] - mDeltaVelY[i];
+        mPcgIterationsSaved = countColdStartIterations(r_max, tolerance) - mPcgIterations;
       }
     }
 
-    float FLIPSolver2D::computePhi(float a, float b, float current)
+    void FLIPSolver2D::setupPcgSystem()
     {
-      const float dif = a - b;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const int numFluidCells = mNumFluidCells;
+
+      if (mPressurePrecision == kPressurePrecisionDouble)
+      {
+        mPcgDouble.resize(numFluidCells + 1);
+        calcPrecond(mPcgDouble);
+        return;
+      }
+
+      // Float storage halves the memory traffic of the solver. The coefficients are small integers, so they are
+      // converted exactly.
 
-      if (std::fabs(dif) >= mDx)
+      mPcgFloat.resize(numFluidCells + 1);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int i = 0; i < numFluidCells; i++)
       {
-        return std::min(a, b) + mDx;
+        mPcgFloat.coefDiag[i] = static_cast<float>(mPcgDouble.coefDiag[i]);
+        mPcgFloat.coefPlusI[i] = static_cast<float>(mPcgDouble.coefPlusI[i]);
+        mPcgFloat.coefPlusJ[i] = static_cast<float>(mPcgDouble.coefPlusJ[i]);
       }
 
-      return std::min(current, (a + b + sqrt(2 * mDx * mDx - dif * dif)) / 2.0f);
+      calcPrecond(mPcgFloat);
     }
 
-    void FLIPSolver2D::computeGridPhi()
+    double FLIPSolver2D::solvePressureCorrection(const math::AlignedVector<double>& residual, double error,
+                                                 double tolerance)
     {
-      // Initialize distance function
+      // Adds to mP the solution of A p = residual, given the max norm of the residual, and returns the max norm
+      // of what is left of it
 
-      const float max_dim = static_cast<float>(mGridWidth + mGridHeight + 2);
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const int numFluidCells = mNumFluidCells;
 
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth; i++)
+      if ((error > tolerance) && (mPressurePrecision == kPressurePrecisionDouble))
       {
-        const int ix_ = ix(i, j);
-
-        if (mCellType[ix_] == kCellTypeFluid)
+        #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+        for (int i = 0; i < numFluidCells; i++)
         {
-          mPhi[ix_] = -0.5f;
+          mPcgDouble.r[i] = residual[i];
         }
-        else
+
+        error = solvePcg(mPcgDouble, tolerance);
+
+        #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+        for (int i = 0; i < numFluidCells; i++)
         {
-          mPhi[ix_] = max_dim;
+          mP[i] += mPcgDouble.p[i];
         }
       }
-
-      for (int r = 0; r < 2; r++)
+      else if (error > tolerance)
       {
-        // Sweep in all directions
-
-        for (int j = 1; j < mGridHeight; j++)
-        for (int i = 1; i < mGridWidth; i++)
-        {
-          const int ix_ = ix(i, j);
+        // The residual of the double system is computed after each float solve. With iterative refinement the
+        // float solver is run again on that residual until it is small enough.
 
-          if (mCellType[ix_] != kCellTypeFluid)
-          {
-            mPhi[ix_] = computePhi(mPhi[ix(i - 1, j)], mPhi[ix(i, j - 1)], mPhi[ix_]);
-          }
-        }
+        const int numSteps = (mPressurePrecision == kPressurePrecisionFloatRefined) ? kMaxRefinementSteps : 1;
 
-        for (int j = mGridHeight - 2; j >= 0; j--)
-        for (int i = 1; i < mGridWidth; i++)
+        for (int step = 0; (step < numSteps) && (error > tolerance); step++)
         {
-          const int ix_ = ix(i, j);
+          const math::AlignedVector<double>& source = (step == 0) ? residual : mResidual;
 
-          if (mCellType[ix_] != kCellTypeFluid)
+          #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+          for (int i = 0; i < numFluidCells; i++)
           {
-            mPhi[ix_] = computePhi(mPhi[ix(i - 1, j)], mPhi[ix(i, j + 1)], mPhi[ix_]);
+            mPcgFloat.r[i] = static_cast<float>(source[i]);
           }
-        }
 
-        for (int j = 1; j < mGridHeight; j++)
-        for (int i = mGridWidth - 2; i >= 0; i--)
-        {
-          const int ix_ = ix(i, j);
+          solvePcg(mPcgFloat, tolerance);
 
-          if (mCellType[ix_] != kCellTypeFluid)
+          #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+          for (int i = 0; i < numFluidCells; i++)
           {
-            mPhi[ix_] = computePhi(mPhi[ix(i + 1, j)], mPhi[ix(i, j - 1)], mPhi[ix_]);
+            mP[i] += mPcgFloat.p[i];
           }
-        }
-
-        for (int j = mGridHeight - 2; j >= 0; j--)
-        for (int i = mGridWidth - 2; i >= 0; i--)
-        {
-          const int ix_ = ix(i, j);
 
-          if (mCellType[ix_] != kCellTypeFluid)
-          {
-            mPhi[ix_] = computePhi(mPhi[ix(i + 1, j)], mPhi[ix(i, j + 1)], mPhi[ix_]);
-          }
+          error = computeResidual();
         }
       }
+
+      return error;
     }
 
-    void FLIPSolver2D::sweepU(int i0, int i1, int j0, int j1)
+    int FLIPSolver2D::countColdStartIterations(double r_max, double tolerance)
     {
-      const int di = (i0 < i1) ? 1 : -1;
-      const int dj = (j0 < j1) ? 1 : -1;
+      // Solves the same system again from 0, taking the same path as the warm started solve, and discards the
+      // result. Doubles the cost of the pressure solve, so it only runs when asked for.
 
-      float dp, dq, alpha;
+      const int warmStartIterations = mPcgIterations;
 
-      for (int j = j0; j != j1; j += dj)
-      for (int i = i0; i != i1; i += di)
-      {
-        if ((mCellType[ix(i - 1, j)] == kCellTypeAir) && (mCellType[ix(i, j)] == kCellTypeAir))
-        {
-          dp = di * (mPhi[ix(i, j)] - mPhi[ix(i - 1, j)]);
+      mColdStartPressure.assign(mP.size(), 0.0);
+      mP.swap(mColdStartPressure);
 
-          if (dp < 0)
-          {
-            continue;
-          }
+      solvePressureCorrection(mRhs, r_max, tolerance);
 
-          dq = 0.5f * (mPhi[ix(i - 1, j)] + mPhi[ix(i, j)] - mPhi[ix(i - 1, j - dj)] - mPhi[ix(i, j - dj)]);
+      mP.swap(mColdStartPressure);
 
-          if (dq < 0)
-          {
-            continue;
-          }
+      const int coldStartIterations = mPcgIterations - warmStartIterations;
 
-          if ((dp + dq) < kEpsilon)
-          {
-            alpha = 0.5f;
-          }
-          else
-          {
-            alpha = dp / (dp + dq);
-          }
+      mPcgIterations = warmStartIterations;
 
-          u(i, j) = alpha * u(i - di, j) + (1.0f - alpha) * u(i, j - dj);
-        }
-      }
+      return coldStartIterations;
     }
 
-    void FLIPSolver2D::sweepV(int i0, int i1, int j0, int j1)
+    void FLIPSolver2D::loadPressureGuess(float dt)
     {
-      const int di = (i0 < i1) ? 1 : -1;
-      const int dj = (j0 < j1) ? 1 : -1;
+      // With the same density the pressure scales linearly with the time step
 
-      float dp, dq, alpha;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const double scale = (mLastPressureDt > 0.0f) ? (static_cast<double>(dt) / mLastPressureDt) : 0.0;
 
-      for (int j = j0; j != j1; j += dj)
-      for (int i = i0; i != i1; i += di)
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int k = 0; k < mNumFluidCells; k++)
       {
-        if ((mCellType[ix(i, j - 1)] == kCellTypeAir) && (mCellType[ix(i, j)] == kCellTypeAir))
-        {
-          dq = dj * (mPhi[ix(i, j)] - mPhi[ix(i, j - 1)]);
+        const int ix_ = mFluidCells[k];
 
-          if (dq < 0)
-          {
-            continue;
-          }
+        mP[k] = scale * mLastPressure.get(ix_ % mGridWidth, ix_ / mGridWidth);
+      }
+    }
 
-          dp = 0.5f * (mPhi[ix(i, j - 1)] + mPhi[ix(i, j)] - mPhi[ix(i - di, j - 1)] - mPhi[ix(i - di, j)]);
+    void FLIPSolver2D::storePressureGuess(float dt)
+    {
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
 
-          if (dp < 0)
-          {
-            continue;
-          }
+      // Only the tiles holding fluid are kept. They are allocated first, as allocation is not thread safe.
 
-          if (std::fabs(dp + dq) < kEpsilon)
-          {
-            alpha = 0.5f;
-          }
-          else
-          {
-            alpha = dp / (dp + dq);
-          }
+      mLastPressure.clear();
 
-          v(i, j) = alpha * v(i - di, j) + (1.0f - alpha) * v(i, j - dj);
-        }
+      for (int k = 0; k < mNumFluidCells; k++)
+      {
+        const int ix_ = mFluidCells[k];
+
+        mLastPressure.allocateTile(mLastPressure.getTile(ix_ % mGridWidth, ix_ / mGridWidth));
+      }
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int k = 0; k < mNumFluidCells; k++)
+      {
+        const int ix_ = mFluidCells[k];
+
+        mLastPressure.at(ix_ % mGridWidth, ix_ / mGridWidth) = mP[k];
       }
+
+      mLastPressureDt = dt;
     }
 
-    void FLIPSolver2D::extrapolateVel()
+    double FLIPSolver2D::computeResidual()
     {
-      for (int r = 0; r < 4; r++)
-      {
-        sweepU(1, mGridWidth, 1, mGridHeight - 1);
-        sweepU(1, mGridWidth, mGridHeight - 2, 0);
-        sweepU(mGridWidth - 1, 0, 1, mGridHeight - 1);
-        sweepU(mGridWidth - 1, 0, mGridHeight - 2, 0);
+      // residual = rhs - A p, in double, returning its max norm
 
-        #pragma omp for
-        for (int i = 0; i < mGridWidth + 1; i++)
-        {
-          u(i, 0) = u(i, 1);
-          u(i, mGridHeight - 1) = u(i, mGridHeight - 2);
-        }
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const int numFluidCells = mNumFluidCells;
 
-        #pragma omp for
-        for (int j = 0; j < mGridHeight; j++)
-        {
-          u(0, j) = u(1, j);
-          u(mGridWidth, j) = u(mGridWidth - 1, j);
-        }
+      const double* coefDiag = mPcgDouble.coefDiag.data();
+      const double* coefPlusI = mPcgDouble.coefPlusI.data();
+      const double* coefPlusJ = mPcgDouble.coefPlusJ.data();
 
-        sweepV(1, mGridWidth - 1, 1, mGridHeight);
-        sweepV(1, mGridWidth - 1, mGridHeight - 1, 0);
-        sweepV(mGridWidth - 2, 0, 1, mGridHeight);
-        sweepV(mGridWidth - 2, 0, mGridHeight - 1, 0);
+      double error = 0.0;
 
-        #pragma omp for
-        for (int i = 0; i < mGridWidth; i++)
-        {
-          v(i, 0) = v(i, 1);
-          v(i, mGridHeight) = v(i, mGridHeight - 1);
-        }
+      #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
+      {
+        double localError = 0.0;
 
         #pragma omp for
-        for (int j = 0; j < mGridHeight + 1; j++)
+        for (int k = 0; k < numFluidCells; k++)
         {
-          v(0, j) = v(1, j);
-          v(mGridWidth - 1, j) = v(mGridWidth - 2, j);
+          const int k_minus_i = mNeighbourMinusI[k];
+          const int k_minus_j = mNeighbourMinusJ[k];
+
+          const double t = coefDiag[k] * mP[k] +
+                           coefPlusI[k_minus_i] * mP[k_minus_i] +
+                           coefPlusJ[k_minus_j] * mP[k_minus_j] +
+                           coefPlusI[k] * mP[mNeighbourPlusI[k]] +
+                           coefPlusJ[k] * mP[mNeighbourPlusJ[k]];
+
+          mResidual[k] = mRhs[k] - t;
+          localError = std::max(localError, std::fabs(mResidual[k]));
         }
+
+        #pragma omp critical
+        error = std::max(error, localError);
       }
+
+      return error;
     }
 
-    void FLIPSolver2D::project(float dt)
+    template <typename T>
+    double FLIPSolver2D::solvePcg(PcgSystem<T>& system, double tolerance)
     {
-      // Set the right hand side of the equation system
+      // Solves A p = r with the preconditioner already computed, returning the max norm of the final residual
 
-      mRhs.clear();
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const int numFluidCells = mNumFluidCells;
 
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth; i++)
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int i = 0; i < numFluidCells; i++)
       {
-        const int ix_ = i + j * mGridWidth;
+        system.p[i] = 0;
+      }
 
-        if (mCellType[ix_] == kCellTypeFluid)
-        {
-          mRhs[ix_] = (u(i + 1, j) - u(i, j) + v(i, j + 1) - v(i, j));
+      applyPrecond(system);
 
-          if ((i > 0) && (mCellType[ix(i - 1, j)] == kCellTypeSolid))
-          {
-            mRhs[ix_] -= (mBoundaryVelocity.x - u(i, j));
-          }
-          if ((i < (mGridWidth - 1)) && (mCellType[ix(i + 1, j)] == kCellTypeSolid))
-          {
-            mRhs[ix_] -= (u(i + 1, j) - mBoundaryVelocity.x);
-          }
-          if ((j > 0) && (mCellType[ix(i, j - 1)] == kCellTypeSolid))
-          {
-            mRhs[ix_] -= (mBoundaryVelocity.y - v(i, j));
-          }
-          if ((j < (mGridHeight - 1)) && (mCellType[ix(i, j + 1)] == kCellTypeSolid))
-          {
-            mRhs[ix_] -= (v(i, j + 1) - mBoundaryVelocity.y);
-          }
-        }
-      }
+      system.s = system.z;
 
-      // Set the coefficients
+      double sigma = dotProduct(system, system.z, system.r);
+      double error = 0.0;
 
-      mCoefDiag.clear();
-      mCoefPlusI.clear();
-      mCoefPlusJ.clear();
+      if (sigma == 0.0)
+      {
+        return error;
+      }
 
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth; i++)
+      for (int i = 0; i < kPcgMaxIterations; i++)
       {
-        if (mCellType[ix(i, j)] == kCellTypeFluid)
-        {
-          if (mCellType[ix(i + 1, j)] != kCellTypeSolid)
-          {
-            mCoefDiag[ix(i, j)] += 1.0f;
+        ++mPcgIterations;
 
-            if (mCellType[ix(i + 1, j)] == kCellTypeFluid)
-            {
-              mCoefPlusI[ix(i, j)] = -1.0f;
-            }
-          }
+        const double alpha = sigma / applyA(system);
+        error = updatePressureAndResidual(system, alpha);
 
-          if (mCellType[ix(i - 1, j)] != kCellTypeSolid)
-          {
-            mCoefDiag[ix(i, j)] += 1.0f;
-          }
+        if (error <= tolerance)
+        {
+          break;
+        }
 
-          if (mCellType[ix(i, j + 1)] != kCellTypeSolid)
-          {
-            mCoefDiag[ix(i, j)] += 1.0f;
+        applyPrecond(system);
 
-            if (mCellType[ix(i, j + 1)] == kCellTypeFluid)
-            {
-              mCoefPlusJ[ix(i, j)] = -1.0f;
-            }
-          }
+        const double sigma_new = dotProduct(system, system.z, system.r);
+        const double beta = sigma_new / sigma;
 
-          if (mCellType[ix(i, j - 1)] != kCellTypeSolid)
-          {
-            mCoefDiag[ix(i, j)] += 1.0f;
-          }
-        }
+        updateSearchVector(system, beta);
+
+        sigma = sigma_new;
       }
 
-      // Solve for pressure with PCG algorithm
+      return error;
+    }
 
-      solvePressure();
+    template <typename T>
+    double FLIPSolver2D::dotProduct(PcgSystem<T>& system, const math::AlignedVector<T>& a,
+                                    const math::AlignedVector<T>& b)
+    {
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const int numBlocks = (mNumFluidCells + kKernelBlockSize - 1) / kKernelBlockSize;
 
-      // Apply pressure to update velocity
+      double* const blockSums = system.blockSums.data();
 
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth; i++)
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int block = 0; block < numBlocks; block++)
       {
-        const int ix_ = i + j * mGridWidth;
-
-        if (mCellType[ix_] == kCellTypeFluid)
-        {
-          float pressure = static_cast<float>(mP[ix_]);
+        const int begin = block * kKernelBlockSize;
+        const int size = std::min(kKernelBlockSize, mNumFluidCells - begin);
 
-          u(i, j) += pressure;
-          u(i + 1, j) -= pressure;
-          v(i, j) += pressure;
-          v(i, j + 1) -= pressure;
-        }
+        blockSums[block] = system.kernels->dot(a.data() + begin, b.data() + begin, size);
       }
 
-      setBoundary();
+      return sumBlocks(blockSums, numBlocks);
     }
 
-    void FLIPSolver2D::solvePressure()
+    template <typename T>
+    double FLIPSolver2D::updatePressureAndResidual(PcgSystem<T>& system, double alpha)
     {
-      mP.clear();
+      // p += alpha * s and r -= alpha * z, returning the max norm of the updated residual
 
-      double r_max = 0.0;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const int numBlocks = (mNumFluidCells + kKernelBlockSize - 1) / kKernelBlockSize;
 
-      for (unsigned int i = 0; i < mRhs.size(); i++)
-      {
-        if (std::fabs(mRhs[i]) > r_max)
-        {
-          r_max = std::fabs(mRhs[i]);
-        }
-      }
+      double error = 0.0;
 
-      if (r_max == 0.0)
+      #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
       {
-        return;
-      }
+        double localError = 0.0;
+
+        #pragma omp for
+        for (int block = 0; block < numBlocks; block++)
+        {
+          const int begin = block * kKernelBlockSize;
+          const int size = std::min(kKernelBlockSize, mNumFluidCells - begin);
 
-      mR = mRhs;
+          const double blockError = system.kernels->axpyMaxNorm(alpha, system.s.data() + begin, system.z.data() + begin,
+                                                                system.p.data() + begin, system.r.data() + begin, size);
 
-      const double tolerance = kPcgTolerance * r_max;
+          localError = std::max(localError, blockError);
+        }
 
-      calcPrecond();
-      applyPrecond();
+        #pragma omp critical
+        error = std::max(error, localError);
+      }
 
-      mS = mZ;
+      return error;
+    }
 
-      double sigma = inner_prod(mZ, mR);
+    template <typename T>
+    void FLIPSolver2D::updateSearchVector(PcgSystem<T>& system, double beta)
+    {
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const int numBlocks = (mNumFluidCells + kKernelBlockSize - 1) / kKernelBlockSize;
 
-      if (sigma == 0.0)
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int block = 0; block < numBlocks; block++)
       {
-        return;
+        const int begin = block * kKernelBlockSize;
+        const int size = std::min(kKernelBlockSize, mNumFluidCells - begin);
+
+        system.kernels->xpby(system.z.data() + begin, beta, system.s.data() + begin, size);
       }
+    }
 
-      for (int i = 0; i < kPcgMaxIterations; i++)
+    template <typename T>
+    void FLIPSolver2D::calcPrecond(PcgSystem<T>& system)
+    {
+      if (mPressurePreconditioner == kPreconditionerMultigrid)
       {
-        applyA();
+        if (!mMultigrid)
+        {
+          mMultigrid.reset(new MultigridPreconditioner2D(mGridWidth, mGridHeight));
+        }
 
-        const double alpha = sigma / inner_prod(mZ, mS);
+        mMultigrid->setExecutionPolicy(mExecutionPolicy);
+        mMultigrid->build(mCellType, mFluidCells.data(), mNumFluidCells, mPcgDouble.coefDiag.data(),
+                          mPcgDouble.coefPlusI.data(), mPcgDouble.coefPlusJ.data());
 
-        mP += (alpha * mS);
-        mR -= (alpha * mZ);
+        return;
+      }
 
-        double error = 0.0f;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
 
-        for (int j = 0; j < mGridWidth * mGridHeight; j++)
+      if (numThreads == 1)
+      {
+        for (int k = 0; k < mNumFluidCells; k++)
         {
-          const double abs_r = std::fabs(mR[j]);
-          error = std::max(abs_r, error);
+          calcPrecondCell(system, k);
         }
 
-        if (error <= tolerance)
-        {
-          break;
-        }
+        return;
+      }
 
-        applyPrecond();
+      // MIC(0) only couples each cell with its (i - 1, j) and (i, j - 1) neighbours, so the tiles lying on the
+      // same anti-diagonal of the tile grid are independent and can be factorised concurrently. Inside a tile
+      // the cells are still visited in lexicographic order, so the result is identical to the serial sweep.
 
-        const double sigma_new = inner_prod(mZ, mR);
-        const double beta = sigma_new / sigma;
+      const int tilesX = mTilesX;
+      const int tilesY = mTilesY;
+      const int numDiagonals = tilesX + tilesY - 1;
 
-        mS = mZ + beta * mS;
+      #pragma omp parallel num_threads(numThreads)
+      {
+        for (int d = 0; d < numDiagonals; d++)
+        {
+          const int tj0 = std::max(0, d - tilesX + 1);
+          const int tj1 = std::min(d, tilesY - 1);
 
-        sigma = sigma_new;
+          #pragma omp for schedule(dynamic, 1)
+          for (int tj = tj0; tj <= tj1; tj++)
+          {
+            const int t = (d - tj) + tj * tilesX;
+
+            for (int k = mTileFluidStart[t]; k < mTileFluidStart[t + 1]; k++)
+            {
+              calcPrecondCell(system, k);
+            }
+          }
+        }
       }
     }
 
-    void FLIPSolver2D::calcPrecond()
+    template <typename T>
+    void FLIPSolver2D::calcPrecondCell(PcgSystem<T>& system, int k)
     {
+      // Neighbours that are not fluid point to the trailing zero slot, so they do not contribute
+
       const double tuning_const = 0.99;
       const double safety_const = 0.25;
 
-      mPrecond.clear();
-
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth; i++)
-      {
-        int ix = i + j * mGridWidth;
+      const int k_minus_i = mNeighbourMinusI[k];
+      const int k_minus_j = mNeighbourMinusJ[k];
 
-        if (mCellType[ix] == kCellTypeFluid)
-        {
-          int ix_plus_i = (i - 1) + j * mGridWidth;
-          int ix_plus_j = i + (j - 1) * mGridWidth;
+      const T* coefPlusI = system.coefPlusI.data();
+      const T* coefPlusJ = system.coefPlusJ.data();
+      const T* precond = system.precond.data();
 
-          mPrecond[ix] = mCoefDiag[ix];
+      double e = system.coefDiag[k];
 
-          if (i > 0)
-          {
-            double plus_i = mCoefPlusI[ix_plus_i] * mPrecond[ix_plus_i];
-            mPrecond[ix] += (-plus_i * plus_i - tuning_const *
-              (mCoefPlusI[ix_plus_i] * mCoefPlusJ[ix_plus_i] * mPrecond[ix_plus_i] * mPrecond[ix_plus_i]));
-          }
-          if (j > 0)
-          {
-            double plus_j = mCoefPlusJ[ix_plus_j] * mPrecond[ix_plus_j];
-            mPrecond[ix] += (-plus_j * plus_j - tuning_const *
-              (mCoefPlusJ[ix_plus_j] * mCoefPlusI[ix_plus_j] * mPrecond[ix_plus_j] * mPrecond[ix_plus_j]));
-          }
+      double plus_i = coefPlusI[k_minus_i] * precond[k_minus_i];
+      e += (-plus_i * plus_i - tuning_const *
+        (coefPlusI[k_minus_i] * coefPlusJ[k_minus_i] * precond[k_minus_i] * precond[k_minus_i]));
 
-          if (mPrecond[ix] < safety_const * mCoefDiag[ix])
-          {
-            mPrecond[ix] = mCoefDiag[ix];
-          }
+      double plus_j = coefPlusJ[k_minus_j] * precond[k_minus_j];
+      e += (-plus_j * plus_j - tuning_const *
+        (coefPlusJ[k_minus_j] * coefPlusI[k_minus_j] * precond[k_minus_j] * precond[k_minus_j]));
 
-          mPrecond[ix] = 1.0 / sqrt(mPrecond[ix] + kPcgEpsilon);
-        }
+      if (e < safety_const * system.coefDiag[k])
+      {
+        e = system.coefDiag[k];
       }
+
+      system.precond[k] = static_cast<T>(1.0 / std::sqrt(e + kPcgEpsilon));
     }
 
-    void FLIPSolver2D::applyPrecond()
+    template <typename T>
+    void FLIPSolver2D::applyPrecond(PcgSystem<T>& system)
     {
-      mAux.clear();
-
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth; i++)
+      if (mPressurePreconditioner == kPreconditionerMultigrid)
       {
-        int ix = i + j * mGridWidth;
-
-        if (mCellType[ix] == kCellTypeFluid)
-        {
-          const int ix_plus_i = (i - 1) + j * mGridWidth;
-          const int ix_plus_j = i + (j - 1) * mGridWidth;
+        mMultigrid->apply(mFluidCells.data(), mNumFluidCells, system.r.data(), system.z.data());
+        return;
+      }
 
-          double t = mR[ix];
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
 
-          if (i > 0)
-          {
-            t -= (mCoefPlusI[ix_plus_i] * mPrecond[ix_plus_i] * mAux[ix_plus_i]);
-          }
-          if (j > 0)
-          {
-            t -= (mCoefPlusJ[ix_plus_j] * mPrecond[ix_plus_j] * mAux[ix_plus_j]);
-          }
+      if (numThreads == 1)
+      {
+        for (int k = 0; k < mNumFluidCells; k++)
+        {
+          applyPrecondLowerCell(system, k);
+        }
 
-          mAux[ix] = t * mPrecond[ix];
+        for (int k = mNumFluidCells - 1; k >= 0; k--)
+        {
+          applyPrecondUpperCell(system, k);
         }
+
+        return;
       }
 
-      mZ.clear();
+      // Same wavefront schedule as in calcPrecond, run forwards for the lower triangular solve and backwards
+      // (tiles and cells in reverse order) for the upper triangular one.
 
-      for (int j = mGridHeight; j >= 0; --j)
-      for (int i = mGridWidth; i >= 0; --i)
-      {
-        const int ix = i + j * mGridWidth;
+      const int tilesX = mTilesX;
+      const int tilesY = mTilesY;
+      const int numDiagonals = tilesX + tilesY - 1;
 
-        if (mCellType[ix] == kCellTypeFluid)
+      #pragma omp parallel num_threads(numThreads)
+      {
+        for (int d = 0; d < numDiagonals; d++)
         {
-          const int ix_plus_i = (i + 1) + j * mGridWidth;
-          const int ix_plus_j = i + (j + 1) * mGridWidth;
+          const int tj0 = std::max(0, d - tilesX + 1);
+          const int tj1 = std::min(d, tilesY - 1);
 
-          double t = mAux[ix];
-
-          if (i < (mGridWidth - 1))
+          #pragma omp for schedule(dynamic, 1)
+          for (int tj = tj0; tj <= tj1; tj++)
           {
-            t -= (mCoefPlusI[ix] * mPrecond[ix] * mZ[ix_plus_i]);
+            const int t = (d - tj) + tj * tilesX;
+
+            for (int k = mTileFluidStart[t]; k < mTileFluidStart[t + 1]; k++)
+            {
+              applyPrecondLowerCell(system, k);
+            }
           }
-          if (j < (mGridHeight - 1))
+        }
+
+        for (int d = numDiagonals - 1; d >= 0; d--)
+        {
+          const int tj0 = std::max(0, d - tilesX + 1);
+          const int tj1 = std::min(d, tilesY - 1);
+
+          #pragma omp for schedule(dynamic, 1)
+          for (int tj = tj0; tj <= tj1; tj++)
           {
-            t -= (mCoefPlusJ[ix] * mPrecond[ix] * mZ[ix_plus_j]);
-          }
+            const int t = (d - tj) + tj * tilesX;
 
-          mZ[ix] = t * mPrecond[ix];
+            for (int k = mTileFluidStart[t + 1] - 1; k >= mTileFluidStart[t]; k--)
+            {
+              applyPrecondUpperCell(system, k);
+            }
+          }
         }
       }
     }
 
-    void FLIPSolver2D::applyA()
+    template <typename T>
+    void FLIPSolver2D::applyPrecondLowerCell(PcgSystem<T>& system, int k)
     {
-      mZ.clear();
+      const int k_minus_i = mNeighbourMinusI[k];
+      const int k_minus_j = mNeighbourMinusJ[k];
 
-      for (int j = 0; j < mGridHeight; j++)
-      for (int i = 0; i < mGridWidth; i++)
-      {
-        const int ix = i + j * mGridWidth;
+      T t = system.r[k];
 
-        if (mCellType[ix] == kCellTypeFluid)
-        {
-          const int ix_plus_i = (i + 1) + j * mGridWidth;
-          const int ix_plus_j = i + (j + 1) * mGridWidth;
-          const int ix_minus_i = (i - 1) + j * mGridWidth;
-          const int ix_minus_j = i + (j - 1) * mGridWidth;
+      t -= (system.coefPlusI[k_minus_i] * system.precond[k_minus_i] * system.aux[k_minus_i]);
+      t -= (system.coefPlusJ[k_minus_j] * system.precond[k_minus_j] * system.aux[k_minus_j]);
 
-          mZ[ix] = mS[ix] * mCoefDiag[ix];
+      system.aux[k] = t * system.precond[k];
+    }
 
-          if (i > 0)
-          {
-            mZ[ix] += mS[ix_minus_i] * mCoefPlusI[ix_minus_i];
-          }
-          if (j > 0)
-          {
-            mZ[ix] += mS[ix_minus_j] * mCoefPlusJ[ix_minus_j];
-          }
-          if (i < (mGridWidth - 1))
-          {
-            mZ[ix] += mS[ix_plus_i] * mCoefPlusI[ix];
-          }
-          if (j < (mGridHeight - 1))
-          {
-            mZ[ix] += mS[ix_plus_j] * mCoefPlusJ[ix];
-          }
-        }
+    template <typename T>
+    void FLIPSolver2D::applyPrecondUpperCell(PcgSystem<T>& system, int k)
+    {
+      T t = system.aux[k];
+
+      t -= (system.coefPlusI[k] * system.precond[k] * system.z[mNeighbourPlusI[k]]);
+      t -= (system.coefPlusJ[k] * system.precond[k] * system.z[mNeighbourPlusJ[k]]);
+
+      system.z[k] = t * system.precond[k];
+    }
+
+    template <typename T>
+    double FLIPSolver2D::applyA(PcgSystem<T>& system)
+    {
+      // z = A s, returning s . z
+
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, mNumFluidCells);
+      const int numBlocks = (mNumFluidCells + kKernelBlockSize - 1) / kKernelBlockSize;
+
+      const PcgStencil<T> stencil =
+      {
+        system.coefDiag.data(),
+        system.coefPlusI.data(),
+        system.coefPlusJ.data(),
+        mNeighbourMinusI.data(),
+        mNeighbourPlusI.data(),
+        mNeighbourMinusJ.data(),
+        mNeighbourPlusJ.data()
+      };
+
+      double* const blockSums = system.blockSums.data();
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int block = 0; block < numBlocks; block++)
+      {
+        const int begin = block * kKernelBlockSize;
+        const int end = std::min(begin + kKernelBlockSize, mNumFluidCells);
+
+        blockSums[block] = system.kernels->applyStencilDot(stencil, system.s.data(), system.z.data(), begin, end);
       }
+
+      return sumBlocks(blockSums, numBlocks);
     }
   }
 }
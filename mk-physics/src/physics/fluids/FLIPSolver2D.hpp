@@ -2,81 +2,224 @@
 #define SRC_PHYSICS_FLUIDS_FLIPSOLVER2D_H_
 
 #include <vector>
+#include <memory>
+#include <string>
 
-#include <boost/numeric/ublas/vector.hpp>
 #include <glm/glm.hpp>
 
+#include "math/AlignedAllocator.hpp"
+#include "CellType.hpp"
+#include "DistanceField2D.hpp"
+#include "ExecutionPolicy.hpp"
+#include "FLIPCheckpoint.hpp"
+#include "MultigridPreconditioner2D.hpp"
+#include "Particles2D.hpp"
+#include "PcgKernels.hpp"
+#include "SolverStats.hpp"
+#include "SparseGrid2D.hpp"
+
 namespace mk
 {
   namespace physics
   {
-    enum CellType
+    enum PressureSolverMode
     {
-      kCellTypeAir = 0,
-      kCellTypeFluid,
-      kCellTypeSolid
+      kPressureSolverSerial = 0,
+      kPressureSolverParallel
     };
 
-    class FLIPSolver2D
+    enum PressurePreconditioner
     {
-    public:
-      struct Particles
-      {
-      public:
-        Particles();
+      kPreconditionerMIC = 0,
+      kPreconditionerMultigrid
+    };
 
-        void addParticle(const glm::fvec2& pos, const glm::fvec2& vel);
-        void clearParticles();
+    enum PressurePrecision
+    {
+      kPressurePrecisionDouble = 0,
+      kPressurePrecisionFloat,
+      kPressurePrecisionFloatRefined
+    };
 
-      public:
-        std::vector<glm::fvec2> positions;
-        std::vector<glm::fvec2> velocities;
-        int	numParticles;
-      };
+    enum ParticleTransferMode
+    {
+      kParticleTransferSerial = 0,
+      kParticleTransferParallel
+    };
 
+    enum ParticleSortOrder
+    {
+      kParticleSortRowMajor = 0,
+      kParticleSortMorton
+    };
+
+    enum VelocityExtrapolation
+    {
+      kExtrapolationSweeping = 0,
+      kExtrapolationLayered
+    };
+
+    enum VelocityTransfer
+    {
+      kVelocityTransferPicFlip = 0,
+      kVelocityTransferApic
+    };
+
+    enum AdvectionIntegrator
+    {
+      kAdvectionRK2 = 0,
+      kAdvectionRK3,
+      kAdvectionRK4
+    };
+
+    class FLIPSolver2D
+    {
     public:
       FLIPSolver2D(int grid_width, int grid_height, float dx);
 
       float timeStep();
+      int advance(float frameDt, float cflNumber);
       void simulate(float dt);
+      void setMaxSubsteps(int substeps);
+      int getLastSubsteps() const;
       void setBoundaryVel(const glm::fvec2& vel);
       float getPressure(int i, int j);
       glm::fvec2 getVelocity(int i, int j);
       glm::fvec2 getVelocity(float i, float j);
       CellType getCellType(int i, int j) const;
+      void getCellTypes(CellType* cellTypes) const;
       void setCellType(int i, int j, CellType type);
       void setPicFlipFactor(float factor);
+      void setVelocityTransfer(VelocityTransfer transfer);
+      void setPressureSolverMode(PressureSolverMode mode);
+      void setPressurePreconditioner(PressurePreconditioner preconditioner);
+      void setPressurePrecision(PressurePrecision precision);
+      void setPressureWarmStart(bool warmStart);
+      void setPressureWarmStartReference(bool reference);
+      void setSimdLevel(SimdLevel simdLevel);
+      void setParticleTransferMode(ParticleTransferMode mode);
+      void setParticleSortInterval(int steps);
+      void setParticleSortOrder(ParticleSortOrder order);
+      bool getCellParticles(int i, int j, int& begin, int& end) const;
+      void setDistanceMethod(DistanceMethod method);
+      void setDistanceBand(float band);
+      void setVelocityExtrapolation(VelocityExtrapolation extrapolation);
+      void setExtrapolationLayers(int layers);
+      void setAdvectionIntegrator(AdvectionIntegrator integrator);
+      void setAdvectionCfl(float cells);
+      void setExecutionPolicy(const ExecutionPolicy& executionPolicy);
+      const ExecutionPolicy& getExecutionPolicy() const;
+      void setNumThreads(int numThreads);
+      void solvePressure();
+      int getPcgIterations() const;
+      int getPcgIterationsSaved() const;
+      double getPcgResidual() const;
+      int getGridWidth() const;
+      int getGridHeight() const;
+      int getNumActiveTiles() const;
+      float getActiveTileRatio() const;
+      SolverStats& getStats();
+      const SolverStats& getStats() const;
+      void saveCheckpoint(const std::string& path) const;
+      void loadCheckpoint(const FLIPCheckpoint& checkpoint);
+      void loadCheckpoint(const std::string& path);
 
       float& u(int i, int j);
       float& v(int i, int j);
       int ix(int i, int j) const;
-      int ixBig(int i, int j);
 
     public:
-      Particles mParticles;
+      Particles2D mParticles;
 
     private:
+      typedef SparseGrid2D<float, kFluidTileSize> FloatGrid;
+
+      template <typename T> struct PcgSystem
+      {
+        PcgSystem();
+
+        void resize(std::size_t size);
+
+        const PcgKernels<T>* kernels;
+        math::AlignedVector<T> p;
+        math::AlignedVector<T> r;
+        math::AlignedVector<T> s;
+        math::AlignedVector<T> z;
+        math::AlignedVector<T> aux;
+        math::AlignedVector<T> precond;
+        math::AlignedVector<T> coefDiag;
+        math::AlignedVector<T> coefPlusI;
+        math::AlignedVector<T> coefPlusJ;
+        std::vector<double> blockSums;
+      };
+
+      struct ExtrapolationFront
+      {
+        ExtrapolationFront(int width, int height);
+
+        SparseGrid2D<unsigned char, kFluidTileSize> state;
+        std::vector<int> current;
+        std::vector<int> next;
+        std::vector<float> values;
+      };
+
+    private:
+      void step(float dt, int frame, int substep);
+      float getMaxSpeedSquared();
       void applyForce(float dt, float ax, float ay);
       void setBoundary();
+      void applyBoundary();
       void project(float dt);
 
       void checkBoundary(float i_init_, float j_init_, float& i_end_, float& j_end_);
       void advectParticles(float dt);
+      void sortParticles();
+      int cellKey(int i, int j) const;
       void particlesToGrid();
+      void particlesToGridParallel(int numThreads);
+      void reduceTransferGrids(FloatGrid& vel, int numThreads);
+      template <typename Accumulator> void splatVelX(int begin, int end, Accumulator accumulate);
+      template <typename Accumulator> void splatVelY(int begin, int end, Accumulator accumulate);
       void storeVel();
-      float computePhi(float a, float b, float current);
+      void normaliseVel(FloatGrid& vel);
       void computeGridPhi();
-      void sweepU(int i0, int i1, int j0, int j1);
-      void sweepV(int i0, int i1, int j0, int j1);
+      void sweepU(int di, int dj);
+      void sweepV(int di, int dj);
       void extrapolateVel();
+      void extrapolateU();
+      void extrapolateV();
+      void copyBorderFaces(FloatGrid& vel);
+      void extrapolateLayered(FloatGrid& vel, int offsetI, int offsetJ, ExtrapolationFront& front);
       void subtractVel();
       void gridToParticles();
       void fillHoles();
+      void updateActiveTiles();
+      void updateGridTiles();
+      template <typename T> void updateGridTiles(SparseGrid2D<T, kFluidTileSize>& grid, bool keepSolidTiles);
+      template <typename T> void allocateGridTiles(SparseGrid2D<T, kFluidTileSize>& grid, int tile);
+      void getGridTiles(const FloatGrid& grid, const unsigned char* activeTileMask, std::vector<int>& tiles) const;
+      int getSolverTile(int gridTile, int gridTilesX) const;
+      void getTileBounds(int tile, int width, int height, int& i0, int& i1, int& j0, int& j1) const;
+      template <typename Function> void forEachActiveTile(int width, int height, SolverStage stage, Function function);
 
-      void solvePressure();
-      void calcPrecond();
-      void applyPrecond();
-      void applyA();
+      void buildFluidCellList();
+      double computeResidual();
+      void loadPressureGuess(float dt);
+      void storePressureGuess(float dt);
+      template <typename T> double solvePcg(PcgSystem<T>& system, double tolerance);
+      void setupPcgSystem();
+      double solvePressureCorrection(const math::AlignedVector<double>& residual, double error, double tolerance);
+      int countColdStartIterations(double r_max, double tolerance);
+      template <typename T> void calcPrecond(PcgSystem<T>& system);
+      template <typename T> void calcPrecondCell(PcgSystem<T>& system, int k);
+      template <typename T> void applyPrecond(PcgSystem<T>& system);
+      template <typename T> void applyPrecondLowerCell(PcgSystem<T>& system, int k);
+      template <typename T> void applyPrecondUpperCell(PcgSystem<T>& system, int k);
+      template <typename T> double applyA(PcgSystem<T>& system);
+      template <typename T>
+      double dotProduct(PcgSystem<T>& system, const math::AlignedVector<T>& a, const math::AlignedVector<T>& b);
+      template <typename T> double updatePressureAndResidual(PcgSystem<T>& system, double alpha);
+      template <typename T> void updateSearchVector(PcgSystem<T>& system, double beta);
 
       float uVel(float i, float j);
       float vVel(float i, float j);
@@ -84,7 +227,6 @@ namespace mk
       int uIndex_y(float y, float& wy);
       int vIndex_x(float x, float& wx);
       int vIndex_y(float y, float& wy);
-      void swapVel();
 
     private:
       int mGridWidth;
@@ -94,25 +236,68 @@ namespace mk
       float mOverDx;
       glm::fvec2 mBoundaryVelocity;
       float mPicFlipFactor;
-      std::vector<float> mVelX;
-      std::vector<float> mVelY;
-      std::vector<float> mDeltaVelX;
-      std::vector<float> mDeltaVelY;
-      std::vector<float> mWeightSum;
-      std::vector<float> mPhi;
-      std::vector<CellType> mCellType;
-      std::vector<CellType> mCellTypeAux;
-
-      boost::numeric::ublas::vector<double> mP;
-      boost::numeric::ublas::vector<double> mR;
-      boost::numeric::ublas::vector<double> mS;
-      boost::numeric::ublas::vector<double> mZ;
-      boost::numeric::ublas::vector<double> mAux;
-      boost::numeric::ublas::vector<double> mRhs;
-      boost::numeric::ublas::vector<double> mPrecond;
-      boost::numeric::ublas::vector<double> mCoefDiag;
-      boost::numeric::ublas::vector<double> mCoefPlusI;
-      boost::numeric::ublas::vector<double> mCoefPlusJ;
+      VelocityTransfer mVelocityTransfer;
+      ExecutionPolicy mExecutionPolicy;
+      SolverStats mStats;
+      int mStepCount;
+      int mFrameCount;
+      int mMaxSubsteps;
+      int mLastSubsteps;
+      float mMaxSpeedSquared;
+      int mMaxSpeedParticles;
+      ParticleSortOrder mParticleSortOrder;
+      int mParticleSortInterval;
+      int mNumSortedParticles;
+      std::vector<int> mParticleKeys;
+      std::vector<int> mCellParticleStart;
+      PressurePreconditioner mPressurePreconditioner;
+      PressurePrecision mPressurePrecision;
+      bool mPressureWarmStart;
+      bool mPressureWarmStartReference;
+      int mPcgIterations;
+      int mPcgIterationsSaved;
+      double mPcgResidual;
+      float mLastPressureDt;
+      FloatGrid mVelX;
+      FloatGrid mVelY;
+      FloatGrid mDeltaVelX;
+      FloatGrid mDeltaVelY;
+      FloatGrid mWeightSum;
+      std::vector<SparseGrid2D<glm::fvec2, kFluidTileSize> > mTransferGrids;
+      FloatGrid mPhi;
+      DistanceField2D mDistanceField;
+      VelocityExtrapolation mVelocityExtrapolation;
+      int mExtrapolationLayers;
+      AdvectionIntegrator mAdvectionIntegrator;
+      float mAdvectionCfl;
+      ExtrapolationFront mExtrapolationU;
+      ExtrapolationFront mExtrapolationV;
+      CellTypeGrid mCellType;
+      CellTypeGrid mCellTypeAux;
+      int mTilesX;
+      int mTilesY;
+      std::vector<unsigned char> mSolidTileMask;
+      std::vector<unsigned char> mFluidTileMask;
+      std::vector<unsigned char> mActiveTileMask;
+      std::vector<int> mActiveTiles;
+
+      int mNumFluidCells;
+      std::vector<int> mFluidCells;
+      SparseGrid2D<int, kFluidTileSize> mCompactIndex;
+      std::vector<int> mTileFluidStart;
+      math::AlignedVector<int> mNeighbourMinusI;
+      math::AlignedVector<int> mNeighbourPlusI;
+      math::AlignedVector<int> mNeighbourMinusJ;
+      math::AlignedVector<int> mNeighbourPlusJ;
+
+      math::AlignedVector<double> mP;
+      math::AlignedVector<double> mColdStartPressure;
+      math::AlignedVector<double> mRhs;
+      math::AlignedVector<double> mResidual;
+      PcgSystem<double> mPcgDouble;
+      PcgSystem<float> mPcgFloat;
+      SparseGrid2D<double> mLastPressure;
+      std::unique_ptr<MultigridPreconditioner2D> mMultigrid;
     };
   }
 }
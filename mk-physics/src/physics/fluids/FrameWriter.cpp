@@ -0,0 +1,652 @@
+#include "FrameWriter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "trace/TraceRecorder.hpp"
+#include "FLIPSolver2D.hpp"
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      const char kMagic[8] = { 'M', 'K', 'F', 'L', 'I', 'P', 'F', 'R' };
+      const std::uint32_t kVersion = 1;
+      const int kFileHeaderSize = 32;
+      const int kFrameHeaderSize = 32;
+      const float kQuantizationSteps = 65535.0f;
+
+      const std::uint32_t kFrameFlagKey = 1;
+      const std::uint32_t kFrameFlagQuantized = 2;
+
+      // Fixed size fields are written byte by byte, so the files are little endian whatever the host
+
+      void putU32(unsigned char* out, std::uint32_t value)
+      {
+        out[0] = static_cast<unsigned char>(value);
+        out[1] = static_cast<unsigned char>(value >> 8);
+        out[2] = static_cast<unsigned char>(value >> 16);
+        out[3] = static_cast<unsigned char>(value >> 24);
+      }
+
+      std::uint32_t getU32(const unsigned char* in)
+      {
+        return static_cast<std::uint32_t>(in[0]) | (static_cast<std::uint32_t>(in[1]) << 8) |
+               (static_cast<std::uint32_t>(in[2]) << 16) | (static_cast<std::uint32_t>(in[3]) << 24);
+      }
+
+      void putF32(unsigned char* out, float value)
+      {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        putU32(out, bits);
+      }
+
+      float getF32(const unsigned char* in)
+      {
+        const std::uint32_t bits = getU32(in);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+      }
+
+      void putF64(unsigned char* out, double value)
+      {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        putU32(out, static_cast<std::uint32_t>(bits));
+        putU32(out + 4, static_cast<std::uint32_t>(bits >> 32));
+      }
+
+      double getF64(const unsigned char* in)
+      {
+        const std::uint64_t bits = static_cast<std::uint64_t>(getU32(in)) |
+                                   (static_cast<std::uint64_t>(getU32(in + 4)) << 32);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+      }
+
+      void appendU16(std::vector<unsigned char>& out, std::uint16_t value)
+      {
+        out.push_back(static_cast<unsigned char>(value));
+        out.push_back(static_cast<unsigned char>(value >> 8));
+      }
+
+      void appendVarint(std::vector<unsigned char>& out, std::uint32_t value)
+      {
+        while (value >= 0x80)
+        {
+          out.push_back(static_cast<unsigned char>(value | 0x80));
+          value >>= 7;
+        }
+
+        out.push_back(static_cast<unsigned char>(value));
+      }
+
+      bool readVarint(const unsigned char*& in, const unsigned char* end, std::uint32_t& value)
+      {
+        value = 0;
+
+        for (int shift = 0; (shift < 35) && (in < end); shift += 7)
+        {
+          const unsigned char byte = *in++;
+
+          value |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+
+          if (!(byte & 0x80))
+          {
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      std::uint32_t zigzag(std::int32_t value)
+      {
+        return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+      }
+
+      std::int32_t unzigzag(std::uint32_t value)
+      {
+        return static_cast<std::int32_t>(value >> 1) ^ -static_cast<std::int32_t>(value & 1);
+      }
+
+      std::uint16_t quantize(float value, float scale)
+      {
+        const float q = std::floor(value * scale + 0.5f);
+
+        return static_cast<std::uint16_t>(std::min(std::max(q, 0.0f), kQuantizationSteps));
+      }
+
+      void appendRunLengths(std::vector<unsigned char>& out, const unsigned char* values, int count)
+      {
+        int c = 0;
+
+        while (c < count)
+        {
+          int end = c + 1;
+
+          while ((end < count) && (values[end] == values[c]))
+          {
+            ++end;
+          }
+
+          out.push_back(values[c]);
+          appendVarint(out, static_cast<std::uint32_t>(end - c));
+
+          c = end;
+        }
+      }
+    }
+
+    FrameWriterOptions::FrameWriterOptions()
+    : queueCapacity(2),
+      queuePolicy(kFrameQueueBlock),
+      quantize(false),
+      delta(false),
+      keyFrameInterval(30)
+    {
+    }
+
+    FrameWriterStats::FrameWriterStats()
+    : framesSubmitted(0),
+      framesWritten(0),
+      framesDropped(0),
+      framesStalled(0),
+      stallMs(0.0),
+      bytesWritten(0),
+      maxQueueSize(0),
+      failed(false)
+    {
+    }
+
+    FrameWriter::FrameFileError::FrameFileError(const std::string& path, const std::string& reason)
+    : mWhat("Frame file " + path + ": " + reason)
+    {
+    }
+
+    const char* FrameWriter::FrameFileError::what() const noexcept
+    {
+      return mWhat.c_str();
+    }
+
+    FrameWriter::FrameWriter(const std::string& path, int gridWidth, int gridHeight, float dx,
+                             const FrameWriterOptions& options)
+    : mGridWidth(gridWidth),
+      mGridHeight(gridHeight),
+      mDx(dx),
+      mOptions(options),
+      mFile(path.c_str(), std::ios::binary | std::ios::trunc),
+      mMutex(),
+      mFrameQueued(),
+      mFrameReleased(),
+      mFrames(),
+      mFreeFrames(),
+      mQueue(),
+      mClosing(false),
+      mStats(),
+      mCellTypes(gridWidth * gridHeight),
+      mPreviousX(),
+      mPreviousY(),
+      mPreviousCellTypes(),
+      mPayload(),
+      mFramesSinceKey(0),
+      mThread()
+    {
+      if (!mFile)
+      {
+        throw FrameFileError(path, "cannot create the file");
+      }
+
+      const std::uint32_t flags = (options.quantize ? kFrameFlagQuantized : 0);
+
+      unsigned char header[kFileHeaderSize] = {};
+
+      std::memcpy(header, kMagic, sizeof(kMagic));
+      putU32(header + 8, kVersion);
+      putU32(header + 12, flags);
+      putU32(header + 16, static_cast<std::uint32_t>(gridWidth));
+      putU32(header + 20, static_cast<std::uint32_t>(gridHeight));
+      putF32(header + 24, dx);
+
+      mFile.write(reinterpret_cast<const char*>(header), sizeof(header));
+      mStats.bytesWritten = sizeof(header);
+
+      // One buffer more than the queue holds, so that a frame can be written while the queue is full
+
+      const int numFrames = std::max(1, options.queueCapacity) + 1;
+
+      for (int f = 0; f < numFrames; f++)
+      {
+        mFrames.push_back(std::unique_ptr<Frame>(new Frame()));
+        mFreeFrames.push_back(mFrames.back().get());
+      }
+
+      mThread = std::thread(&FrameWriter::run, this);
+    }
+
+    FrameWriter::~FrameWriter()
+    {
+      close();
+    }
+
+    bool FrameWriter::submit(const FLIPSolver2D& solver, double time)
+    {
+      MK_TRACE_SCOPE("fluids", "submit_frame");
+
+      if ((solver.getGridWidth() != mGridWidth) || (solver.getGridHeight() != mGridHeight))
+      {
+        throw std::invalid_argument("The grid of the solver does not match the frame file");
+      }
+
+      const std::size_t queueCapacity = static_cast<std::size_t>(std::max(1, mOptions.queueCapacity));
+
+      Frame* frame = nullptr;
+      int index = 0;
+
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        index = static_cast<int>(mStats.framesSubmitted++);
+
+        const bool full = mFreeFrames.empty() || (mQueue.size() >= queueCapacity);
+
+        if (mClosing || mStats.failed || (full && (mOptions.queuePolicy == kFrameQueueDrop)))
+        {
+          ++mStats.framesDropped;
+          return false;
+        }
+
+        if (full)
+        {
+          const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+          mFrameReleased.wait(lock, [this, queueCapacity]()
+          {
+            return !mFreeFrames.empty() && (mQueue.size() < queueCapacity);
+          });
+
+          ++mStats.framesStalled;
+          mStats.stallMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        frame = mFreeFrames.back();
+        mFreeFrames.pop_back();
+      }
+
+      // The copy is the only work left on the simulation thread, and it happens without holding the lock
+
+      const int numParticles = solver.mParticles.getNumParticles();
+
+      frame->index = index;
+      frame->time = time;
+      frame->x.assign(solver.mParticles.x(), solver.mParticles.x() + numParticles);
+      frame->y.assign(solver.mParticles.y(), solver.mParticles.y() + numParticles);
+      solver.getCellTypes(mCellTypes.data());
+      frame->cellTypes.assign(mCellTypes.begin(), mCellTypes.end());
+
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mQueue.push_back(frame);
+        mStats.maxQueueSize = std::max(mStats.maxQueueSize, static_cast<int>(mQueue.size()));
+      }
+
+      mFrameQueued.notify_one();
+
+      return true;
+    }
+
+    void FrameWriter::close()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosing = true;
+      }
+
+      mFrameQueued.notify_one();
+
+      if (mThread.joinable())
+      {
+        mThread.join();
+      }
+
+      if (mFile.is_open())
+      {
+        mFile.close();
+      }
+    }
+
+    FrameWriterStats FrameWriter::getStats() const
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      return mStats;
+    }
+
+    void FrameWriter::run()
+    {
+      MK_TRACE_THREAD_NAME("frame_writer");
+
+      for (;;)
+      {
+        Frame* frame = nullptr;
+        bool failed = false;
+
+        {
+          std::unique_lock<std::mutex> lock(mMutex);
+
+          mFrameQueued.wait(lock, [this]()
+          {
+            return mClosing || !mQueue.empty();
+          });
+
+          if (mQueue.empty())
+          {
+            return;
+          }
+
+          frame = mQueue.front();
+          mQueue.pop_front();
+          failed = mStats.failed;
+        }
+
+        const std::streamoff start = mFile.tellp();
+
+        if (!failed)
+        {
+          writeFrame(*frame);
+        }
+
+        const bool written = !failed && static_cast<bool>(mFile);
+
+        {
+          std::lock_guard<std::mutex> lock(mMutex);
+
+          if (written)
+          {
+            ++mStats.framesWritten;
+            mStats.bytesWritten += mFile.tellp() - start;
+          }
+          else
+          {
+            ++mStats.framesDropped;
+            mStats.failed = true;
+          }
+
+          mFreeFrames.push_back(frame);
+        }
+
+        mFrameReleased.notify_one();
+      }
+    }
+
+    void FrameWriter::writeFrame(const Frame& frame)
+    {
+      MK_TRACE_SCOPE("fluids", "write_frame");
+
+      const int numParticles = static_cast<int>(frame.x.size());
+      const int numCells = static_cast<int>(frame.cellTypes.size());
+
+      // Differences need the previous frame, with the same particles, and a key frame every few frames
+
+      const bool delta = mOptions.quantize && mOptions.delta && (mFramesSinceKey > 0) &&
+                         (mFramesSinceKey < mOptions.keyFrameInterval) &&
+                         (static_cast<int>(mPreviousX.size()) == numParticles);
+
+      mFramesSinceKey = delta ? (mFramesSinceKey + 1) : 1;
+
+      mPayload.clear();
+
+      if (!mOptions.quantize)
+      {
+        mPayload.resize(2 * numParticles * sizeof(float));
+
+        for (int p = 0; p < numParticles; p++)
+        {
+          putF32(&mPayload[4 * p], frame.x[p]);
+          putF32(&mPayload[4 * (numParticles + p)], frame.y[p]);
+        }
+      }
+      else
+      {
+        const float scaleX = kQuantizationSteps / (mGridWidth * mDx);
+        const float scaleY = kQuantizationSteps / (mGridHeight * mDx);
+
+        mPreviousX.resize(numParticles);
+        mPreviousY.resize(numParticles);
+
+        const float* positions[] = { frame.x.data(), frame.y.data() };
+        const float scales[] = { scaleX, scaleY };
+        std::uint16_t* previous[] = { mPreviousX.data(), mPreviousY.data() };
+
+        for (int axis = 0; axis < 2; axis++)
+        for (int p = 0; p < numParticles; p++)
+        {
+          const std::uint16_t q = quantize(positions[axis][p], scales[axis]);
+
+          if (delta)
+          {
+            appendVarint(mPayload, zigzag(static_cast<std::int32_t>(q) - previous[axis][p]));
+          }
+          else
+          {
+            appendU16(mPayload, q);
+          }
+
+          previous[axis][p] = q;
+        }
+      }
+
+      const std::size_t positionBytes = mPayload.size();
+
+      // Between consecutive frames only the cells at the surface change type, so the xor is mostly long runs of 0
+
+      if (delta)
+      {
+        for (int c = 0; c < numCells; c++)
+        {
+          mPreviousCellTypes[c] ^= frame.cellTypes[c];
+        }
+
+        appendRunLengths(mPayload, mPreviousCellTypes.data(), numCells);
+      }
+      else
+      {
+        appendRunLengths(mPayload, frame.cellTypes.data(), numCells);
+      }
+
+      mPreviousCellTypes = frame.cellTypes;
+
+      const std::uint32_t flags = (delta ? 0 : kFrameFlagKey) | (mOptions.quantize ? kFrameFlagQuantized : 0);
+
+      unsigned char header[kFrameHeaderSize] = {};
+
+      putU32(header, static_cast<std::uint32_t>(frame.index));
+      putU32(header + 4, flags);
+      putF64(header + 8, frame.time);
+      putU32(header + 16, static_cast<std::uint32_t>(numParticles));
+      putU32(header + 20, static_cast<std::uint32_t>(positionBytes));
+      putU32(header + 24, static_cast<std::uint32_t>(mPayload.size() - positionBytes));
+
+      mFile.write(reinterpret_cast<const char*>(header), sizeof(header));
+      mFile.write(reinterpret_cast<const char*>(mPayload.data()), static_cast<std::streamsize>(mPayload.size()));
+    }
+
+    FrameReader::FrameReader(const std::string& path)
+    : mPath(path),
+      mFile(path.c_str(), std::ios::binary),
+      mGridWidth(0),
+      mGridHeight(0),
+      mDx(0.0f),
+      mPreviousX(),
+      mPreviousY(),
+      mPreviousCellTypes(),
+      mPayload()
+    {
+      unsigned char header[kFileHeaderSize];
+
+      if (!mFile.read(reinterpret_cast<char*>(header), sizeof(header)))
+      {
+        throw FrameWriter::FrameFileError(path, "cannot read the header");
+      }
+
+      if ((std::memcmp(header, kMagic, sizeof(kMagic)) != 0) || (getU32(header + 8) != kVersion))
+      {
+        throw FrameWriter::FrameFileError(path, "not a frame file of a supported version");
+      }
+
+      mGridWidth = static_cast<int>(getU32(header + 16));
+      mGridHeight = static_cast<int>(getU32(header + 20));
+      mDx = getF32(header + 24);
+    }
+
+    int FrameReader::getGridWidth() const
+    {
+      return mGridWidth;
+    }
+
+    int FrameReader::getGridHeight() const
+    {
+      return mGridHeight;
+    }
+
+    float FrameReader::getDx() const
+    {
+      return mDx;
+    }
+
+    bool FrameReader::readFrame(FrameData& frame)
+    {
+      unsigned char header[kFrameHeaderSize];
+
+      if (!mFile.read(reinterpret_cast<char*>(header), sizeof(header)))
+      {
+        if (mFile.gcount() == 0)
+        {
+          return false;
+        }
+
+        throw FrameWriter::FrameFileError(mPath, "truncated frame header");
+      }
+
+      const std::uint32_t flags = getU32(header + 4);
+      const bool key = (flags & kFrameFlagKey) != 0;
+      const bool quantized = (flags & kFrameFlagQuantized) != 0;
+      const int numParticles = static_cast<int>(getU32(header + 16));
+      const std::size_t positionBytes = getU32(header + 20);
+      const std::size_t cellBytes = getU32(header + 24);
+      const int numCells = mGridWidth * mGridHeight;
+
+      if (!key && ((static_cast<int>(mPreviousX.size()) != numParticles) ||
+                   (static_cast<int>(mPreviousCellTypes.size()) != numCells)))
+      {
+        throw FrameWriter::FrameFileError(mPath, "difference frame without a previous frame");
+      }
+
+      mPayload.resize(positionBytes + cellBytes);
+
+      if (!mFile.read(reinterpret_cast<char*>(mPayload.data()), static_cast<std::streamsize>(mPayload.size())))
+      {
+        throw FrameWriter::FrameFileError(mPath, "truncated frame");
+      }
+
+      frame.index = static_cast<int>(getU32(header));
+      frame.time = getF64(header + 8);
+      frame.x.resize(numParticles);
+      frame.y.resize(numParticles);
+
+      const unsigned char* in = mPayload.data();
+      const unsigned char* positionEnd = in + positionBytes;
+      bool valid = true;
+
+      if (!quantized)
+      {
+        valid = (positionBytes == 2 * numParticles * sizeof(float));
+
+        for (int p = 0; valid && (p < numParticles); p++)
+        {
+          frame.x[p] = getF32(in + 4 * p);
+          frame.y[p] = getF32(in + 4 * (numParticles + p));
+        }
+      }
+      else
+      {
+        const float scaleX = (mGridWidth * mDx) / kQuantizationSteps;
+        const float scaleY = (mGridHeight * mDx) / kQuantizationSteps;
+
+        mPreviousX.resize(numParticles);
+        mPreviousY.resize(numParticles);
+
+        float* positions[] = { frame.x.data(), frame.y.data() };
+        const float scales[] = { scaleX, scaleY };
+        std::uint16_t* previous[] = { mPreviousX.data(), mPreviousY.data() };
+
+        for (int axis = 0; valid && (axis < 2); axis++)
+        for (int p = 0; valid && (p < numParticles); p++)
+        {
+          std::uint32_t value = 0;
+
+          if (key)
+          {
+            valid = (positionEnd - in >= 2);
+            value = valid ? (in[0] | (in[1] << 8)) : 0;
+            in += 2;
+          }
+          else
+          {
+            valid = readVarint(in, positionEnd, value);
+            value = static_cast<std::uint16_t>(previous[axis][p] + unzigzag(value));
+          }
+
+          previous[axis][p] = static_cast<std::uint16_t>(value);
+          positions[axis][p] = value * scales[axis];
+        }
+      }
+
+      // Cell types, as runs of either types or their xor with the previous frame
+
+      in = positionEnd;
+
+      const unsigned char* cellEnd = positionEnd + cellBytes;
+
+      mPreviousCellTypes.resize(numCells);
+
+      int c = 0;
+
+      while (valid && (c < numCells) && (in < cellEnd))
+      {
+        const unsigned char value = *in++;
+        std::uint32_t run = 0;
+
+        valid = readVarint(in, cellEnd, run) && (run <= static_cast<std::uint32_t>(numCells - c));
+
+        for (std::uint32_t r = 0; valid && (r < run); r++, c++)
+        {
+          mPreviousCellTypes[c] = key ? value : (mPreviousCellTypes[c] ^ value);
+        }
+      }
+
+      if (!valid || (c != numCells))
+      {
+        throw FrameWriter::FrameFileError(mPath, "corrupt frame " + std::to_string(frame.index));
+      }
+
+      frame.cellTypes.resize(numCells);
+
+      for (int cell = 0; cell < numCells; cell++)
+      {
+        frame.cellTypes[cell] = static_cast<CellType>(mPreviousCellTypes[cell]);
+      }
+
+      return true;
+    }
+  }
+}
@@ -0,0 +1,234 @@
+#ifndef SRC_PHYSICS_FLUIDS_FRAMEWRITER_H_
+#define SRC_PHYSICS_FLUIDS_FRAMEWRITER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CellType.hpp"
+
+namespace mk
+{
+  namespace physics
+  {
+    class FLIPSolver2D;
+
+    enum FrameQueuePolicy
+    {
+      kFrameQueueBlock = 0,
+      kFrameQueueDrop
+    };
+
+    /**
+     * Options of a FrameWriter.
+     */
+    struct FrameWriterOptions
+    {
+      FrameWriterOptions();
+
+      /**
+       * Number of frames that may wait to be written. Once it is full, submitting a frame either waits for the
+       * writer (kFrameQueueBlock) or drops the frame (kFrameQueueDrop).
+       */
+      int queueCapacity;
+      FrameQueuePolicy queuePolicy;
+
+      /**
+       * Stores positions as 16 bit fixed point values across the domain instead of floats.
+       */
+      bool quantize;
+
+      /**
+       * Stores quantized positions and cell types as differences from the previous frame, which mostly are
+       * small numbers taking a single byte. Ignored without quantization.
+       */
+      bool delta;
+
+      /**
+       * Every this many frames a frame is stored whole, so that readers can start from it.
+       */
+      int keyFrameInterval;
+    };
+
+    /**
+     * Counters of a FrameWriter, since it was opened.
+     */
+    struct FrameWriterStats
+    {
+      FrameWriterStats();
+
+      long long framesSubmitted;
+      long long framesWritten;
+      long long framesDropped;
+      long long framesStalled;
+      double stallMs;
+      long long bytesWritten;
+      int maxQueueSize;
+      bool failed;
+    };
+
+    /**
+     * Frame decoded by a FrameReader.
+     */
+    struct FrameData
+    {
+      int index;
+      double time;
+      std::vector<float> x;
+      std::vector<float> y;
+      std::vector<CellType> cellTypes;
+    };
+
+    /**
+     * Writes the particle positions and cell types of a FLIPSolver2D to a sequential frame file from a
+     * background thread, so that the simulation only pays for copying them.
+     *
+     * Snapshots are copied to buffers taken from a pool holding one more buffer than the queue, handed to the
+     * writer thread through the queue, and returned to the pool once written, so nothing is allocated once
+     * the buffers have grown to the size of the frames.
+     *
+     * The file starts with a header describing the grid, followed by one record per frame: a header with the
+     * index, time, number of particles and payload sizes, the positions (floats, 16 bit values, or zigzag
+     * varint differences of the 16 bit values from the previous frame), and the cell types run length encoded
+     * (either the types themselves, or their xor with the types of the previous frame). Everything is little
+     * endian.
+     */
+    class FrameWriter
+    {
+    public:
+      class FrameFileError : public std::exception
+      {
+      public:
+        FrameFileError(const std::string& path, const std::string& reason);
+        virtual const char* what() const noexcept;
+
+      private:
+        const std::string mWhat;
+      };
+
+    public:
+      /**
+       * Creates the file and starts the writer thread.
+       *
+       * @param path Path of the frame file.
+       * @param gridWidth Width of the grid of the solver in cells.
+       * @param gridHeight Height of the grid of the solver in cells.
+       * @param dx Size of a cell.
+       * @param options Queue and encoding options.
+       * @throw FrameWriter::FrameFileError if the file cannot be created
+       */
+      FrameWriter(const std::string& path, int gridWidth, int gridHeight, float dx,
+                  const FrameWriterOptions& options = FrameWriterOptions());
+      ~FrameWriter();
+
+      FrameWriter(const FrameWriter&) = delete;
+      FrameWriter& operator=(const FrameWriter&) = delete;
+
+      /**
+       * Queues a snapshot of the particle positions and cell types of a solver.
+       *
+       * @param solver Solver with the same grid the writer was opened with.
+       * @param time Simulated time of the frame.
+       * @return False if the frame was dropped because the queue was full or the writer failed.
+       */
+      bool submit(const FLIPSolver2D& solver, double time);
+
+      /**
+       * Writes the frames still queued and stops the writer thread. Called by the destructor.
+       */
+      void close();
+
+      FrameWriterStats getStats() const;
+
+    private:
+      struct Frame
+      {
+        int index;
+        double time;
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<unsigned char> cellTypes;
+      };
+
+    private:
+      void run();
+      void writeFrame(const Frame& frame);
+
+    private:
+      const int mGridWidth;
+      const int mGridHeight;
+      const float mDx;
+      const FrameWriterOptions mOptions;
+      std::ofstream mFile;
+
+      mutable std::mutex mMutex;
+      std::condition_variable mFrameQueued;
+      std::condition_variable mFrameReleased;
+      std::vector<std::unique_ptr<Frame> > mFrames;
+      std::vector<Frame*> mFreeFrames;
+      std::deque<Frame*> mQueue;
+      bool mClosing;
+      FrameWriterStats mStats;
+
+      // Only used by the simulation thread
+      std::vector<CellType> mCellTypes;
+
+      // Only used by the writer thread
+      std::vector<std::uint16_t> mPreviousX;
+      std::vector<std::uint16_t> mPreviousY;
+      std::vector<unsigned char> mPreviousCellTypes;
+      std::vector<unsigned char> mPayload;
+      int mFramesSinceKey;
+
+      std::thread mThread;
+    };
+
+    /**
+     * Reads the frames of a file written by FrameWriter, in order.
+     */
+    class FrameReader
+    {
+    public:
+      /**
+       * @throw FrameWriter::FrameFileError if the file cannot be opened or is not a frame file
+       */
+      explicit FrameReader(const std::string& path);
+
+      FrameReader(const FrameReader&) = delete;
+      FrameReader& operator=(const FrameReader&) = delete;
+
+      int getGridWidth() const;
+      int getGridHeight() const;
+      float getDx() const;
+
+      /**
+       * Decodes the next frame.
+       *
+       * @param frame Frame read.
+       * @return False at the end of the file.
+       * @throw FrameWriter::FrameFileError if the frame is corrupt
+       */
+      bool readFrame(FrameData& frame);
+
+    private:
+      std::string mPath;
+      std::ifstream mFile;
+      int mGridWidth;
+      int mGridHeight;
+      float mDx;
+      std::vector<std::uint16_t> mPreviousX;
+      std::vector<std::uint16_t> mPreviousY;
+      std::vector<unsigned char> mPreviousCellTypes;
+      std::vector<unsigned char> mPayload;
+    };
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_FRAMEWRITER_H_
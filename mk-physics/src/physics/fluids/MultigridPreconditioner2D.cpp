@@ -0,0 +1,418 @@
+#include "MultigridPreconditioner2D.hpp"
+
+#include <algorithm>
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      const int kCoarsestLevelSize = 8;
+      const int kSmoothingSweeps = 2;
+      const int kCoarsestLevelSweeps = 16;
+    }
+
+    MultigridPreconditioner2D::Level::Level(int width, int height)
+    : width(width),
+      height(height),
+      cellType(width * height, kCellTypeSolid),
+      coefDiag(width * height, 0.0),
+      coefPlusI(width * height, 0.0),
+      coefPlusJ(width * height, 0.0),
+      x(width * height, 0.0),
+      b(width * height, 0.0),
+      r(width * height, 0.0)
+    {
+    }
+
+    MultigridPreconditioner2D::MultigridPreconditioner2D(int gridWidth, int gridHeight)
+    : mLevels(),
+      mExecutionPolicy()
+    {
+      int width = gridWidth;
+      int height = gridHeight;
+
+      mLevels.push_back(Level(width, height));
+
+      while ((width > kCoarsestLevelSize) || (height > kCoarsestLevelSize))
+      {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+
+        mLevels.push_back(Level(width, height));
+      }
+    }
+
+    void MultigridPreconditioner2D::setExecutionPolicy(const ExecutionPolicy& executionPolicy)
+    {
+      mExecutionPolicy = executionPolicy;
+    }
+
+    int MultigridPreconditioner2D::getNumLevels() const
+    {
+      return static_cast<int>(mLevels.size());
+    }
+
+    void MultigridPreconditioner2D::build(const CellTypeGrid& cellType, const int* fluidCells, int numFluidCells,
+                                          const double* coefDiag, const double* coefPlusI, const double* coefPlusJ)
+    {
+      // The finest level scatters the stencil of the solver instead of discretising its own, so both always
+      // agree on the matrix being preconditioned
+
+      Level& finest = mLevels[0];
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, numFluidCells);
+
+      cellType.copyTo(finest.cellType.data());
+
+      std::fill(finest.coefDiag.begin(), finest.coefDiag.end(), 0.0);
+      std::fill(finest.coefPlusI.begin(), finest.coefPlusI.end(), 0.0);
+      std::fill(finest.coefPlusJ.begin(), finest.coefPlusJ.end(), 0.0);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int k = 0; k < numFluidCells; k++)
+      {
+        const int ix = fluidCells[k];
+
+        finest.coefDiag[ix] = coefDiag[k];
+        finest.coefPlusI[ix] = coefPlusI[k];
+        finest.coefPlusJ[ix] = coefPlusJ[k];
+      }
+
+      for (std::size_t l = 1; l < mLevels.size(); l++)
+      {
+        coarsen(mLevels[l - 1], mLevels[l]);
+        discretise(mLevels[l]);
+      }
+    }
+
+    template <typename T>
+    void MultigridPreconditioner2D::apply(const int* fluidCells, int numFluidCells, const T* r, T* z)
+    {
+      // Only fluid cells of the right hand side are ever read, so there is no need to clear the rest
+
+      Level& finest = mLevels[0];
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, numFluidCells);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int k = 0; k < numFluidCells; k++)
+      {
+        finest.b[fluidCells[k]] = r[k];
+      }
+
+      vCycle(0);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int k = 0; k < numFluidCells; k++)
+      {
+        z[k] = static_cast<T>(finest.x[fluidCells[k]]);
+      }
+    }
+
+    template void MultigridPreconditioner2D::apply<double>(const int*, int, const double*, double*);
+    template void MultigridPreconditioner2D::apply<float>(const int*, int, const float*, float*);
+
+    void MultigridPreconditioner2D::coarsen(const Level& fine, Level& coarse)
+    {
+      // Air dominates fluid, which dominates solid
+
+      const int width = coarse.width;
+      const int height = coarse.height;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, width * height);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int j = 0; j < height; j++)
+      for (int i = 0; i < width; i++)
+      {
+        bool hasAir = false;
+        bool hasFluid = false;
+
+        for (int fj = 2 * j; fj < std::min(2 * j + 2, fine.height); fj++)
+        for (int fi = 2 * i; fi < std::min(2 * i + 2, fine.width); fi++)
+        {
+          const CellType type = fine.cellType[fi + fj * fine.width];
+
+          hasAir = hasAir || (type == kCellTypeAir);
+          hasFluid = hasFluid || (type == kCellTypeFluid);
+        }
+
+        coarse.cellType[i + j * width] = hasAir ? kCellTypeAir : (hasFluid ? kCellTypeFluid : kCellTypeSolid);
+      }
+    }
+
+    void MultigridPreconditioner2D::discretise(Level& level)
+    {
+      // Cells outside the grid are treated as solid
+
+      const int width = level.width;
+      const int height = level.height;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, width * height);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int j = 0; j < height; j++)
+      for (int i = 0; i < width; i++)
+      {
+        const int ix = i + j * width;
+
+        level.coefDiag[ix] = 0.0;
+        level.coefPlusI[ix] = 0.0;
+        level.coefPlusJ[ix] = 0.0;
+
+        if (level.cellType[ix] != kCellTypeFluid)
+        {
+          continue;
+        }
+
+        if ((i > 0) && (level.cellType[ix - 1] != kCellTypeSolid))
+        {
+          level.coefDiag[ix] += 1.0;
+        }
+        if ((j > 0) && (level.cellType[ix - width] != kCellTypeSolid))
+        {
+          level.coefDiag[ix] += 1.0;
+        }
+        if ((i < (width - 1)) && (level.cellType[ix + 1] != kCellTypeSolid))
+        {
+          level.coefDiag[ix] += 1.0;
+
+          if (level.cellType[ix + 1] == kCellTypeFluid)
+          {
+            level.coefPlusI[ix] = -1.0;
+          }
+        }
+        if ((j < (height - 1)) && (level.cellType[ix + width] != kCellTypeSolid))
+        {
+          level.coefDiag[ix] += 1.0;
+
+          if (level.cellType[ix + width] == kCellTypeFluid)
+          {
+            level.coefPlusJ[ix] = -1.0;
+          }
+        }
+      }
+    }
+
+    void MultigridPreconditioner2D::vCycle(int l)
+    {
+      Level& level = mLevels[l];
+
+      std::fill(level.x.begin(), level.x.end(), 0.0);
+
+      if (l == static_cast<int>(mLevels.size()) - 1)
+      {
+        for (int k = 0; k < kCoarsestLevelSweeps; k++)
+        {
+          smooth(level, 0);
+          smooth(level, 1);
+        }
+
+        for (int k = 0; k < kCoarsestLevelSweeps; k++)
+        {
+          smooth(level, 1);
+          smooth(level, 0);
+        }
+
+        return;
+      }
+
+      for (int k = 0; k < kSmoothingSweeps; k++)
+      {
+        smooth(level, 0);
+        smooth(level, 1);
+      }
+
+      computeResidual(level);
+      restrictResidual(level, mLevels[l + 1]);
+
+      vCycle(l + 1);
+
+      prolongate(mLevels[l + 1], level);
+
+      for (int k = 0; k < kSmoothingSweeps; k++)
+      {
+        smooth(level, 1);
+        smooth(level, 0);
+      }
+    }
+
+    void MultigridPreconditioner2D::smooth(Level& level, int colour)
+    {
+      const int width = level.width;
+      const int height = level.height;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, width * height);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int j = 0; j < height; j++)
+      for (int i = (j + colour) % 2; i < width; i += 2)
+      {
+        const int ix = i + j * width;
+
+        if ((level.cellType[ix] != kCellTypeFluid) || (level.coefDiag[ix] == 0.0))
+        {
+          continue;
+        }
+
+        double t = level.b[ix];
+
+        if (i > 0)
+        {
+          t -= level.coefPlusI[ix - 1] * level.x[ix - 1];
+        }
+        if (j > 0)
+        {
+          t -= level.coefPlusJ[ix - width] * level.x[ix - width];
+        }
+        if (i < (width - 1))
+        {
+          t -= level.coefPlusI[ix] * level.x[ix + 1];
+        }
+        if (j < (height - 1))
+        {
+          t -= level.coefPlusJ[ix] * level.x[ix + width];
+        }
+
+        level.x[ix] = t / level.coefDiag[ix];
+      }
+    }
+
+    void MultigridPreconditioner2D::computeResidual(Level& level)
+    {
+      const int width = level.width;
+      const int height = level.height;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, width * height);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int j = 0; j < height; j++)
+      for (int i = 0; i < width; i++)
+      {
+        const int ix = i + j * width;
+
+        if (level.cellType[ix] != kCellTypeFluid)
+        {
+          level.r[ix] = 0.0;
+          continue;
+        }
+
+        double t = level.b[ix] - level.coefDiag[ix] * level.x[ix];
+
+        if (i > 0)
+        {
+          t -= level.coefPlusI[ix - 1] * level.x[ix - 1];
+        }
+        if (j > 0)
+        {
+          t -= level.coefPlusJ[ix - width] * level.x[ix - width];
+        }
+        if (i < (width - 1))
+        {
+          t -= level.coefPlusI[ix] * level.x[ix + 1];
+        }
+        if (j < (height - 1))
+        {
+          t -= level.coefPlusJ[ix] * level.x[ix + width];
+        }
+
+        level.r[ix] = t;
+      }
+    }
+
+    void MultigridPreconditioner2D::restrictResidual(const Level& fine, Level& coarse)
+    {
+      // Transpose of the bilinear prolongation: each coarse cell gathers the 4x4 fine cells around it with
+      // weights (1/4, 3/4, 3/4, 1/4) in each dimension
+
+      static const double weights[4] = { 0.25, 0.75, 0.75, 0.25 };
+
+      const int width = coarse.width;
+      const int height = coarse.height;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, width * height);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int j = 0; j < height; j++)
+      for (int i = 0; i < width; i++)
+      {
+        const int ix = i + j * width;
+
+        coarse.b[ix] = 0.0;
+
+        if (coarse.cellType[ix] != kCellTypeFluid)
+        {
+          continue;
+        }
+
+        double sum = 0.0;
+
+        for (int sj = 0; sj < 4; sj++)
+        {
+          const int fj = 2 * j - 1 + sj;
+
+          if ((fj < 0) || (fj >= fine.height))
+          {
+            continue;
+          }
+
+          for (int si = 0; si < 4; si++)
+          {
+            const int fi = 2 * i - 1 + si;
+
+            if ((fi < 0) || (fi >= fine.width))
+            {
+              continue;
+            }
+
+            sum += weights[si] * weights[sj] * fine.r[fi + fj * fine.width];
+          }
+        }
+
+        coarse.b[ix] = sum;
+      }
+    }
+
+    void MultigridPreconditioner2D::prolongate(const Level& coarse, Level& fine)
+    {
+      // Bilinear interpolation between cell centres. Non fluid coarse cells hold a zero correction.
+
+      const int width = fine.width;
+      const int height = fine.height;
+      const int numThreads = mExecutionPolicy.getNumThreads(kSolverStagePressure, width * height);
+
+      #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+      for (int j = 0; j < height; j++)
+      for (int i = 0; i < width; i++)
+      {
+        const int ix = i + j * width;
+
+        if (fine.cellType[ix] != kCellTypeFluid)
+        {
+          continue;
+        }
+
+        const int ci[2] = { i / 2, (i % 2) ? (i / 2 + 1) : (i / 2 - 1) };
+        const int cj[2] = { j / 2, (j % 2) ? (j / 2 + 1) : (j / 2 - 1) };
+        const double w[2] = { 0.75, 0.25 };
+
+        double correction = 0.0;
+
+        for (int sj = 0; sj < 2; sj++)
+        {
+          if ((cj[sj] < 0) || (cj[sj] >= coarse.height))
+          {
+            continue;
+          }
+
+          for (int si = 0; si < 2; si++)
+          {
+            if ((ci[si] < 0) || (ci[si] >= coarse.width))
+            {
+              continue;
+            }
+
+            correction += w[si] * w[sj] * coarse.x[ci[si] + cj[sj] * coarse.width];
+          }
+        }
+
+        fine.x[ix] += correction;
+      }
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef SRC_PHYSICS_FLUIDS_MULTIGRIDPRECONDITIONER2D_H_
+#define SRC_PHYSICS_FLUIDS_MULTIGRIDPRECONDITIONER2D_H_
+
+#include <vector>
+
+#include "CellType.hpp"
+#include "ExecutionPolicy.hpp"
+
+namespace mk
+{
+  namespace physics
+  {
+    /**
+     * Geometric multigrid V-cycle used as preconditioner for the pressure Poisson system of FLIPSolver2D.
+     *
+     * Coarser levels are obtained by halving the grid in each dimension: a coarse cell is air if any of its
+     * children is air, fluid if any of them is fluid and solid otherwise. The finest level takes the 5-point
+     * stencil the solver assembles in FLIPSolver2D::project, and coarser ones discretise the same stencil from their
+     * own cell types. Residuals are restricted with the transpose of the (cell centred) bilinear prolongation and
+     * both operators only touch fluid cells, so air cells behave as Dirichlet and solid cells as Neumann
+     * boundaries on every level.
+     *
+     * Red-black Gauss-Seidel is used as smoother, running the colours in reverse order after the coarse grid
+     * correction, so the resulting preconditioner is symmetric as required by PCG.
+     */
+    class MultigridPreconditioner2D
+    {
+    public:
+      /**
+       * Allocates the grid hierarchy for a grid of the given size.
+       *
+       * @param gridWidth Width of the finest grid in cells.
+       * @param gridHeight Height of the finest grid in cells.
+       */
+      MultigridPreconditioner2D(int gridWidth, int gridHeight);
+
+      /**
+       * Sets up all levels for a new pressure system.
+       *
+       * @param cellType Cell types of the finest grid, which are copied to the dense levels.
+       * @param fluidCells Grid index of each fluid cell of the finest grid.
+       * @param numFluidCells Number of fluid cells.
+       * @param coefDiag Diagonal of the system matrix, one value per fluid cell.
+       * @param coefPlusI Coefficient between each fluid cell and its neighbour along +i.
+       * @param coefPlusJ Coefficient between each fluid cell and its neighbour along +j.
+       */
+      void build(const CellTypeGrid& cellType, const int* fluidCells, int numFluidCells, const double* coefDiag,
+                 const double* coefPlusI, const double* coefPlusJ);
+
+      /**
+       * Applies one V-cycle to approximately solve A z = r.
+       *
+       * @param fluidCells Grid index of each fluid cell of the finest grid.
+       * @param numFluidCells Number of fluid cells.
+       * @param r Right hand side, one value per fluid cell.
+       * @param z Approximate solution, one value per fluid cell.
+       * @tparam T Storage type of r and z (float or double). The V-cycle itself always works in double.
+       */
+      template <typename T> void apply(const int* fluidCells, int numFluidCells, const T* r, T* z);
+
+      /**
+       * @param executionPolicy Policy deciding the threads of the smoothing and transfer operators, which run as
+       *                        part of the pressure stage. Coarse levels get fewer threads than fine ones.
+       */
+      void setExecutionPolicy(const ExecutionPolicy& executionPolicy);
+
+      /**
+       * @return Number of levels in the hierarchy, including the finest one.
+       */
+      int getNumLevels() const;
+
+    private:
+      struct Level
+      {
+        Level(int width, int height);
+
+        int width;
+        int height;
+        std::vector<CellType> cellType;
+        std::vector<double> coefDiag;
+        std::vector<double> coefPlusI;
+        std::vector<double> coefPlusJ;
+        std::vector<double> x;
+        std::vector<double> b;
+        std::vector<double> r;
+      };
+
+    private:
+      void coarsen(const Level& fine, Level& coarse);
+      void discretise(Level& level);
+      void vCycle(int level);
+      void smooth(Level& level, int colour);
+      void computeResidual(Level& level);
+      void restrictResidual(const Level& fine, Level& coarse);
+      void prolongate(const Level& coarse, Level& fine);
+
+    private:
+      std::vector<Level> mLevels;
+      ExecutionPolicy mExecutionPolicy;
+    };
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_MULTIGRIDPRECONDITIONER2D_H_
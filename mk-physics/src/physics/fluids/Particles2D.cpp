@@ -0,0 +1,300 @@
+#include "Particles2D.hpp"
+
+#include <algorithm>
+
+namespace mk
+{
+  namespace physics
+  {
+    Particles2D::PositionView::PositionView(const float* x, const float* y, int size)
+    : mX(x),
+      mY(y),
+      mSize(size)
+    {
+    }
+
+    glm::fvec2 Particles2D::PositionView::operator[](int p) const
+    {
+      return glm::fvec2(mX[p], mY[p]);
+    }
+
+    int Particles2D::PositionView::size() const
+    {
+      return mSize;
+    }
+
+    Particles2D::Particles2D()
+    : mX(),
+      mY(),
+      mU(),
+      mV(),
+      mAffineEnabled(false),
+      mC00(),
+      mC01(),
+      mC10(),
+      mC11(),
+      mSortScratch(),
+      mSortIndex()
+    {
+    }
+
+    void Particles2D::reserve(int capacity)
+    {
+      mX.reserve(capacity);
+      mY.reserve(capacity);
+      mU.reserve(capacity);
+      mV.reserve(capacity);
+      mSortScratch.reserve(capacity);
+
+      if (mAffineEnabled)
+      {
+        mC00.reserve(capacity);
+        mC01.reserve(capacity);
+        mC10.reserve(capacity);
+        mC11.reserve(capacity);
+      }
+    }
+
+    int Particles2D::getCapacity() const
+    {
+      return static_cast<int>(mX.capacity());
+    }
+
+    int Particles2D::getNumParticles() const
+    {
+      return static_cast<int>(mX.size());
+    }
+
+    void Particles2D::addParticle(const glm::fvec2& pos, const glm::fvec2& vel)
+    {
+      mX.push_back(pos.x);
+      mY.push_back(pos.y);
+      mU.push_back(vel.x);
+      mV.push_back(vel.y);
+      resizeAffine();
+    }
+
+    void Particles2D::addParticles(const float* x, const float* y, const float* u, const float* v, int count)
+    {
+      mX.insert(mX.end(), x, x + count);
+      mY.insert(mY.end(), y, y + count);
+      mU.insert(mU.end(), u, u + count);
+      mV.insert(mV.end(), v, v + count);
+      resizeAffine();
+    }
+
+    void Particles2D::clearParticles()
+    {
+      mX.clear();
+      mY.clear();
+      mU.clear();
+      mV.clear();
+      resizeAffine();
+    }
+
+    void Particles2D::setAffineEnabled(bool enabled)
+    {
+      if (enabled == mAffineEnabled)
+      {
+        return;
+      }
+
+      mAffineEnabled = enabled;
+
+      // Disabling frees the arrays, so that they are only paid for while they are used
+
+      math::AlignedVector<float>* components[] = { &mC00, &mC01, &mC10, &mC11 };
+
+      for (math::AlignedVector<float>* component : components)
+      {
+        math::AlignedVector<float>().swap(*component);
+      }
+
+      resizeAffine();
+    }
+
+    bool Particles2D::isAffineEnabled() const
+    {
+      return mAffineEnabled;
+    }
+
+    void Particles2D::resizeAffine()
+    {
+      // New particles start with a zero matrix
+
+      if (mAffineEnabled)
+      {
+        mC00.resize(mX.size(), 0.0f);
+        mC01.resize(mX.size(), 0.0f);
+        mC10.resize(mX.size(), 0.0f);
+        mC11.resize(mX.size(), 0.0f);
+      }
+    }
+
+    void Particles2D::sortByKey(const int* keys, int numKeys, int* keyStart, int numThreads)
+    {
+      const int numParticles = getNumParticles();
+
+      // Histogram of keys turned into the first destination of each key
+
+      std::fill(keyStart, keyStart + numKeys + 1, 0);
+
+      for (int p = 0; p < numParticles; p++)
+      {
+        ++keyStart[keys[p] + 1];
+      }
+
+      for (int k = 0; k < numKeys; k++)
+      {
+        keyStart[k + 1] += keyStart[k];
+      }
+
+      // Destination of every particle, using keyStart[k] as cursor and shifting it back afterwards
+
+      mSortIndex.resize(numParticles);
+
+      for (int p = 0; p < numParticles; p++)
+      {
+        mSortIndex[p] = keyStart[keys[p]]++;
+      }
+
+      for (int k = numKeys; k > 0; k--)
+      {
+        keyStart[k] = keyStart[k - 1];
+      }
+
+      keyStart[0] = 0;
+
+      // Each component is scattered into the scratch array, which then takes its place. The destinations are a
+      // permutation, so the particles can be split among threads without any synchronisation.
+
+      mSortScratch.resize(numParticles);
+
+      math::AlignedVector<float>* components[] = { &mX, &mY, &mU, &mV, &mC00, &mC01, &mC10, &mC11 };
+      const int numComponents = mAffineEnabled ? 8 : 4;
+      const int* destinations = mSortIndex.data();
+
+      for (int c = 0; c < numComponents; c++)
+      {
+        math::AlignedVector<float>* component = components[c];
+        const float* source = component->data();
+        float* scratch = mSortScratch.data();
+
+        #pragma omp parallel for num_threads(numThreads) if (numThreads > 1)
+        for (int p = 0; p < numParticles; p++)
+        {
+          scratch[destinations[p]] = source[p];
+        }
+
+        component->swap(mSortScratch);
+      }
+    }
+
+    glm::fvec2 Particles2D::getPosition(int p) const
+    {
+      return glm::fvec2(mX[p], mY[p]);
+    }
+
+    glm::fvec2 Particles2D::getVelocity(int p) const
+    {
+      return glm::fvec2(mU[p], mV[p]);
+    }
+
+    void Particles2D::setPosition(int p, const glm::fvec2& pos)
+    {
+      mX[p] = pos.x;
+      mY[p] = pos.y;
+    }
+
+    void Particles2D::setVelocity(int p, const glm::fvec2& vel)
+    {
+      mU[p] = vel.x;
+      mV[p] = vel.y;
+    }
+
+    Particles2D::PositionView Particles2D::getPositions() const
+    {
+      return PositionView(mX.data(), mY.data(), getNumParticles());
+    }
+
+    float* Particles2D::x()
+    {
+      return mX.data();
+    }
+
+    float* Particles2D::y()
+    {
+      return mY.data();
+    }
+
+    float* Particles2D::u()
+    {
+      return mU.data();
+    }
+
+    float* Particles2D::v()
+    {
+      return mV.data();
+    }
+
+    const float* Particles2D::x() const
+    {
+      return mX.data();
+    }
+
+    const float* Particles2D::y() const
+    {
+      return mY.data();
+    }
+
+    const float* Particles2D::u() const
+    {
+      return mU.data();
+    }
+
+    const float* Particles2D::v() const
+    {
+      return mV.data();
+    }
+
+    float* Particles2D::c00()
+    {
+      return mAffineEnabled ? mC00.data() : nullptr;
+    }
+
+    float* Particles2D::c01()
+    {
+      return mAffineEnabled ? mC01.data() : nullptr;
+    }
+
+    float* Particles2D::c10()
+    {
+      return mAffineEnabled ? mC10.data() : nullptr;
+    }
+
+    float* Particles2D::c11()
+    {
+      return mAffineEnabled ? mC11.data() : nullptr;
+    }
+
+    const float* Particles2D::c00() const
+    {
+      return mAffineEnabled ? mC00.data() : nullptr;
+    }
+
+    const float* Particles2D::c01() const
+    {
+      return mAffineEnabled ? mC01.data() : nullptr;
+    }
+
+    const float* Particles2D::c10() const
+    {
+      return mAffineEnabled ? mC10.data() : nullptr;
+    }
+
+    const float* Particles2D::c11() const
+    {
+      return mAffineEnabled ? mC11.data() : nullptr;
+    }
+  }
+}
@@ -0,0 +1,191 @@
+#ifndef SRC_PHYSICS_FLUIDS_PARTICLES2D_H_
+#define SRC_PHYSICS_FLUIDS_PARTICLES2D_H_
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "math/AlignedAllocator.hpp"
+
+namespace mk
+{
+  namespace physics
+  {
+    /**
+     * Set of 2D particles with position and velocity, stored as a structure of arrays.
+     *
+     * Each component lives in its own aligned array, so particle loops read contiguous streams of floats
+     * that can be vectorised, and passes that only need positions do not load velocities.
+     *
+     * Particles can also carry the affine velocity matrix used by APIC transfers, whose first row is the
+     * gradient of u and second row the gradient of v. Its arrays are only allocated while it is enabled.
+     */
+    class Particles2D
+    {
+    public:
+      /**
+       * Read only view of the particle positions, indexed as an array of vectors.
+       */
+      class PositionView
+      {
+      public:
+        PositionView(const float* x, const float* y, int size);
+
+        glm::fvec2 operator[](int p) const;
+        int size() const;
+
+      private:
+        const float* mX;
+        const float* mY;
+        int mSize;
+      };
+
+    public:
+      Particles2D();
+
+      /**
+       * Allocates room for at least the given number of particles, so that adding them does not reallocate.
+       *
+       * @param capacity Number of particles.
+       */
+      void reserve(int capacity);
+
+      /**
+       * @return Number of particles that fit without reallocating.
+       */
+      int getCapacity() const;
+
+      /**
+       * @return Number of particles in the set.
+       */
+      int getNumParticles() const;
+
+      void addParticle(const glm::fvec2& pos, const glm::fvec2& vel);
+
+      /**
+       * Appends a batch of particles.
+       *
+       * @param x Array of count horizontal positions.
+       * @param y Array of count vertical positions.
+       * @param u Array of count horizontal velocities.
+       * @param v Array of count vertical velocities.
+       * @param count Number of particles to append.
+       */
+      void addParticles(const float* x, const float* y, const float* u, const float* v, int count);
+
+      /**
+       * Removes the particles for which the predicate returns true, keeping the order of the rest.
+       *
+       * @param predicate Callable taking the index of a particle and returning whether it should be removed.
+       * @return Number of removed particles.
+       */
+      template <typename Predicate> int removeParticles(Predicate predicate);
+
+      void clearParticles();
+
+      /**
+       * Enables or disables the affine velocity matrix of the particles. Enabling it sets the matrix of every
+       * particle to 0, and particles added afterwards also start with 0.
+       */
+      void setAffineEnabled(bool enabled);
+      bool isAffineEnabled() const;
+
+      /**
+       * Reorders the particles by key with a stable counting sort.
+       *
+       * @param keys Key of each particle, in the range [0, numKeys).
+       * @param numKeys Number of different keys.
+       * @param keyStart Output array of numKeys + 1 elements. The particles with key k end up in the range
+       *                 [keyStart[k], keyStart[k + 1]).
+       * @param numThreads Threads moving the particles to their sorted positions. The destinations are always
+       *                   computed by a single thread, so the order does not depend on it.
+       */
+      void sortByKey(const int* keys, int numKeys, int* keyStart, int numThreads);
+
+      glm::fvec2 getPosition(int p) const;
+      glm::fvec2 getVelocity(int p) const;
+      void setPosition(int p, const glm::fvec2& pos);
+      void setVelocity(int p, const glm::fvec2& vel);
+
+      /**
+       * @return View of the positions, valid until particles are added or removed.
+       */
+      PositionView getPositions() const;
+
+      float* x();
+      float* y();
+      float* u();
+      float* v();
+      const float* x() const;
+      const float* y() const;
+      const float* u() const;
+      const float* v() const;
+
+      /**
+       * @return Entries of the affine velocity matrix, or nullptr if it is not enabled.
+       */
+      float* c00();
+      float* c01();
+      float* c10();
+      float* c11();
+      const float* c00() const;
+      const float* c01() const;
+      const float* c10() const;
+      const float* c11() const;
+
+    private:
+      void resizeAffine();
+
+    private:
+      math::AlignedVector<float> mX;
+      math::AlignedVector<float> mY;
+      math::AlignedVector<float> mU;
+      math::AlignedVector<float> mV;
+      bool mAffineEnabled;
+      math::AlignedVector<float> mC00;
+      math::AlignedVector<float> mC01;
+      math::AlignedVector<float> mC10;
+      math::AlignedVector<float> mC11;
+      math::AlignedVector<float> mSortScratch;
+      std::vector<int> mSortIndex;
+    };
+
+    template <typename Predicate> int Particles2D::removeParticles(Predicate predicate)
+    {
+      const int numParticles = getNumParticles();
+
+      int numKept = 0;
+
+      for (int p = 0; p < numParticles; p++)
+      {
+        if (!predicate(p))
+        {
+          mX[numKept] = mX[p];
+          mY[numKept] = mY[p];
+          mU[numKept] = mU[p];
+          mV[numKept] = mV[p];
+
+          if (mAffineEnabled)
+          {
+            mC00[numKept] = mC00[p];
+            mC01[numKept] = mC01[p];
+            mC10[numKept] = mC10[p];
+            mC11[numKept] = mC11[p];
+          }
+
+          ++numKept;
+        }
+      }
+
+      mX.resize(numKept);
+      mY.resize(numKept);
+      mU.resize(numKept);
+      mV.resize(numKept);
+      resizeAffine();
+
+      return numParticles - numKept;
+    }
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_PARTICLES2D_H_
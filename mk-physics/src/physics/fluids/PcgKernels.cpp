@@ -0,0 +1,161 @@
+#include "PcgKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "PcgKernelsDetail.hpp"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      template <typename T> double dotScalar(const T* a, const T* b, int n)
+      {
+        double result = 0.0;
+
+        for (int i = 0; i < n; i++)
+        {
+          result += static_cast<double>(a[i]) * static_cast<double>(b[i]);
+        }
+
+        return result;
+      }
+
+      template <typename T> double axpyMaxNormScalar(double alpha, const T* s, const T* z, T* p, T* r, int n)
+      {
+        const T alphaT = static_cast<T>(alpha);
+
+        T maxNorm = 0;
+
+        for (int i = 0; i < n; i++)
+        {
+          p[i] += alphaT * s[i];
+          r[i] -= alphaT * z[i];
+
+          maxNorm = std::max(maxNorm, std::fabs(r[i]));
+        }
+
+        return maxNorm;
+      }
+
+      template <typename T> void xpbyScalar(const T* z, double beta, T* s, int n)
+      {
+        const T betaT = static_cast<T>(beta);
+
+        for (int i = 0; i < n; i++)
+        {
+          s[i] = z[i] + betaT * s[i];
+        }
+      }
+
+      template <typename T>
+      double applyStencilDotScalar(const PcgStencil<T>& stencil, const T* s, T* z, int begin, int end)
+      {
+        double sum = 0.0;
+
+        for (int k = begin; k < end; k++)
+        {
+          sum += detail::applyStencilCell(stencil, s, z, k);
+        }
+
+        return sum;
+      }
+
+      template <typename T> const PcgKernels<T>& getPcgKernelsScalar()
+      {
+        static const PcgKernels<T> kernels =
+        {
+          dotScalar<T>,
+          axpyMaxNormScalar<T>,
+          xpbyScalar<T>,
+          applyStencilDotScalar<T>
+        };
+
+        return kernels;
+      }
+
+      template <typename T> const PcgKernels<T>& selectPcgKernels(SimdLevel simdLevel)
+      {
+        static const SimdLevel detectedSimdLevel = detectSimdLevel();
+
+        simdLevel = std::min(simdLevel, detectedSimdLevel);
+
+        if (simdLevel == kSimdAVX2)
+        {
+          return *detail::getPcgKernelsAVX2<T>();
+        }
+        if (simdLevel == kSimdSSE2)
+        {
+          return *detail::getPcgKernelsSSE2<T>();
+        }
+
+        return getPcgKernelsScalar<T>();
+      }
+    }
+
+    SimdLevel detectSimdLevel()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+      int info[4];
+
+      __cpuid(info, 0);
+      const int maxLeaf = info[0];
+
+      __cpuid(info, 1);
+      const bool hasSSE2 = (info[3] & (1 << 26)) != 0;
+      const bool hasFMA = (info[2] & (1 << 12)) != 0;
+      const bool hasOSXSave = (info[2] & (1 << 27)) != 0;
+      const bool hasAVX = (info[2] & (1 << 28)) != 0;
+
+      bool hasAVX2 = false;
+
+      if (maxLeaf >= 7)
+      {
+        __cpuidex(info, 7, 0);
+        hasAVX2 = (info[1] & (1 << 5)) != 0;
+      }
+
+      const bool osSavesYmm = hasOSXSave && ((_xgetbv(0) & 0x6) == 0x6);
+
+      if (hasAVX && hasAVX2 && hasFMA && osSavesYmm && detail::getPcgKernelsAVX2<double>())
+      {
+        return kSimdAVX2;
+      }
+      if (hasSSE2 && detail::getPcgKernelsSSE2<double>())
+      {
+        return kSimdSSE2;
+      }
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+      __builtin_cpu_init();
+
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && detail::getPcgKernelsAVX2<double>())
+      {
+        return kSimdAVX2;
+      }
+      if (__builtin_cpu_supports("sse2") && detail::getPcgKernelsSSE2<double>())
+      {
+        return kSimdSSE2;
+      }
+#endif
+
+      return kSimdScalar;
+    }
+
+    template <> const PcgKernels<double>& getPcgKernels<double>(SimdLevel simdLevel)
+    {
+      return selectPcgKernels<double>(simdLevel);
+    }
+
+    template <> const PcgKernels<float>& getPcgKernels<float>(SimdLevel simdLevel)
+    {
+      return selectPcgKernels<float>(simdLevel);
+    }
+  }
+}
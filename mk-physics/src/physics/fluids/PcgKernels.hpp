@@ -0,0 +1,87 @@
+#ifndef SRC_PHYSICS_FLUIDS_PCGKERNELS_H_
+#define SRC_PHYSICS_FLUIDS_PCGKERNELS_H_
+
+namespace mk
+{
+  namespace physics
+  {
+    enum SimdLevel
+    {
+      kSimdScalar = 0,
+      kSimdSSE2,
+      kSimdAVX2
+    };
+
+    /**
+     * 5-point stencil of the pressure system stored over the compacted list of fluid cells.
+     *
+     * Element k of each array refers to the k-th fluid cell. Neighbour indices refer to the same list, and point to
+     * an extra trailing slot (index numFluidCells) when the neighbour is not a fluid cell. That slot must hold 0 in
+     * every coefficient array and in every vector the stencil is applied to.
+     *
+     * @tparam T Storage type of the coefficients (float or double).
+     */
+    template <typename T> struct PcgStencil
+    {
+      const T* coefDiag;
+      const T* coefPlusI;
+      const T* coefPlusJ;
+      const int* neighbourMinusI;
+      const int* neighbourPlusI;
+      const int* neighbourMinusJ;
+      const int* neighbourPlusJ;
+    };
+
+    /**
+     * Set of fused vector kernels used by the PCG pressure solver of FLIPSolver2D.
+     *
+     * Each kernel performs in a single pass over memory what would otherwise take several passes. All of them
+     * work on a range of elements, so that the caller can split the work among several threads.
+     * Pointers do not need to be aligned, although aligned storage gives better performance.
+     *
+     * @tparam T Storage type of the vectors (float or double). Reductions are always accumulated in double.
+     */
+    template <typename T> struct PcgKernels
+    {
+      /**
+       * @return Sum of a[i] * b[i] for i in [0, n).
+       */
+      double (*dot)(const T* a, const T* b, int n);
+
+      /**
+       * Computes p += alpha * s and r -= alpha * z.
+       *
+       * @return Max norm of the updated r.
+       */
+      double (*axpyMaxNorm)(double alpha, const T* s, const T* z, T* p, T* r, int n);
+
+      /**
+       * Computes s = z + beta * s.
+       */
+      void (*xpby)(const T* z, double beta, T* s, int n);
+
+      /**
+       * Computes z = A s for the fluid cells in [begin, end), A being the given stencil.
+       *
+       * @return Sum of s[k] * z[k] over the processed cells.
+       */
+      double (*applyStencilDot)(const PcgStencil<T>& stencil, const T* s, T* z, int begin, int end);
+    };
+
+    /**
+     * @return Highest SIMD instruction set supported by both the CPU and the build.
+     */
+    SimdLevel detectSimdLevel();
+
+    /**
+     * @param simdLevel Requested instruction set. It is lowered to the detected one if not supported.
+     * @return Kernels implemented with the given instruction set.
+     */
+    template <typename T> const PcgKernels<T>& getPcgKernels(SimdLevel simdLevel);
+
+    template <> const PcgKernels<double>& getPcgKernels<double>(SimdLevel simdLevel);
+    template <> const PcgKernels<float>& getPcgKernels<float>(SimdLevel simdLevel);
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_PCGKERNELS_H_
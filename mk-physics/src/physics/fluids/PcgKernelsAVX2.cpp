@@ -0,0 +1,363 @@
+#include "PcgKernelsDetail.hpp"
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+
+#include <immintrin.h>
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      // Local instead of std::max and std::fabs, whose inline definitions could otherwise be shared with the
+      // files not compiled for this instruction set
+      template <typename T> T maxAbs(T maxNorm, T value)
+      {
+        const T absValue = value < T(0) ? -value : value;
+        return absValue > maxNorm ? absValue : maxNorm;
+      }
+
+      double horizontalSum(__m256d v)
+      {
+        const __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+      }
+
+      double horizontalMax(__m256d v)
+      {
+        const __m128d max = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_max_sd(max, _mm_unpackhi_pd(max, max)));
+      }
+
+      double dotAVX2(const double* a, const double* b, int n)
+      {
+        __m256d acc0 = _mm256_setzero_pd();
+        __m256d acc1 = _mm256_setzero_pd();
+
+        int i = 0;
+
+        for (; i + 8 <= n; i += 8)
+        {
+          acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+          acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+        }
+
+        double result = horizontalSum(_mm256_add_pd(acc0, acc1));
+
+        for (; i < n; i++)
+        {
+          result += a[i] * b[i];
+        }
+
+        return result;
+      }
+
+      double axpyMaxNormAVX2(double alpha, const double* s, const double* z, double* p, double* r, int n)
+      {
+        const __m256d alphaV = _mm256_set1_pd(alpha);
+        const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+
+        __m256d maxNormV = _mm256_setzero_pd();
+
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4)
+        {
+          const __m256d pV = _mm256_fmadd_pd(alphaV, _mm256_loadu_pd(s + i), _mm256_loadu_pd(p + i));
+          const __m256d rV = _mm256_fnmadd_pd(alphaV, _mm256_loadu_pd(z + i), _mm256_loadu_pd(r + i));
+
+          _mm256_storeu_pd(p + i, pV);
+          _mm256_storeu_pd(r + i, rV);
+
+          maxNormV = _mm256_max_pd(maxNormV, _mm256_and_pd(rV, absMask));
+        }
+
+        double maxNorm = horizontalMax(maxNormV);
+
+        for (; i < n; i++)
+        {
+          p[i] += alpha * s[i];
+          r[i] -= alpha * z[i];
+
+          maxNorm = maxAbs(maxNorm, r[i]);
+        }
+
+        return maxNorm;
+      }
+
+      void xpbyAVX2(const double* z, double beta, double* s, int n)
+      {
+        const __m256d betaV = _mm256_set1_pd(beta);
+
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4)
+        {
+          _mm256_storeu_pd(s + i, _mm256_fmadd_pd(betaV, _mm256_loadu_pd(s + i), _mm256_loadu_pd(z + i)));
+        }
+
+        for (; i < n; i++)
+        {
+          s[i] = z[i] + beta * s[i];
+        }
+      }
+
+      // The masked gathers with a zeroed source and a full mask load the same lanes as the unmasked ones, which
+      // start from an undefined register and make the compiler warn about an uninitialized value
+      __m256d gather(const double* base, __m128i indices)
+      {
+        const __m256d mask = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, indices, mask, 8);
+      }
+
+      __m256d gather(const double* base, const int* indices)
+      {
+        return gather(base, _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices)));
+      }
+
+      double applyStencilDotAVX2(const PcgStencil<double>& stencil, const double* s, double* z, int begin, int end)
+      {
+        __m256d sumV = _mm256_setzero_pd();
+
+        int k = begin;
+
+        for (; k + 4 <= end; k += 4)
+        {
+          const __m128i minusI = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stencil.neighbourMinusI + k));
+          const __m128i minusJ = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stencil.neighbourMinusJ + k));
+
+          const __m256d sV = _mm256_loadu_pd(s + k);
+
+          __m256d t = _mm256_mul_pd(_mm256_loadu_pd(stencil.coefDiag + k), sV);
+          t = _mm256_fmadd_pd(gather(stencil.coefPlusI, minusI), gather(s, minusI), t);
+          t = _mm256_fmadd_pd(gather(stencil.coefPlusJ, minusJ), gather(s, minusJ), t);
+          t = _mm256_fmadd_pd(_mm256_loadu_pd(stencil.coefPlusI + k), gather(s, stencil.neighbourPlusI + k), t);
+          t = _mm256_fmadd_pd(_mm256_loadu_pd(stencil.coefPlusJ + k), gather(s, stencil.neighbourPlusJ + k), t);
+
+          _mm256_storeu_pd(z + k, t);
+          sumV = _mm256_fmadd_pd(t, sV, sumV);
+        }
+
+        double sum = horizontalSum(sumV);
+
+        for (; k < end; k++)
+        {
+          sum += detail::applyStencilCell(stencil, s, z, k);
+        }
+
+        return sum;
+      }
+
+      const PcgKernels<double> kPcgKernelsAVX2 =
+      {
+        dotAVX2,
+        axpyMaxNormAVX2,
+        xpbyAVX2,
+        applyStencilDotAVX2
+      };
+
+      __m256d lowToDouble(__m256 v)
+      {
+        return _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+      }
+
+      __m256d highToDouble(__m256 v)
+      {
+        return _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+      }
+
+      float horizontalMax(__m256 v)
+      {
+        __m128 max = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+        return _mm_cvtss_f32(_mm_max_ss(max, _mm_shuffle_ps(max, max, 1)));
+      }
+
+      double dotAVX2(const float* a, const float* b, int n)
+      {
+        __m256d acc0 = _mm256_setzero_pd();
+        __m256d acc1 = _mm256_setzero_pd();
+
+        int i = 0;
+
+        for (; i + 8 <= n; i += 8)
+        {
+          const __m256 aV = _mm256_loadu_ps(a + i);
+          const __m256 bV = _mm256_loadu_ps(b + i);
+
+          acc0 = _mm256_fmadd_pd(lowToDouble(aV), lowToDouble(bV), acc0);
+          acc1 = _mm256_fmadd_pd(highToDouble(aV), highToDouble(bV), acc1);
+        }
+
+        double result = horizontalSum(_mm256_add_pd(acc0, acc1));
+
+        for (; i < n; i++)
+        {
+          result += static_cast<double>(a[i]) * static_cast<double>(b[i]);
+        }
+
+        return result;
+      }
+
+      double axpyMaxNormAVX2(double alpha, const float* s, const float* z, float* p, float* r, int n)
+      {
+        const float alphaF = static_cast<float>(alpha);
+        const __m256 alphaV = _mm256_set1_ps(alphaF);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+        __m256 maxNormV = _mm256_setzero_ps();
+
+        int i = 0;
+
+        for (; i + 8 <= n; i += 8)
+        {
+          const __m256 pV = _mm256_fmadd_ps(alphaV, _mm256_loadu_ps(s + i), _mm256_loadu_ps(p + i));
+          const __m256 rV = _mm256_fnmadd_ps(alphaV, _mm256_loadu_ps(z + i), _mm256_loadu_ps(r + i));
+
+          _mm256_storeu_ps(p + i, pV);
+          _mm256_storeu_ps(r + i, rV);
+
+          maxNormV = _mm256_max_ps(maxNormV, _mm256_and_ps(rV, absMask));
+        }
+
+        float maxNorm = horizontalMax(maxNormV);
+
+        for (; i < n; i++)
+        {
+          p[i] += alphaF * s[i];
+          r[i] -= alphaF * z[i];
+
+          maxNorm = maxAbs(maxNorm, r[i]);
+        }
+
+        return maxNorm;
+      }
+
+      void xpbyAVX2(const float* z, double beta, float* s, int n)
+      {
+        const float betaF = static_cast<float>(beta);
+        const __m256 betaV = _mm256_set1_ps(betaF);
+
+        int i = 0;
+
+        for (; i + 8 <= n; i += 8)
+        {
+          _mm256_storeu_ps(s + i, _mm256_fmadd_ps(betaV, _mm256_loadu_ps(s + i), _mm256_loadu_ps(z + i)));
+        }
+
+        for (; i < n; i++)
+        {
+          s[i] = z[i] + betaF * s[i];
+        }
+      }
+
+      __m256 gather(const float* base, __m256i indices)
+      {
+        const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, indices, mask, 4);
+      }
+
+      __m256 gather(const float* base, const int* indices)
+      {
+        return gather(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices)));
+      }
+
+      double applyStencilDotAVX2(const PcgStencil<float>& stencil, const float* s, float* z, int begin, int end)
+      {
+        __m256d sumV = _mm256_setzero_pd();
+
+        int k = begin;
+
+        for (; k + 8 <= end; k += 8)
+        {
+          const __m256i minusI = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stencil.neighbourMinusI + k));
+          const __m256i minusJ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stencil.neighbourMinusJ + k));
+
+          const __m256 sV = _mm256_loadu_ps(s + k);
+
+          // The products are summed in double like the dot products, four cells per register
+
+          const __m256 coefs[] = { _mm256_loadu_ps(stencil.coefDiag + k),
+                                   gather(stencil.coefPlusI, minusI),
+                                   gather(stencil.coefPlusJ, minusJ),
+                                   _mm256_loadu_ps(stencil.coefPlusI + k),
+                                   _mm256_loadu_ps(stencil.coefPlusJ + k) };
+          const __m256 values[] = { sV,
+                                    gather(s, minusI),
+                                    gather(s, minusJ),
+                                    gather(s, stencil.neighbourPlusI + k),
+                                    gather(s, stencil.neighbourPlusJ + k) };
+
+          __m256d tLow = _mm256_mul_pd(lowToDouble(coefs[0]), lowToDouble(values[0]));
+          __m256d tHigh = _mm256_mul_pd(highToDouble(coefs[0]), highToDouble(values[0]));
+
+          for (int n = 1; n < 5; n++)
+          {
+            tLow = _mm256_fmadd_pd(lowToDouble(coefs[n]), lowToDouble(values[n]), tLow);
+            tHigh = _mm256_fmadd_pd(highToDouble(coefs[n]), highToDouble(values[n]), tHigh);
+          }
+
+          const __m256 t = _mm256_castps128_ps256(_mm256_cvtpd_ps(tLow));
+
+          _mm256_storeu_ps(z + k, _mm256_insertf128_ps(t, _mm256_cvtpd_ps(tHigh), 1));
+          sumV = _mm256_fmadd_pd(tLow, lowToDouble(sV), sumV);
+          sumV = _mm256_fmadd_pd(tHigh, highToDouble(sV), sumV);
+        }
+
+        double sum = horizontalSum(sumV);
+
+        for (; k < end; k++)
+        {
+          sum += detail::applyStencilCell(stencil, s, z, k);
+        }
+
+        return sum;
+      }
+
+      const PcgKernels<float> kPcgKernelsAVX2Float =
+      {
+        dotAVX2,
+        axpyMaxNormAVX2,
+        xpbyAVX2,
+        applyStencilDotAVX2
+      };
+    }
+
+    namespace detail
+    {
+      template <> const PcgKernels<double>* getPcgKernelsAVX2<double>()
+      {
+        return &kPcgKernelsAVX2;
+      }
+
+      template <> const PcgKernels<float>* getPcgKernelsAVX2<float>()
+      {
+        return &kPcgKernelsAVX2Float;
+      }
+    }
+  }
+}
+
+#else
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace detail
+    {
+      template <> const PcgKernels<double>* getPcgKernelsAVX2<double>()
+      {
+        return nullptr;
+      }
+
+      template <> const PcgKernels<float>* getPcgKernelsAVX2<float>()
+      {
+        return nullptr;
+      }
+    }
+  }
+}
+
+#endif
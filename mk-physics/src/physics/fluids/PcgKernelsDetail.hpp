@@ -0,0 +1,61 @@
+#ifndef SRC_PHYSICS_FLUIDS_PCGKERNELSDETAIL_H_
+#define SRC_PHYSICS_FLUIDS_PCGKERNELSDETAIL_H_
+
+#include "PcgKernels.hpp"
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace detail
+    {
+      /**
+       * @return SSE2 kernels, or nullptr if they were not compiled in.
+       */
+      template <typename T> const PcgKernels<T>* getPcgKernelsSSE2();
+
+      template <> const PcgKernels<double>* getPcgKernelsSSE2<double>();
+      template <> const PcgKernels<float>* getPcgKernelsSSE2<float>();
+
+      /**
+       * @return AVX2 kernels, or nullptr if they were not compiled in.
+       */
+      template <typename T> const PcgKernels<T>* getPcgKernelsAVX2();
+
+      template <> const PcgKernels<double>* getPcgKernelsAVX2<double>();
+      template <> const PcgKernels<float>* getPcgKernelsAVX2<float>();
+
+      // The helpers below have internal linkage, so each kernel file gets its own copy compiled with its own
+      // instruction set instead of sharing a single one picked by the linker.
+      namespace
+      {
+        /**
+         * Applies the stencil to a single fluid cell. Used for the cells that do not fill a whole SIMD register.
+         * The row is summed in double also for float storage, only the stored result is rounded to T.
+         *
+         * @return s[k] * z[k]
+         */
+        template <typename T>
+        double applyStencilCell(const PcgStencil<T>& stencil, const T* s, T* z, int k)
+        {
+          const int minusI = stencil.neighbourMinusI[k];
+          const int minusJ = stencil.neighbourMinusJ[k];
+          const int plusI = stencil.neighbourPlusI[k];
+          const int plusJ = stencil.neighbourPlusJ[k];
+
+          const double t = static_cast<double>(stencil.coefDiag[k]) * static_cast<double>(s[k]) +
+                           static_cast<double>(stencil.coefPlusI[minusI]) * static_cast<double>(s[minusI]) +
+                           static_cast<double>(stencil.coefPlusJ[minusJ]) * static_cast<double>(s[minusJ]) +
+                           static_cast<double>(stencil.coefPlusI[k]) * static_cast<double>(s[plusI]) +
+                           static_cast<double>(stencil.coefPlusJ[k]) * static_cast<double>(s[plusJ]);
+
+          z[k] = static_cast<T>(t);
+
+          return t * static_cast<double>(s[k]);
+        }
+      }
+    }
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_PCGKERNELSDETAIL_H_
@@ -0,0 +1,345 @@
+#include "PcgKernelsDetail.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      // Local instead of std::max and std::fabs, whose inline definitions could otherwise be shared with the
+      // files not compiled for this instruction set
+      template <typename T> T maxAbs(T maxNorm, T value)
+      {
+        const T absValue = value < T(0) ? -value : value;
+        return absValue > maxNorm ? absValue : maxNorm;
+      }
+
+      double horizontalSum(__m128d v)
+      {
+        return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+      }
+
+      double horizontalMax(__m128d v)
+      {
+        return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v)));
+      }
+
+      double dotSSE2(const double* a, const double* b, int n)
+      {
+        __m128d acc0 = _mm_setzero_pd();
+        __m128d acc1 = _mm_setzero_pd();
+
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4)
+        {
+          acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+          acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        }
+
+        double result = horizontalSum(_mm_add_pd(acc0, acc1));
+
+        for (; i < n; i++)
+        {
+          result += a[i] * b[i];
+        }
+
+        return result;
+      }
+
+      double axpyMaxNormSSE2(double alpha, const double* s, const double* z, double* p, double* r, int n)
+      {
+        const __m128d alphaV = _mm_set1_pd(alpha);
+        const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+
+        __m128d maxNormV = _mm_setzero_pd();
+
+        int i = 0;
+
+        for (; i + 2 <= n; i += 2)
+        {
+          const __m128d pV = _mm_add_pd(_mm_loadu_pd(p + i), _mm_mul_pd(alphaV, _mm_loadu_pd(s + i)));
+          const __m128d rV = _mm_sub_pd(_mm_loadu_pd(r + i), _mm_mul_pd(alphaV, _mm_loadu_pd(z + i)));
+
+          _mm_storeu_pd(p + i, pV);
+          _mm_storeu_pd(r + i, rV);
+
+          maxNormV = _mm_max_pd(maxNormV, _mm_and_pd(rV, absMask));
+        }
+
+        double maxNorm = horizontalMax(maxNormV);
+
+        for (; i < n; i++)
+        {
+          p[i] += alpha * s[i];
+          r[i] -= alpha * z[i];
+
+          maxNorm = maxAbs(maxNorm, r[i]);
+        }
+
+        return maxNorm;
+      }
+
+      void xpbySSE2(const double* z, double beta, double* s, int n)
+      {
+        const __m128d betaV = _mm_set1_pd(beta);
+
+        int i = 0;
+
+        for (; i + 2 <= n; i += 2)
+        {
+          _mm_storeu_pd(s + i, _mm_add_pd(_mm_loadu_pd(z + i), _mm_mul_pd(betaV, _mm_loadu_pd(s + i))));
+        }
+
+        for (; i < n; i++)
+        {
+          s[i] = z[i] + beta * s[i];
+        }
+      }
+
+      __m128d gather(const double* base, const int* indices)
+      {
+        return _mm_set_pd(base[indices[1]], base[indices[0]]);
+      }
+
+      double applyStencilDotSSE2(const PcgStencil<double>& stencil, const double* s, double* z, int begin, int end)
+      {
+        __m128d sumV = _mm_setzero_pd();
+
+        int k = begin;
+
+        for (; k + 2 <= end; k += 2)
+        {
+          const int* minusI = stencil.neighbourMinusI + k;
+          const int* minusJ = stencil.neighbourMinusJ + k;
+
+          const __m128d sV = _mm_loadu_pd(s + k);
+
+          __m128d t = _mm_mul_pd(_mm_loadu_pd(stencil.coefDiag + k), sV);
+          t = _mm_add_pd(t, _mm_mul_pd(gather(stencil.coefPlusI, minusI), gather(s, minusI)));
+          t = _mm_add_pd(t, _mm_mul_pd(gather(stencil.coefPlusJ, minusJ), gather(s, minusJ)));
+          t = _mm_add_pd(t, _mm_mul_pd(_mm_loadu_pd(stencil.coefPlusI + k), gather(s, stencil.neighbourPlusI + k)));
+          t = _mm_add_pd(t, _mm_mul_pd(_mm_loadu_pd(stencil.coefPlusJ + k), gather(s, stencil.neighbourPlusJ + k)));
+
+          _mm_storeu_pd(z + k, t);
+          sumV = _mm_add_pd(sumV, _mm_mul_pd(t, sV));
+        }
+
+        double sum = horizontalSum(sumV);
+
+        for (; k < end; k++)
+        {
+          sum += detail::applyStencilCell(stencil, s, z, k);
+        }
+
+        return sum;
+      }
+
+      const PcgKernels<double> kPcgKernelsSSE2 =
+      {
+        dotSSE2,
+        axpyMaxNormSSE2,
+        xpbySSE2,
+        applyStencilDotSSE2
+      };
+
+      __m128d lowToDouble(__m128 v)
+      {
+        return _mm_cvtps_pd(v);
+      }
+
+      __m128d highToDouble(__m128 v)
+      {
+        return _mm_cvtps_pd(_mm_movehl_ps(v, v));
+      }
+
+      float horizontalMax(__m128 v)
+      {
+        const __m128 max = _mm_max_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_max_ss(max, _mm_shuffle_ps(max, max, 1)));
+      }
+
+      double dotSSE2(const float* a, const float* b, int n)
+      {
+        __m128d acc0 = _mm_setzero_pd();
+        __m128d acc1 = _mm_setzero_pd();
+
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4)
+        {
+          const __m128 aV = _mm_loadu_ps(a + i);
+          const __m128 bV = _mm_loadu_ps(b + i);
+
+          acc0 = _mm_add_pd(acc0, _mm_mul_pd(lowToDouble(aV), lowToDouble(bV)));
+          acc1 = _mm_add_pd(acc1, _mm_mul_pd(highToDouble(aV), highToDouble(bV)));
+        }
+
+        double result = horizontalSum(_mm_add_pd(acc0, acc1));
+
+        for (; i < n; i++)
+        {
+          result += static_cast<double>(a[i]) * static_cast<double>(b[i]);
+        }
+
+        return result;
+      }
+
+      double axpyMaxNormSSE2(double alpha, const float* s, const float* z, float* p, float* r, int n)
+      {
+        const float alphaF = static_cast<float>(alpha);
+        const __m128 alphaV = _mm_set1_ps(alphaF);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+        __m128 maxNormV = _mm_setzero_ps();
+
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4)
+        {
+          const __m128 pV = _mm_add_ps(_mm_loadu_ps(p + i), _mm_mul_ps(alphaV, _mm_loadu_ps(s + i)));
+          const __m128 rV = _mm_sub_ps(_mm_loadu_ps(r + i), _mm_mul_ps(alphaV, _mm_loadu_ps(z + i)));
+
+          _mm_storeu_ps(p + i, pV);
+          _mm_storeu_ps(r + i, rV);
+
+          maxNormV = _mm_max_ps(maxNormV, _mm_and_ps(rV, absMask));
+        }
+
+        float maxNorm = horizontalMax(maxNormV);
+
+        for (; i < n; i++)
+        {
+          p[i] += alphaF * s[i];
+          r[i] -= alphaF * z[i];
+
+          maxNorm = maxAbs(maxNorm, r[i]);
+        }
+
+        return maxNorm;
+      }
+
+      void xpbySSE2(const float* z, double beta, float* s, int n)
+      {
+        const float betaF = static_cast<float>(beta);
+        const __m128 betaV = _mm_set1_ps(betaF);
+
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4)
+        {
+          _mm_storeu_ps(s + i, _mm_add_ps(_mm_loadu_ps(z + i), _mm_mul_ps(betaV, _mm_loadu_ps(s + i))));
+        }
+
+        for (; i < n; i++)
+        {
+          s[i] = z[i] + betaF * s[i];
+        }
+      }
+
+      __m128 gather(const float* base, const int* indices)
+      {
+        return _mm_set_ps(base[indices[3]], base[indices[2]], base[indices[1]], base[indices[0]]);
+      }
+
+      double applyStencilDotSSE2(const PcgStencil<float>& stencil, const float* s, float* z, int begin, int end)
+      {
+        __m128d sumV = _mm_setzero_pd();
+
+        int k = begin;
+
+        for (; k + 4 <= end; k += 4)
+        {
+          const int* minusI = stencil.neighbourMinusI + k;
+          const int* minusJ = stencil.neighbourMinusJ + k;
+
+          const __m128 sV = _mm_loadu_ps(s + k);
+
+          // The products are summed in double like the dot products, two cells per register
+
+          const __m128 coefs[] = { _mm_loadu_ps(stencil.coefDiag + k),
+                                   gather(stencil.coefPlusI, minusI),
+                                   gather(stencil.coefPlusJ, minusJ),
+                                   _mm_loadu_ps(stencil.coefPlusI + k),
+                                   _mm_loadu_ps(stencil.coefPlusJ + k) };
+          const __m128 values[] = { sV,
+                                    gather(s, minusI),
+                                    gather(s, minusJ),
+                                    gather(s, stencil.neighbourPlusI + k),
+                                    gather(s, stencil.neighbourPlusJ + k) };
+
+          __m128d tLow = _mm_mul_pd(lowToDouble(coefs[0]), lowToDouble(values[0]));
+          __m128d tHigh = _mm_mul_pd(highToDouble(coefs[0]), highToDouble(values[0]));
+
+          for (int n = 1; n < 5; n++)
+          {
+            tLow = _mm_add_pd(tLow, _mm_mul_pd(lowToDouble(coefs[n]), lowToDouble(values[n])));
+            tHigh = _mm_add_pd(tHigh, _mm_mul_pd(highToDouble(coefs[n]), highToDouble(values[n])));
+          }
+
+          _mm_storeu_ps(z + k, _mm_movelh_ps(_mm_cvtpd_ps(tLow), _mm_cvtpd_ps(tHigh)));
+          sumV = _mm_add_pd(sumV, _mm_mul_pd(tLow, lowToDouble(sV)));
+          sumV = _mm_add_pd(sumV, _mm_mul_pd(tHigh, highToDouble(sV)));
+        }
+
+        double sum = horizontalSum(sumV);
+
+        for (; k < end; k++)
+        {
+          sum += detail::applyStencilCell(stencil, s, z, k);
+        }
+
+        return sum;
+      }
+
+      const PcgKernels<float> kPcgKernelsSSE2Float =
+      {
+        dotSSE2,
+        axpyMaxNormSSE2,
+        xpbySSE2,
+        applyStencilDotSSE2
+      };
+    }
+
+    namespace detail
+    {
+      template <> const PcgKernels<double>* getPcgKernelsSSE2<double>()
+      {
+        return &kPcgKernelsSSE2;
+      }
+
+      template <> const PcgKernels<float>* getPcgKernelsSSE2<float>()
+      {
+        return &kPcgKernelsSSE2Float;
+      }
+    }
+  }
+}
+
+#else
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace detail
+    {
+      template <> const PcgKernels<double>* getPcgKernelsSSE2<double>()
+      {
+        return nullptr;
+      }
+
+      template <> const PcgKernels<float>* getPcgKernelsSSE2<float>()
+      {
+        return nullptr;
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,311 @@
+#include "SolverStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace mk
+{
+  namespace physics
+  {
+    namespace
+    {
+      const int kDefaultCapacity = 4096;
+      const double kPercentile = 0.99;
+
+      const char* const kStageNames[kSolverStageCount] = { "advection",
+                                                           "sort",
+                                                           "particles_to_grid",
+                                                           "grid_update",
+                                                           "distance",
+                                                           "extrapolation",
+                                                           "pressure",
+                                                           "grid_to_particles" };
+
+      double elapsedMs(std::chrono::steady_clock::time_point start)
+      {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      }
+
+      void writeJsonNumber(std::ostream& out, double value)
+      {
+        // JSON has no representation for infinities and NaN
+
+        if (std::isfinite(value))
+        {
+          out << value;
+        }
+        else
+        {
+          out << "null";
+        }
+      }
+
+      void writeJsonTimings(std::ostream& out, const char* name, const SolverStageTimings& timings)
+      {
+        out << "\"" << name << "\": { \"samples\": " << timings.samples
+            << ", \"min_ms\": " << timings.minMs
+            << ", \"mean_ms\": " << timings.meanMs
+            << ", \"p99_ms\": " << timings.p99Ms
+            << ", \"max_ms\": " << timings.maxMs
+            << ", \"total_ms\": " << timings.totalMs << " }";
+      }
+    }
+
+    const char* getSolverStageName(SolverStage stage)
+    {
+      return kStageNames[stage];
+    }
+
+    SolverStats::SolverStats()
+    : mCapacity(kDefaultCapacity),
+      mNextStep(0),
+      mCurrentStep(),
+      mStepStart(),
+      mSteps()
+    {
+    }
+
+    void SolverStats::setCapacity(int capacity)
+    {
+      mCapacity = std::max(1, capacity);
+
+      while (static_cast<int>(mSteps.size()) > mCapacity)
+      {
+        mSteps.pop_front();
+      }
+    }
+
+    int SolverStats::getCapacity() const
+    {
+      return mCapacity;
+    }
+
+    void SolverStats::clear()
+    {
+      mSteps.clear();
+    }
+
+    void SolverStats::beginStep(float dt, int frame, int substep, float cfl)
+    {
+      mCurrentStep = SolverStepStats();
+      mCurrentStep.step = mNextStep++;
+      mCurrentStep.frame = frame;
+      mCurrentStep.substep = substep;
+      mCurrentStep.dt = dt;
+      mCurrentStep.cfl = cfl;
+      mStepStart = Clock::now();
+    }
+
+    void SolverStats::addStageTime(SolverStage stage, double ms)
+    {
+      mCurrentStep.stageMs[stage] += ms;
+    }
+
+    void SolverStats::endStep(int numParticles, int numFluidCells, int pcgIterations, double pcgResidual,
+                              float activeTileRatio)
+    {
+      mCurrentStep.numParticles = numParticles;
+      mCurrentStep.numFluidCells = numFluidCells;
+      mCurrentStep.pcgIterations = pcgIterations;
+      mCurrentStep.pcgResidual = pcgResidual;
+      mCurrentStep.activeTileRatio = activeTileRatio;
+      mCurrentStep.totalMs = elapsedMs(mStepStart);
+
+      if (static_cast<int>(mSteps.size()) == mCapacity)
+      {
+        mSteps.pop_front();
+      }
+
+      mSteps.push_back(mCurrentStep);
+    }
+
+    int SolverStats::getNumSteps() const
+    {
+      return static_cast<int>(mSteps.size());
+    }
+
+    const SolverStepStats& SolverStats::getStep(int index) const
+    {
+      return mSteps[index];
+    }
+
+    template <typename Getter> SolverStageTimings SolverStats::aggregate(Getter getter) const
+    {
+      SolverStageTimings timings = SolverStageTimings();
+
+      if (mSteps.empty())
+      {
+        return timings;
+      }
+
+      std::vector<double> samples;
+      samples.reserve(mSteps.size());
+
+      for (const SolverStepStats& step : mSteps)
+      {
+        samples.push_back(getter(step));
+      }
+
+      const int numSamples = static_cast<int>(samples.size());
+
+      timings.samples = numSamples;
+      timings.minMs = *std::min_element(samples.begin(), samples.end());
+      timings.maxMs = *std::max_element(samples.begin(), samples.end());
+
+      for (double sample : samples)
+      {
+        timings.totalMs += sample;
+      }
+
+      timings.meanMs = timings.totalMs / numSamples;
+
+      // Nearest rank percentile
+
+      const int rank = std::max(0, static_cast<int>(std::ceil(kPercentile * numSamples)) - 1);
+      std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+      timings.p99Ms = samples[rank];
+
+      return timings;
+    }
+
+    SolverStageTimings SolverStats::getStageTimings(SolverStage stage) const
+    {
+      return aggregate([stage](const SolverStepStats& step) { return step.stageMs[stage]; });
+    }
+
+    SolverStageTimings SolverStats::getStepTimings() const
+    {
+      return aggregate([](const SolverStepStats& step) { return step.totalMs; });
+    }
+
+    SolverSubstepStats SolverStats::getSubstepStats() const
+    {
+      SolverSubstepStats substeps = SolverSubstepStats();
+
+      // The steps of a frame are consecutive, so every run of steps with the same frame is one frame
+
+      int totalSubsteps = 0;
+      std::size_t n = 0;
+
+      while (n < mSteps.size())
+      {
+        const int frame = mSteps[n].frame;
+        const std::size_t first = n;
+
+        while ((n < mSteps.size()) && (mSteps[n].frame == frame))
+        {
+          ++n;
+        }
+
+        if (frame < 0)
+        {
+          continue;
+        }
+
+        const int count = static_cast<int>(n - first);
+
+        substeps.minSubsteps = (substeps.frames == 0) ? count : std::min(substeps.minSubsteps, count);
+        substeps.maxSubsteps = std::max(substeps.maxSubsteps, count);
+        totalSubsteps += count;
+        ++substeps.frames;
+      }
+
+      if (substeps.frames > 0)
+      {
+        substeps.meanSubsteps = static_cast<double>(totalSubsteps) / substeps.frames;
+      }
+
+      return substeps;
+    }
+
+    void SolverStats::writeCsv(std::ostream& out) const
+    {
+      out << "step,frame,substep,dt,cfl,particles,fluid_cells,pcg_iterations,pcg_residual,active_tile_ratio";
+
+      for (int s = 0; s < kSolverStageCount; s++)
+      {
+        out << "," << kStageNames[s] << "_ms";
+      }
+
+      out << ",total_ms\n";
+
+      for (const SolverStepStats& step : mSteps)
+      {
+        out << step.step << "," << step.frame << "," << step.substep << "," << step.dt << "," << step.cfl << ","
+            << step.numParticles << "," << step.numFluidCells << "," << step.pcgIterations << ","
+            << step.pcgResidual << "," << step.activeTileRatio;
+
+        for (int s = 0; s < kSolverStageCount; s++)
+        {
+          out << "," << step.stageMs[s];
+        }
+
+        out << "," << step.totalMs << "\n";
+      }
+    }
+
+    void SolverStats::writeJson(std::ostream& out) const
+    {
+      out << "{\n  \"stages\": {\n";
+
+      for (int s = 0; s < kSolverStageCount; s++)
+      {
+        out << "    ";
+        writeJsonTimings(out, kStageNames[s], getStageTimings(static_cast<SolverStage>(s)));
+        out << ",\n";
+      }
+
+      out << "    ";
+      writeJsonTimings(out, "step", getStepTimings());
+
+      const SolverSubstepStats substeps = getSubstepStats();
+
+      out << "\n  },\n  \"substeps\": { \"frames\": " << substeps.frames
+          << ", \"min\": " << substeps.minSubsteps
+          << ", \"mean\": " << substeps.meanSubsteps
+          << ", \"max\": " << substeps.maxSubsteps << " },\n  \"steps\": [";
+
+      for (std::size_t n = 0; n < mSteps.size(); n++)
+      {
+        const SolverStepStats& step = mSteps[n];
+
+        out << ((n == 0) ? "\n" : ",\n")
+            << "    { \"step\": " << step.step
+            << ", \"frame\": " << step.frame
+            << ", \"substep\": " << step.substep
+            << ", \"dt\": " << step.dt
+            << ", \"cfl\": " << step.cfl
+            << ", \"particles\": " << step.numParticles
+            << ", \"fluid_cells\": " << step.numFluidCells
+            << ", \"pcg_iterations\": " << step.pcgIterations
+            << ", \"pcg_residual\": ";
+
+        writeJsonNumber(out, step.pcgResidual);
+
+        out << ", \"active_tile_ratio\": " << step.activeTileRatio << ", \"stage_ms\": {";
+
+        for (int s = 0; s < kSolverStageCount; s++)
+        {
+          out << ((s == 0) ? " \"" : ", \"") << kStageNames[s] << "\": " << step.stageMs[s];
+        }
+
+        out << " }, \"total_ms\": " << step.totalMs << " }";
+      }
+
+      out << (mSteps.empty() ? "]\n}\n" : "\n  ]\n}\n");
+    }
+
+    ScopedStageTimer::ScopedStageTimer(SolverStats& stats, SolverStage stage)
+    : mStats(stats),
+      mStage(stage),
+      mStart(std::chrono::steady_clock::now())
+    {
+    }
+
+    ScopedStageTimer::~ScopedStageTimer()
+    {
+      mStats.addStageTime(mStage, elapsedMs(mStart));
+    }
+  }
+}
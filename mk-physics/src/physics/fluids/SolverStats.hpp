@@ -0,0 +1,204 @@
+#ifndef SRC_PHYSICS_FLUIDS_SOLVERSTATS_H_
+#define SRC_PHYSICS_FLUIDS_SOLVERSTATS_H_
+
+#include <chrono>
+#include <deque>
+#include <ostream>
+
+#include "trace/TraceRecorder.hpp"
+#include "ExecutionPolicy.hpp"
+
+// Stage timers are only compiled in when MK_PHYSICS_PROFILING is defined, otherwise they expand to nothing and
+// the statistics stay empty. Stages are also traced when tracing is compiled in.
+#ifdef MK_PHYSICS_PROFILING
+#define MK_PHYSICS_CONCAT_IMPL(a, b) a##b
+#define MK_PHYSICS_CONCAT(a, b) MK_PHYSICS_CONCAT_IMPL(a, b)
+#define MK_PHYSICS_STAGE_TIMER(stats, stage) \
+  mk::physics::ScopedStageTimer MK_PHYSICS_CONCAT(stageTimer, __LINE__)(stats, stage)
+#else
+#define MK_PHYSICS_STAGE_TIMER(stats, stage)
+#endif
+
+#define MK_PHYSICS_PROFILE_STAGE(stats, stage) \
+  MK_PHYSICS_STAGE_TIMER(stats, stage);        \
+  MK_TRACE_SCOPE("fluids", mk::physics::getSolverStageName(stage))
+
+namespace mk
+{
+  namespace physics
+  {
+    /**
+     * Counters and stage times of a single simulation step.
+     */
+    struct SolverStepStats
+    {
+      int step;
+
+      /**
+       * Frame of FLIPSolver2D::advance that ran the step and index of the step in it, or -1 and 0 for steps run
+       * directly with FLIPSolver2D::simulate.
+       */
+      int frame;
+      int substep;
+
+      float dt;
+
+      /**
+       * CFL number of the step: the distance travelled by the fastest particle during it, in cells.
+       */
+      float cfl;
+
+      int numParticles;
+      int numFluidCells;
+      int pcgIterations;
+      double pcgResidual;
+      float activeTileRatio;
+      double stageMs[kSolverStageCount];
+      double totalMs;
+    };
+
+    /**
+     * Aggregated times of a stage over the recorded steps, in milliseconds.
+     */
+    struct SolverStageTimings
+    {
+      int samples;
+      double minMs;
+      double meanMs;
+      double p99Ms;
+      double maxMs;
+      double totalMs;
+    };
+
+    /**
+     * Number of substeps taken by the frames of FLIPSolver2D::advance in the history.
+     */
+    struct SolverSubstepStats
+    {
+      int frames;
+      int minSubsteps;
+      double meanSubsteps;
+      int maxSubsteps;
+    };
+
+    /**
+     * @return Name of a stage, in lower case with underscores, as used in the exported statistics.
+     */
+    const char* getSolverStageName(SolverStage stage);
+
+    /**
+     * Statistics of the last steps of a solver: time spent in every stage, pressure solver iterations and
+     * residual, and the number of particles and fluid cells.
+     *
+     * The history is bounded, so the oldest steps are dropped once the capacity is reached and long simulations
+     * do not grow the memory used. Recording is meant to be done by the solver from the thread calling
+     * simulate.
+     */
+    class SolverStats
+    {
+    public:
+      /**
+       * Creates empty statistics keeping up to a default number of steps.
+       */
+      SolverStats();
+
+      /**
+       * @param capacity Maximum number of steps kept. Values under 1 are clamped to 1.
+       */
+      void setCapacity(int capacity);
+      int getCapacity() const;
+
+      /**
+       * Drops every recorded step.
+       */
+      void clear();
+
+      /**
+       * Starts recording a new step, whose stage times start at 0.
+       *
+       * @param dt Time step being simulated.
+       * @param frame Frame the step belongs to, -1 if it is not part of one.
+       * @param substep Index of the step in its frame.
+       * @param cfl CFL number of the step.
+       */
+      void beginStep(float dt, int frame, int substep, float cfl);
+
+      /**
+       * Adds time to a stage of the step being recorded. A stage can be timed several times in the same step.
+       */
+      void addStageTime(SolverStage stage, double ms);
+
+      /**
+       * Finishes the step being recorded, measuring its total time, and adds it to the history.
+       */
+      void endStep(int numParticles, int numFluidCells, int pcgIterations, double pcgResidual, float activeTileRatio);
+
+      /**
+       * @return Number of steps in the history.
+       */
+      int getNumSteps() const;
+
+      /**
+       * @param index Index in the history, 0 being the oldest step kept.
+       */
+      const SolverStepStats& getStep(int index) const;
+
+      /**
+       * @return Times of a stage over the steps in the history.
+       */
+      SolverStageTimings getStageTimings(SolverStage stage) const;
+
+      /**
+       * @return Total times of the steps in the history.
+       */
+      SolverStageTimings getStepTimings() const;
+
+      /**
+       * @return Substeps of the frames in the history. The oldest frame may be counted short if some of its
+       * steps were already dropped.
+       */
+      SolverSubstepStats getSubstepStats() const;
+
+      /**
+       * Writes one row per step in the history, preceded by a header row.
+       */
+      void writeCsv(std::ostream& out) const;
+
+      /**
+       * Writes the aggregated times of every stage and the steps in the history as a JSON object.
+       */
+      void writeJson(std::ostream& out) const;
+
+    private:
+      typedef std::chrono::steady_clock Clock;
+
+      template <typename Getter> SolverStageTimings aggregate(Getter getter) const;
+
+    private:
+      int mCapacity;
+      int mNextStep;
+      SolverStepStats mCurrentStep;
+      Clock::time_point mStepStart;
+      std::deque<SolverStepStats> mSteps;
+    };
+
+    /**
+     * Adds the time between its construction and destruction to a stage of the step being recorded.
+     */
+    class ScopedStageTimer
+    {
+    public:
+      ScopedStageTimer(SolverStats& stats, SolverStage stage);
+      ScopedStageTimer(const ScopedStageTimer&) = delete;
+      ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+      ~ScopedStageTimer();
+
+    private:
+      SolverStats& mStats;
+      SolverStage mStage;
+      std::chrono::steady_clock::time_point mStart;
+    };
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_SOLVERSTATS_H_
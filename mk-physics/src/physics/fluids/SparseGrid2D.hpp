@@ -0,0 +1,381 @@
+#ifndef SRC_PHYSICS_FLUIDS_SPARSEGRID2D_H_
+#define SRC_PHYSICS_FLUIDS_SPARSEGRID2D_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace mk
+{
+  namespace physics
+  {
+    /**
+     * Grid stored as square tiles that are only allocated when written, so that its memory grows with the
+     * region that is actually used instead of with the whole domain.
+     *
+     * Tiles not allocated read as the background value. Released tiles return their block to a pool owned by the
+     * grid, so clearing and filling the grid again every step does not allocate memory. The list of allocated
+     * tiles works as activity mask, and lets loops visit only the tiles that hold data.
+     *
+     * Reading and writing allocated tiles from several threads is safe, allocating and releasing tiles is not.
+     *
+     * @tparam T Type of the values stored in each cell.
+     * @tparam TileSize Side of the tiles in cells.
+     */
+    template <typename T, int TileSize = 16> class SparseGrid2D
+    {
+    public:
+      static const int kTileSize = TileSize;
+      static const int kTileCells = kTileSize * kTileSize;
+
+    public:
+      /**
+       * Creates a grid without any tile allocated.
+       *
+       * @param width Width of the grid in cells.
+       * @param height Height of the grid in cells.
+       * @param background Value of the cells of tiles that are not allocated.
+       */
+      SparseGrid2D(int width, int height, const T& background);
+
+      int getWidth() const;
+      int getHeight() const;
+      int getTilesX() const;
+      int getTilesY() const;
+      int getNumTiles() const;
+      const T& getBackground() const;
+
+      /**
+       * Changes the value read from the tiles that are not allocated, and given to the ones allocated next.
+       */
+      void setBackground(const T& background);
+
+      /**
+       * @return Tile holding the cell (i, j).
+       */
+      int getTile(int i, int j) const;
+
+      /**
+       * @return Position of the cell (i, j) inside the data of its tile.
+       */
+      static int getTileOffset(int i, int j);
+
+      /**
+       * @return Value of the cell (i, j), or the background value if its tile is not allocated.
+       */
+      T get(int i, int j) const;
+
+      /**
+       * Reads the cells (i, j), (i + 1, j), (i, j + 1) and (i + 1, j + 1) as get does, looking up a single tile
+       * when all of them lie in the same one.
+       */
+      void get2x2(int i, int j, T& v00, T& v10, T& v01, T& v11) const;
+
+      /**
+       * @return Reference to the cell (i, j), allocating its tile if needed.
+       */
+      T& at(int i, int j);
+
+      /**
+       * @return Cells of the tile in row major order, or nullptr if the tile is not allocated.
+       */
+      T* getTileData(int tile);
+      const T* getTileData(int tile) const;
+
+      /**
+       * Sets every cell of the allocated tiles to the given value.
+       */
+      void fill(const T& value);
+
+      /**
+       * Writes every cell of the grid, background included, to a row major array of width * height elements.
+       */
+      void copyTo(T* values) const;
+
+      /**
+       * Allocates a tile, filled with the background value, if it is not already.
+       *
+       * @return Cells of the tile in row major order.
+       */
+      T* allocateTile(int tile);
+
+      /**
+       * Returns the block of a tile to the pool, so that its cells read as background again.
+       */
+      void releaseTile(int tile);
+
+      /**
+       * Releases every tile, keeping their blocks in the pool.
+       */
+      void clear();
+
+      /**
+       * @return Indices of the allocated tiles, in no particular order.
+       */
+      const std::vector<int>& getAllocatedTiles() const;
+
+      /**
+       * @return Bytes used by the blocks of the pool and the tile tables.
+       */
+      std::size_t getMemoryUsage() const;
+
+    private:
+      static const int kMaxBlocksPerChunk = 64;
+
+    private:
+      int mWidth;
+      int mHeight;
+      int mTilesX;
+      int mTilesY;
+      int mBlocksPerChunk;
+      T mBackground;
+      std::vector<T*> mTileData;
+      std::vector<int> mTileBlock;
+      std::vector<int> mTileListIndex;
+      std::vector<int> mAllocatedTiles;
+      std::vector<int> mFreeBlocks;
+      std::vector<std::unique_ptr<T[]> > mChunks;
+    };
+
+    template <typename T, int TileSize>
+    SparseGrid2D<T, TileSize>::SparseGrid2D(int width, int height, const T& background)
+    : mWidth(width),
+      mHeight(height),
+      mTilesX((width + kTileSize - 1) / kTileSize),
+      mTilesY((height + kTileSize - 1) / kTileSize),
+      mBlocksPerChunk(std::max(1, (mTilesX * mTilesY < kMaxBlocksPerChunk) ? (mTilesX * mTilesY) :
+                                                                              kMaxBlocksPerChunk)),
+      mBackground(background),
+      mTileData(mTilesX * mTilesY, nullptr),
+      mTileBlock(mTilesX * mTilesY, -1),
+      mTileListIndex(mTilesX * mTilesY, -1),
+      mAllocatedTiles(),
+      mFreeBlocks(),
+      mChunks()
+    {
+    }
+
+    template <typename T, int TileSize> int SparseGrid2D<T, TileSize>::getWidth() const
+    {
+      return mWidth;
+    }
+
+    template <typename T, int TileSize> int SparseGrid2D<T, TileSize>::getHeight() const
+    {
+      return mHeight;
+    }
+
+    template <typename T, int TileSize> int SparseGrid2D<T, TileSize>::getTilesX() const
+    {
+      return mTilesX;
+    }
+
+    template <typename T, int TileSize> int SparseGrid2D<T, TileSize>::getTilesY() const
+    {
+      return mTilesY;
+    }
+
+    template <typename T, int TileSize> int SparseGrid2D<T, TileSize>::getNumTiles() const
+    {
+      return mTilesX * mTilesY;
+    }
+
+    template <typename T, int TileSize> const T& SparseGrid2D<T, TileSize>::getBackground() const
+    {
+      return mBackground;
+    }
+
+    template <typename T, int TileSize> void SparseGrid2D<T, TileSize>::setBackground(const T& background)
+    {
+      mBackground = background;
+    }
+
+    template <typename T, int TileSize> int SparseGrid2D<T, TileSize>::getTile(int i, int j) const
+    {
+      // Cell coordinates are never negative, and dividing them as unsigned turns into shifts for square tiles
+
+      return static_cast<int>(static_cast<unsigned>(i) / kTileSize + (static_cast<unsigned>(j) / kTileSize) * mTilesX);
+    }
+
+    template <typename T, int TileSize> int SparseGrid2D<T, TileSize>::getTileOffset(int i, int j)
+    {
+      return static_cast<int>(static_cast<unsigned>(i) % kTileSize +
+                              (static_cast<unsigned>(j) % kTileSize) * kTileSize);
+    }
+
+    template <typename T, int TileSize> T SparseGrid2D<T, TileSize>::get(int i, int j) const
+    {
+      const T* data = getTileData(getTile(i, j));
+
+      return data ? data[getTileOffset(i, j)] : mBackground;
+    }
+
+    template <typename T, int TileSize>
+    void SparseGrid2D<T, TileSize>::get2x2(int i, int j, T& v00, T& v10, T& v01, T& v11) const
+    {
+      const int li = static_cast<int>(static_cast<unsigned>(i) % kTileSize);
+      const int lj = static_cast<int>(static_cast<unsigned>(j) % kTileSize);
+
+      if ((li == kTileSize - 1) || (lj == kTileSize - 1))
+      {
+        v00 = get(i, j);
+        v10 = get(i + 1, j);
+        v01 = get(i, j + 1);
+        v11 = get(i + 1, j + 1);
+        return;
+      }
+
+      const T* data = getTileData(getTile(i, j));
+
+      if (!data)
+      {
+        v00 = v10 = v01 = v11 = mBackground;
+        return;
+      }
+
+      const T* row = data + li + lj * kTileSize;
+
+      v00 = row[0];
+      v10 = row[1];
+      v01 = row[kTileSize];
+      v11 = row[kTileSize + 1];
+    }
+
+    template <typename T, int TileSize> T& SparseGrid2D<T, TileSize>::at(int i, int j)
+    {
+      const int tile = getTile(i, j);
+      T* data = getTileData(tile);
+
+      if (!data)
+      {
+        data = allocateTile(tile);
+      }
+
+      return data[getTileOffset(i, j)];
+    }
+
+    template <typename T, int TileSize> T* SparseGrid2D<T, TileSize>::getTileData(int tile)
+    {
+      return mTileData[tile];
+    }
+
+    template <typename T, int TileSize> const T* SparseGrid2D<T, TileSize>::getTileData(int tile) const
+    {
+      return mTileData[tile];
+    }
+
+    template <typename T, int TileSize> void SparseGrid2D<T, TileSize>::fill(const T& value)
+    {
+      for (int tile : mAllocatedTiles)
+      {
+        std::fill(mTileData[tile], mTileData[tile] + kTileCells, value);
+      }
+    }
+
+    template <typename T, int TileSize> void SparseGrid2D<T, TileSize>::copyTo(T* values) const
+    {
+      std::fill(values, values + mWidth * mHeight, mBackground);
+
+      for (int tile : mAllocatedTiles)
+      {
+        const int i0 = (tile % mTilesX) * kTileSize;
+        const int j0 = (tile / mTilesX) * kTileSize;
+        const int i1 = std::min(i0 + kTileSize, mWidth);
+        const int j1 = std::min(j0 + kTileSize, mHeight);
+
+        for (int j = j0; j < j1; j++)
+        {
+          const T* row = mTileData[tile] + (j - j0) * kTileSize;
+
+          std::copy(row, row + (i1 - i0), values + i0 + j * mWidth);
+        }
+      }
+    }
+
+    template <typename T, int TileSize> T* SparseGrid2D<T, TileSize>::allocateTile(int tile)
+    {
+      if (mTileBlock[tile] >= 0)
+      {
+        return getTileData(tile);
+      }
+
+      // Blocks come in chunks, so that growing the pool never moves the blocks already handed out
+
+      if (mFreeBlocks.empty())
+      {
+        const int firstBlock = static_cast<int>(mChunks.size()) * mBlocksPerChunk;
+
+        mChunks.push_back(std::unique_ptr<T[]>(new T[mBlocksPerChunk * kTileCells]));
+
+        for (int b = mBlocksPerChunk - 1; b >= 0; b--)
+        {
+          mFreeBlocks.push_back(firstBlock + b);
+        }
+      }
+
+      const int block = mFreeBlocks.back();
+
+      mTileBlock[tile] = block;
+      mTileData[tile] = mChunks[block / mBlocksPerChunk].get() + (block % mBlocksPerChunk) * kTileCells;
+      mFreeBlocks.pop_back();
+
+      mTileListIndex[tile] = static_cast<int>(mAllocatedTiles.size());
+      mAllocatedTiles.push_back(tile);
+
+      T* data = mTileData[tile];
+      std::fill(data, data + kTileCells, mBackground);
+
+      return data;
+    }
+
+    template <typename T, int TileSize> void SparseGrid2D<T, TileSize>::releaseTile(int tile)
+    {
+      if (mTileBlock[tile] < 0)
+      {
+        return;
+      }
+
+      // The last tile of the list takes the place of the released one
+
+      const int listIndex = mTileListIndex[tile];
+      const int lastTile = mAllocatedTiles.back();
+
+      mAllocatedTiles[listIndex] = lastTile;
+      mTileListIndex[lastTile] = listIndex;
+      mAllocatedTiles.pop_back();
+
+      mFreeBlocks.push_back(mTileBlock[tile]);
+      mTileData[tile] = nullptr;
+      mTileBlock[tile] = -1;
+      mTileListIndex[tile] = -1;
+    }
+
+    template <typename T, int TileSize> void SparseGrid2D<T, TileSize>::clear()
+    {
+      for (int tile : mAllocatedTiles)
+      {
+        mFreeBlocks.push_back(mTileBlock[tile]);
+        mTileData[tile] = nullptr;
+        mTileBlock[tile] = -1;
+        mTileListIndex[tile] = -1;
+      }
+
+      mAllocatedTiles.clear();
+    }
+
+    template <typename T, int TileSize> const std::vector<int>& SparseGrid2D<T, TileSize>::getAllocatedTiles() const
+    {
+      return mAllocatedTiles;
+    }
+
+    template <typename T, int TileSize> std::size_t SparseGrid2D<T, TileSize>::getMemoryUsage() const
+    {
+      return mChunks.size() * mBlocksPerChunk * kTileCells * sizeof(T) + mTileData.size() * sizeof(T*) +
+             (mTileBlock.size() + mTileListIndex.size() + mAllocatedTiles.capacity() + mFreeBlocks.capacity()) *
+             sizeof(int);
+    }
+  }
+}
+
+#endif  // SRC_PHYSICS_FLUIDS_SPARSEGRID2D_H_
@@ -8,6 +8,7 @@
 
 #include "math/Utils.hpp"
 #include "renderer/assets/ResourceLoader.hpp"
+#include "trace/TraceRecorder.hpp"
 
 namespace mk
 {
@@ -74,6 +75,8 @@ namespace mk
 
     void Ocean::update(float t)
     {
+      MK_TRACE_SCOPE("ocean", "Ocean::update");
+
       const glm::uvec2 meshSize(mRectPatch.getWidth(), mRectPatch.getHeight());
       const glm::vec2 oceanLength(mLength.x, mLength.y);
 
@@ -98,11 +101,15 @@ namespace mk
 
       // Perform FFT
 
-      mFFTSolver.fftInv2D(mDevGpuSpectrumIn, mDevGpuSpectrumOut, mSize.x, mSize.y);
-      mFFTSolver.fftInv2D(mDevDispXIn, mDevDispXOut, mSize.x, mSize.y);
-      mFFTSolver.fftInv2D(mDevDispZIn, mDevDispZOut, mSize.x, mSize.y);
-      mFFTSolver.fftInv2D(mDevGradXIn, mDevGradXOut, mSize.x, mSize.y);
-      mFFTSolver.fftInv2D(mDevGradZIn, mDevGradZOut, mSize.x, mSize.y);
+      {
+        MK_TRACE_SCOPE("ocean", "fft");
+
+        mFFTSolver.fftInv2D(mDevGpuSpectrumIn, mDevGpuSpectrumOut, mSize.x, mSize.y);
+        mFFTSolver.fftInv2D(mDevDispXIn, mDevDispXOut, mSize.x, mSize.y);
+        mFFTSolver.fftInv2D(mDevDispZIn, mDevDispZOut, mSize.x, mSize.y);
+        mFFTSolver.fftInv2D(mDevGradXIn, mDevGradXOut, mSize.x, mSize.y);
+        mFFTSolver.fftInv2D(mDevGradZIn, mDevGradZOut, mSize.x, mSize.y);
+      }
 
       // Update mesh position
 
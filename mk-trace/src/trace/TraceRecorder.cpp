@@ -0,0 +1,245 @@
+#include "TraceRecorder.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace mk
+{
+  namespace trace
+  {
+    namespace
+    {
+      const int kProcessId = 1;
+
+      void writeJsonString(std::ostream& out, const char* text)
+      {
+        out << '"';
+
+        for (const char* c = text; *c; c++)
+        {
+          if ((*c == '"') || (*c == '\\'))
+          {
+            out << '\\' << *c;
+          }
+          else if (static_cast<unsigned char>(*c) >= 0x20)
+          {
+            out << *c;
+          }
+        }
+
+        out << '"';
+      }
+
+      void writeMicroseconds(std::ostream& out, std::int64_t nanoseconds)
+      {
+        // Trace viewers expect microseconds, the nanoseconds are kept as decimals
+
+        char text[32];
+        std::snprintf(text, sizeof(text), "%lld.%03lld", static_cast<long long>(nanoseconds / 1000),
+                      static_cast<long long>(nanoseconds % 1000));
+        out << text;
+      }
+    }
+
+    TraceRecorder::ThreadBuffer::ThreadBuffer(int id, int capacity)
+    : id(id),
+      name(),
+      events(capacity),
+      head(0)
+    {
+    }
+
+    TraceRecorder& TraceRecorder::get()
+    {
+      static TraceRecorder recorder;
+
+      return recorder;
+    }
+
+    TraceRecorder::TraceRecorder()
+    : mEpoch(std::chrono::steady_clock::now()),
+      mEnabled(true),
+      mBufferCapacity(kDefaultBufferCapacity),
+      mBuffersMutex(),
+      mBuffers()
+    {
+    }
+
+    void TraceRecorder::setEnabled(bool enabled)
+    {
+      mEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool TraceRecorder::isEnabled() const
+    {
+      return mEnabled.load(std::memory_order_relaxed);
+    }
+
+    void TraceRecorder::setBufferCapacity(int capacity)
+    {
+      mBufferCapacity.store(std::max(1, capacity), std::memory_order_relaxed);
+    }
+
+    int TraceRecorder::getBufferCapacity() const
+    {
+      return mBufferCapacity.load(std::memory_order_relaxed);
+    }
+
+    void TraceRecorder::setThreadName(const std::string& name)
+    {
+      ThreadBuffer& buffer = getThreadBuffer();
+
+      std::lock_guard<std::mutex> lock(mBuffersMutex);
+      buffer.name = name;
+    }
+
+    void TraceRecorder::begin(const char* category, const char* name)
+    {
+      if (mEnabled.load(std::memory_order_relaxed))
+      {
+        record(category, name, 'B');
+      }
+    }
+
+    void TraceRecorder::end(const char* category, const char* name)
+    {
+      if (mEnabled.load(std::memory_order_relaxed))
+      {
+        record(category, name, 'E');
+      }
+    }
+
+    void TraceRecorder::clear()
+    {
+      std::lock_guard<std::mutex> lock(mBuffersMutex);
+
+      for (const std::unique_ptr<ThreadBuffer>& buffer : mBuffers)
+      {
+        buffer->head.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    void TraceRecorder::writeChromeTrace(std::ostream& out) const
+    {
+      std::lock_guard<std::mutex> lock(mBuffersMutex);
+
+      bool first = true;
+
+      out << "{\"traceEvents\":[";
+
+      for (const std::unique_ptr<ThreadBuffer>& buffer : mBuffers)
+      {
+        if (!buffer->name.empty())
+        {
+          out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << kProcessId
+              << ",\"tid\":" << buffer->id << ",\"args\":{\"name\":";
+          writeJsonString(out, buffer->name.c_str());
+          out << "}}";
+          first = false;
+        }
+
+        // Only the last events fit in the ring, so the ends of scopes whose beginning was overwritten are dropped
+
+        const std::uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const std::uint64_t capacity = buffer->events.size();
+        const std::uint64_t tail = (head > capacity) ? (head - capacity) : 0;
+
+        int depth = 0;
+
+        for (std::uint64_t e = tail; e < head; e++)
+        {
+          const Event& event = buffer->events[e % capacity];
+
+          if (event.phase == 'E')
+          {
+            if (depth == 0)
+            {
+              continue;
+            }
+
+            --depth;
+          }
+          else
+          {
+            ++depth;
+          }
+
+          out << (first ? "\n" : ",\n") << "{\"name\":";
+          writeJsonString(out, event.name);
+          out << ",\"cat\":";
+          writeJsonString(out, event.category);
+          out << ",\"ph\":\"" << event.phase << "\",\"ts\":";
+          writeMicroseconds(out, event.timestamp);
+          out << ",\"pid\":" << kProcessId << ",\"tid\":" << buffer->id << "}";
+          first = false;
+        }
+      }
+
+      out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+    bool TraceRecorder::writeChromeTrace(const std::string& path) const
+    {
+      std::ofstream file(path.c_str());
+
+      if (!file)
+      {
+        return false;
+      }
+
+      writeChromeTrace(file);
+
+      return static_cast<bool>(file);
+    }
+
+    TraceRecorder::ThreadBuffer& TraceRecorder::getThreadBuffer()
+    {
+      // The buffers are owned by the recorder, so the events of a thread outlive it
+
+      static thread_local ThreadBuffer* threadBuffer = nullptr;
+
+      if (!threadBuffer)
+      {
+        std::lock_guard<std::mutex> lock(mBuffersMutex);
+
+        const int id = static_cast<int>(mBuffers.size());
+
+        mBuffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer(id, getBufferCapacity())));
+        threadBuffer = mBuffers.back().get();
+      }
+
+      return *threadBuffer;
+    }
+
+    void TraceRecorder::record(const char* category, const char* name, char phase)
+    {
+      // Only the owning thread writes to a buffer, the release store publishes the event to the writer of the trace
+
+      ThreadBuffer& buffer = getThreadBuffer();
+
+      const std::uint64_t head = buffer.head.load(std::memory_order_relaxed);
+      Event& event = buffer.events[head % buffer.events.size()];
+
+      event.category = category;
+      event.name = name;
+      event.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                             mEpoch).count();
+      event.phase = phase;
+
+      buffer.head.store(head + 1, std::memory_order_release);
+    }
+
+    TraceScope::TraceScope(const char* category, const char* name)
+    : mCategory(category),
+      mName(name)
+    {
+      TraceRecorder::get().begin(category, name);
+    }
+
+    TraceScope::~TraceScope()
+    {
+      TraceRecorder::get().end(mCategory, mName);
+    }
+  }
+}
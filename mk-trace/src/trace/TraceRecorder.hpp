@@ -0,0 +1,148 @@
+#ifndef SRC_TRACE_TRACERECORDER_H_
+#define SRC_TRACE_TRACERECORDER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Trace scopes are only compiled in when MK_TRACING is defined, otherwise they expand to nothing. Names and
+// categories must be string literals, or any other string living until the trace is written.
+#ifdef MK_TRACING
+#define MK_TRACE_CONCAT_IMPL(a, b) a##b
+#define MK_TRACE_CONCAT(a, b) MK_TRACE_CONCAT_IMPL(a, b)
+#define MK_TRACE_SCOPE(category, name) mk::trace::TraceScope MK_TRACE_CONCAT(traceScope, __LINE__)(category, name)
+#define MK_TRACE_THREAD_NAME(name) mk::trace::TraceRecorder::get().setThreadName(name)
+#else
+#define MK_TRACE_SCOPE(category, name)
+#define MK_TRACE_THREAD_NAME(name)
+#endif
+
+namespace mk
+{
+  namespace trace
+  {
+    /**
+     * Records begin and end events of the scopes run by every thread of the process, and writes them in the
+     * Chrome trace event format, which can be loaded in chrome://tracing or other trace viewers.
+     *
+     * Every thread writes to its own ring buffer, created the first time the thread records an event, so
+     * recording takes no lock and never allocates afterwards. Once a buffer is full the oldest events of the
+     * thread are overwritten. Writing the trace reads the buffers of all threads, and should be done while no
+     * thread is recording, e.g. after the work being traced has finished.
+     */
+    class TraceRecorder
+    {
+    public:
+      static const int kDefaultBufferCapacity = 1 << 16;
+
+    public:
+      /**
+       * @return The recorder of the process.
+       */
+      static TraceRecorder& get();
+
+      TraceRecorder(const TraceRecorder&) = delete;
+      TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+      /**
+       * @param enabled Whether events are recorded. Recording is enabled by default.
+       */
+      void setEnabled(bool enabled);
+      bool isEnabled() const;
+
+      /**
+       * @param capacity Number of events kept per thread, used by the buffers of threads that did not record any
+       *                 event yet. Values under 1 are clamped to 1.
+       */
+      void setBufferCapacity(int capacity);
+      int getBufferCapacity() const;
+
+      /**
+       * Sets the name the calling thread is shown with in the trace.
+       */
+      void setThreadName(const std::string& name);
+
+      /**
+       * Records the beginning of a scope in the calling thread.
+       */
+      void begin(const char* category, const char* name);
+
+      /**
+       * Records the end of the last scope begun in the calling thread.
+       */
+      void end(const char* category, const char* name);
+
+      /**
+       * Drops the events recorded so far. Must not be called while any thread is recording.
+       */
+      void clear();
+
+      /**
+       * Writes the recorded events as a Chrome trace JSON object.
+       */
+      void writeChromeTrace(std::ostream& out) const;
+
+      /**
+       * Writes the recorded events as a Chrome trace JSON file.
+       *
+       * @return True if the file was written, false otherwise.
+       */
+      bool writeChromeTrace(const std::string& path) const;
+
+    private:
+      struct Event
+      {
+        const char* category;
+        const char* name;
+        std::int64_t timestamp;
+        char phase;
+      };
+
+      struct ThreadBuffer
+      {
+        ThreadBuffer(int id, int capacity);
+
+        int id;
+        std::string name;
+        std::vector<Event> events;
+        std::atomic<std::uint64_t> head;
+      };
+
+    private:
+      TraceRecorder();
+
+      ThreadBuffer& getThreadBuffer();
+      void record(const char* category, const char* name, char phase);
+
+    private:
+      std::chrono::steady_clock::time_point mEpoch;
+      std::atomic<bool> mEnabled;
+      std::atomic<int> mBufferCapacity;
+      mutable std::mutex mBuffersMutex;
+      std::vector<std::unique_ptr<ThreadBuffer> > mBuffers;
+    };
+
+    /**
+     * Records a scope of the calling thread, from its construction to its destruction.
+     */
+    class TraceScope
+    {
+    public:
+      TraceScope(const char* category, const char* name);
+      TraceScope(const TraceScope&) = delete;
+      TraceScope& operator=(const TraceScope&) = delete;
+      ~TraceScope();
+
+    private:
+      const char* mCategory;
+      const char* mName;
+    };
+  }
+}
+
+#endif  // SRC_TRACE_TRACERECORDER_H_
@@ -13,6 +13,7 @@
 #include "renderer/scene/Camera.hpp"
 #include "renderer/scene/Skybox.hpp"
 #include "demofw/glfw/BaseDemoApp.hpp"
+#include "trace/TraceRecorder.hpp"
 
 using namespace mk;
 
@@ -107,5 +108,9 @@ int main(void)
   oceanDemo.hideMouseCursor();
   oceanDemo.doRenderLoop();
 
+#ifdef MK_TRACING
+  mk::trace::TraceRecorder::get().writeChromeTrace("ocean-demo.trace.json");
+#endif
+
   return 0;
 }